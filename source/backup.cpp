@@ -12,8 +12,62 @@
 #include <cstdlib>
 #include <ctime>
 #include <set>
+#include <bitset>
+#include <map>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <string_view>
+#include <array>
+#include <cerrno>
+#include <csignal>
+#include <cmath>
 #ifdef _WIN32
 #include <windows.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <poll.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <sys/inotify.h>
+#include <sys/uio.h>
+#include <sys/vfs.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define BACKUP_URING 1
+#endif
+#include <linux/fs.h>
+#endif
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define BACKUP_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define BACKUP_TARGET_AVX2
+#define BACKUP_TARGET_SSE41
+#else
+#define BACKUP_TARGET_AVX2 __attribute__((target("avx2")))
+#define BACKUP_TARGET_SSE41 __attribute__((target("sse4.1")))
+#endif
+#else
+#define BACKUP_X86 0
 #endif
 
 namespace fs = std::filesystem;
@@ -21,16 +75,24 @@ using namespace std;
 
 const string BACKUP_VERSION = "1.1.2";
 
-// Function prototype for logAction
-void logAction(const std::string& entry);
+//* log verbosity (`log-level` in .backup/__init__): errors only, commands and summaries, or also one line per file
+enum LogLevel { LOG_ERRORS = 0, LOG_INFO = 1, LOG_FILES = 2 };
+
+// Function prototypes for the logger
+void logAction(const std::string& entry, int level = LOG_INFO);
+void flushLogs();
 
 //* function to get a timestamp
 string getTimestamp() {
     auto now = chrono::system_clock::now();
     time_t t = chrono::system_clock::to_time_t(now);
     tm localTime;
+#ifdef _WIN32
     localtime_s(&localTime, &t);
-    
+#else
+    localtime_r(&t, &localTime);
+#endif
+
     stringstream ss;
     ss << put_time(&localTime, "%Y-%m-%d_%H-%M-%S");
     return ss.str();
@@ -89,6 +151,272 @@ bool isBackupInitialized() {
     return false;
 }
 
+//* function to read `key: value` settings from .backup/__init__
+map<string, string> readBackupConfig(const fs::path& file = ".backup/__init__") {
+    map<string, string> config;
+    ifstream metaFile(file);
+    string line;
+    while (getline(metaFile, line)) {
+        size_t colon = line.find(':');
+        if (colon == string::npos) continue;
+        string value = line.substr(colon + 1);
+        value.erase(0, value.find_first_not_of(" \t"));
+        value.erase(value.find_last_not_of(" \t\r") + 1);
+        config[line.substr(0, colon)] = value;
+    }
+    return config;
+}
+
+//* function to get a numeric setting from the config, with a default
+uint64_t configNumber(const map<string, string>& config, const string& key, uint64_t fallback) {
+    auto it = config.find(key);
+    if (it == config.end() || it->second.empty()) return fallback;
+    try {
+        return stoull(it->second);
+    } catch (...) {
+        throw runtime_error("Invalid number for `" + key + "` in .backup/__init__: " + it->second);
+    }
+}
+
+//* counters and timers of the current run; relaxed atomics bumped a few times per file or chunk, cheap
+//* enough to stay on all the time. Phase times of the worker stages are summed over all threads
+struct RunStats {
+    enum Counter {
+        FilesScanned, FoldersScanned, BytesScanned, EntriesIgnored, FilesUnchanged, FilesChanged, FilesDeduped,
+        BytesRead, ChunksNew, BytesNew, BytesWritten, FilesRestored, BytesRestored, LogLines, ChunksCompressed,
+        BytesBeforeCompression, BytesAfterCompression, FilesCurrent, HashCacheHits, HashCacheMisses,
+        ObjectsVerified, ObjectsCorrupt, SnapshotsPruned, ObjectsDeleted, BytesFreed, BytesInHoles,
+        BytesRestoredAsHoles, SparseFiles, BytesInSparseFiles, COUNTERS
+    };
+    enum Phase { Scan, Ignore, Read, Hash, Write, Compress, Manifest, Restore, Log, Throttle, Total, PHASES };
+    static constexpr int SIZE_CLASSES = 6;       // <4K, <64K, <1M, <16M, <256M, larger
+    static constexpr int LATENCY_BUCKETS = 20;   // bucket b counts files below 2^b microseconds, the last is open
+
+    string command;
+    atomic<uint64_t> counters[COUNTERS];
+    atomic<uint64_t> phaseNs[PHASES];
+    atomic<uint64_t> latency[SIZE_CLASSES][LATENCY_BUCKETS];
+
+    static const char* counterName(int c) {
+        static const char* names[COUNTERS] = {"files_scanned", "folders_scanned", "bytes_scanned", "entries_ignored",
+                                              "files_unchanged", "files_changed", "files_deduped", "bytes_read",
+                                              "chunks_new", "bytes_new", "bytes_written", "files_restored",
+                                              "bytes_restored", "log_lines", "chunks_compressed",
+                                              "bytes_before_compression", "bytes_after_compression",
+                                              "files_already_current", "hash_cache_hits", "hash_cache_misses",
+                                              "objects_verified", "objects_corrupt", "snapshots_pruned",
+                                              "objects_deleted", "bytes_freed", "bytes_in_holes",
+                                              "bytes_restored_as_holes", "sparse_files", "bytes_in_sparse_files"};
+        return names[c];
+    }
+    static const char* phaseName(int p) {
+        static const char* names[PHASES] = {"scan",     "ignore",  "read", "hash",      "write", "compress",
+                                            "manifest", "restore", "log",  "throttled", "total"};
+        return names[p];
+    }
+    static const char* sizeClassName(int s) {
+        static const char* names[SIZE_CLASSES] = {"<4K", "4K-64K", "64K-1M", "1M-16M", "16M-256M", ">=256M"};
+        return names[s];
+    }
+
+    void reset(const string& cmd) {
+        command = cmd;
+        for (auto& c : counters) c.store(0, memory_order_relaxed);
+        for (auto& p : phaseNs) p.store(0, memory_order_relaxed);
+        for (auto& row : latency) {
+            for (auto& b : row) b.store(0, memory_order_relaxed);
+        }
+    }
+
+    void add(Counter c, uint64_t n = 1) { counters[c].fetch_add(n, memory_order_relaxed); }
+
+    void addTime(Phase p, chrono::steady_clock::duration d) {
+        phaseNs[p].fetch_add(uint64_t(chrono::duration_cast<chrono::nanoseconds>(d).count()), memory_order_relaxed);
+    }
+
+    //* function to put one file's processing time into the histogram of its size class
+    void recordFile(uint64_t size, chrono::steady_clock::duration d) {
+        int sizeClass = 0;
+        for (uint64_t limit = 4096; sizeClass < SIZE_CLASSES - 1 && size >= limit; limit <<= 4) ++sizeClass;
+        uint64_t us = uint64_t(chrono::duration_cast<chrono::microseconds>(d).count());
+        int bucket = 0;
+        while (bucket < LATENCY_BUCKETS - 1 && us >= (uint64_t(1) << bucket)) ++bucket;
+        latency[sizeClass][bucket].fetch_add(1, memory_order_relaxed);
+    }
+};
+
+RunStats& runStats() {
+    static RunStats stats;
+    return stats;
+}
+
+//* adds the time until the end of the scope to one phase of the run stats
+struct PhaseTimer {
+    RunStats::Phase phase;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    explicit PhaseTimer(RunStats::Phase p) : phase(p) {}
+    ~PhaseTimer() { runStats().addTime(phase, chrono::steady_clock::now() - start); }
+};
+
+const char* STATS_FILE = ".backup/__stats__";
+
+//* set when a command failed; main turns it into exit status 1 (the scheduler and scripts check that)
+bool commandFailed = false;
+
+//* function to save the stats of the run that just ended to .backup/__stats__ (key: value lines like __init__)
+void saveRunStats(bool ok) {
+    if (!ok) commandFailed = true;
+    RunStats& stats = runStats();
+    ofstream out(STATS_FILE, ios::trunc);
+    if (!out) return;
+    out << "command: " << stats.command << "\n";
+    out << "result: " << (ok ? "ok" : "error") << "\n";
+    out << "finished: " << getTimestamp() << "\n";
+    for (int c = 0; c < RunStats::COUNTERS; ++c) out << "counter." << RunStats::counterName(c) << ": " << stats.counters[c] << "\n";
+    for (int p = 0; p < RunStats::PHASES; ++p) out << "phase_ns." << RunStats::phaseName(p) << ": " << stats.phaseNs[p] << "\n";
+    for (int s = 0; s < RunStats::SIZE_CLASSES; ++s) {
+        out << "latency." << RunStats::sizeClassName(s) << ":";
+        for (int b = 0; b < RunStats::LATENCY_BUCKETS; ++b) out << " " << stats.latency[s][b];
+        out << "\n";
+    }
+}
+
+//* function to print the stats of the last `backup do` / `backup pull`, as a table or as JSON for monitoring
+void showStats(bool json) {
+    if (!fs::exists(STATS_FILE)) {
+        cout << "No stats recorded yet, run `backup do` or `backup pull` first." << endl;
+        return;
+    }
+    map<string, string> saved = readBackupConfig(STATS_FILE);
+    auto number = [&saved](const string& key) { return configNumber(saved, key, 0); };
+    vector<vector<uint64_t>> latency;
+    for (int s = 0; s < RunStats::SIZE_CLASSES; ++s) {
+        istringstream row(saved["latency." + string(RunStats::sizeClassName(s))]);
+        vector<uint64_t> buckets(RunStats::LATENCY_BUCKETS, 0);
+        for (auto& b : buckets) row >> b;
+        latency.push_back(buckets);
+    }
+    double seconds = number("phase_ns.total") / 1e9;
+    uint64_t files = number("counter.files_scanned") + number("counter.files_restored");
+    uint64_t bytes = number("counter.bytes_read") + number("counter.bytes_restored");
+    double filesPerSec = seconds > 0 ? files / seconds : 0;
+    double mbPerSec = seconds > 0 ? bytes / seconds / 1e6 : 0;
+    uint64_t cacheLookups = number("counter.hash_cache_hits") + number("counter.hash_cache_misses");
+    double cacheHitRate = cacheLookups ? double(number("counter.hash_cache_hits")) / cacheLookups : 0;
+    // upper bound of the bucket holding the given fraction of files, in microseconds (0 = open last bucket)
+    auto percentile = [](const vector<uint64_t>& buckets, double fraction) {
+        uint64_t total = 0, seen = 0;
+        for (uint64_t b : buckets) total += b;
+        for (int b = 0; b < RunStats::LATENCY_BUCKETS; ++b) {
+            seen += buckets[b];
+            if (total > 0 && seen >= fraction * total) return b == RunStats::LATENCY_BUCKETS - 1 ? uint64_t(0) : uint64_t(1) << b;
+        }
+        return uint64_t(0);
+    };
+
+    cout << fixed << setprecision(3);
+    if (json) {
+        cout << "{\"command\":\"" << saved["command"] << "\",\"result\":\"" << saved["result"] << "\",\"finished\":\""
+             << saved["finished"] << "\",\"counters\":{";
+        for (int c = 0; c < RunStats::COUNTERS; ++c) {
+            cout << (c ? "," : "") << "\"" << RunStats::counterName(c) << "\":" << number("counter." + string(RunStats::counterName(c)));
+        }
+        cout << "},\"phases_ms\":{";
+        for (int p = 0; p < RunStats::PHASES; ++p) {
+            cout << (p ? "," : "") << "\"" << RunStats::phaseName(p) << "\":" << number("phase_ns." + string(RunStats::phaseName(p))) / 1e6;
+        }
+        cout << "},\"throughput\":{\"files_per_sec\":" << filesPerSec << ",\"mb_per_sec\":" << mbPerSec << "}";
+        cout << ",\"hash_cache\":{\"hit_rate\":" << cacheHitRate << "}";
+        cout << ",\"latency_us\":{\"bucket_upper_bounds\":[";
+        for (int b = 0; b < RunStats::LATENCY_BUCKETS - 1; ++b) cout << (b ? "," : "") << (uint64_t(1) << b);
+        cout << "],\"size_classes\":{";
+        for (int s = 0; s < RunStats::SIZE_CLASSES; ++s) {
+            cout << (s ? "," : "") << "\"" << RunStats::sizeClassName(s) << "\":[";
+            for (int b = 0; b < RunStats::LATENCY_BUCKETS; ++b) cout << (b ? "," : "") << latency[s][b];
+            cout << "]";
+        }
+        cout << "}}}" << endl;
+        return;
+    }
+
+    cout << "Last run: backup " << saved["command"] << " (" << saved["result"] << ", finished " << saved["finished"] << ")\n";
+    cout << "  Counters:\n";
+    for (int c = 0; c < RunStats::COUNTERS; ++c) {
+        cout << "    " << left << setw(26) << RunStats::counterName(c) << right << setw(16)
+             << number("counter." + string(RunStats::counterName(c))) << "\n";
+    }
+    cout << "  Phases in ms (read/hash/write/compress/ignore/log are summed over threads, write includes compress):\n";
+    for (int p = 0; p < RunStats::PHASES; ++p) {
+        cout << "    " << left << setw(26) << RunStats::phaseName(p) << right << setw(16)
+             << number("phase_ns." + string(RunStats::phaseName(p))) / 1e6 << "\n";
+    }
+    cout << "  Throughput: " << setprecision(1) << filesPerSec << " files/sec, " << mbPerSec << " MB/sec\n";
+    if (cacheLookups) cout << "  Hash cache: " << cacheHitRate * 100 << "% of " << cacheLookups << " files unchanged by identity and stamps\n";
+    cout << "  File latency per size class:\n";
+    for (int s = 0; s < RunStats::SIZE_CLASSES; ++s) {
+        uint64_t count = 0;
+        for (uint64_t b : latency[s]) count += b;
+        if (count == 0) continue;
+        auto bound = [](uint64_t us) { return us ? "< " + to_string(us) + " us" : string("open"); };
+        cout << "    " << left << setw(10) << RunStats::sizeClassName(s) << right << setw(10) << count
+             << " files   p50 " << bound(percentile(latency[s], 0.5)) << "   p99 " << bound(percentile(latency[s], 0.99)) << "\n";
+    }
+    cout << flush;
+}
+
+//* function to split a command line into arguments; "..." (as written by joinArgs) is one argument
+vector<string> splitArgs(const string& cmd) {
+    vector<string> args;
+    istringstream ss(cmd);
+    string arg;
+    while (ss >> quoted(arg)) args.push_back(arg);
+    return args;
+}
+
+//* function to join arguments into a command line, quoting the ones splitArgs would otherwise cut apart
+//* (spaces, e.g. an --ignore pattern) or unquote (a leading '"')
+string joinArgs(int argc, char* argv[]) {
+    ostringstream cmd;
+    cmd << "backup";
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        bool plain = !arg.empty() && arg[0] != '"' && none_of(arg.begin(), arg.end(), [](unsigned char c) { return isspace(c); });
+        cmd << " ";
+        if (plain) cmd << arg;
+        else cmd << quoted(arg);
+    }
+    return cmd.str();
+}
+
+//* function to check if a flag was given (e.g. --json)
+bool hasArg(const vector<string>& args, const string& name) {
+    for (const auto& a : args) {
+        if (a == name || a.rfind(name + "=", 0) == 0) return true;
+    }
+    return false;
+}
+
+//* function to get the value of `--name value` or `--name=value`, or the fallback
+string argValue(const vector<string>& args, const string& name, const string& fallback) {
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (args[i] == name && i + 1 < args.size()) return args[i + 1];
+        if (args[i].rfind(name + "=", 0) == 0) return args[i].substr(name.size() + 1);
+    }
+    return fallback;
+}
+
+//* function to get a numeric argument value
+uint64_t argNumber(const vector<string>& args, const string& name, uint64_t fallback) {
+    string value = argValue(args, name, "");
+    if (value.empty()) return fallback;
+    try {
+        return stoull(value);
+    } catch (...) {
+        throw runtime_error("Invalid number for " + name + ": " + value);
+    }
+}
+
 //* function to show version
 void showVersion() {
     cout << ".backup Version: " << BACKUP_VERSION << endl;
@@ -112,6 +440,7 @@ string getLogDir() {
 
 void printLogs() {
     try {
+        flushLogs();
         string logDir = getLogDir();
         string logFile = logDir + "/.backup-logs";
         ifstream log(logFile);
@@ -131,6 +460,7 @@ void printLogs() {
 
 void copyLogsToCurrentDir() {
     try {
+        flushLogs();
         string logDir = getLogDir();
         string logFile = logDir + "/.backup-logs";
         string destFile = "./.backup-logs";
@@ -147,203 +477,7836 @@ void copyLogsToCurrentDir() {
 
 
 
-//* function to read .backupignore patterns
-set<string> readBackupIgnore() {
-    set<string> ignore;
-    ifstream ignoreFile(".backupignore");
-    string line;
-    while (getline(ignoreFile, line)) {
-        // Trim whitespace
-        line.erase(line.begin(), find_if(line.begin(), line.end(), [](unsigned char ch) { return !isspace(ch); }));
-        line.erase(find_if(line.rbegin(), line.rend(), [](unsigned char ch) { return !isspace(ch); }).base(), line.end());
-        if (line.empty() || line[0] == '#') continue;
-        // If the line is a directory, add all files in that directory
-        if (fs::is_directory(line)) {
-            for (const auto& entry : fs::directory_iterator(line)) {
-                ignore.insert(entry.path().filename().string());
-            }
-        } else {
-            ignore.insert(line);
-        }
-    }
-    return ignore;
-}
+//* one compiled .backupignore line; a pattern is a list of path segments, each segment a list of tokens
+struct IgnoreRule {
+    enum TokenKind : uint8_t { Char, AnyChar, Star, Class };
+    struct Token {
+        TokenKind kind;
+        uint8_t ch;          // Char: the byte to match
+        uint16_t classIndex; // Class: index into classes
+    };
+    struct Segment {
+        bool anyDepth = false;  // `**`: zero or more whole segments
+        vector<Token> tokens;
+    };
 
-//* function to create a backup safely (with .backupignore support)
-void createBackup() {
-    try {
-        set<string> ignore = readBackupIgnore();
-        string backupDir = ".backup/Backup_" + getTimestamp();
-        fs::create_directories(backupDir);
-        logAction("Created backup directory: " + backupDir);
+    string text;            // the line as written, for logs
+    bool negate = false;    // `!pattern` re-includes
+    bool dirOnly = false;   // `pattern/` only matches folders
+    bool anchored = false;  // contains a `/`: matched against the whole relative path, else against the name
+    vector<Segment> segments;
+    vector<bitset<256>> classes;
+};
 
-        // The backup is created inside the .backup directory, which is in the current working directory.
-        // Files and folders from the current directory (except those in .backupignore and .backup itself) are copied.
-
-        for (const auto& file : fs::directory_iterator(".")) {
-            string filename = file.path().filename().string();
-            if (filename == ".backup") continue;
-            if (filename == ".backupignore") {
-                // Always include .backupignore in backup
-            } else if (ignore.count(filename)) {
-                logAction("Ignored by .backupignore: " + filename);
+//* function to match one path segment (no '/') against compiled tokens; `*` backtracks to the last star only
+bool matchIgnoreSegment(const IgnoreRule& rule, const vector<IgnoreRule::Token>& tokens, string_view s) {
+    size_t p = 0, t = 0, starP = string::npos, starT = 0;
+    while (t < s.size()) {
+        if (p < tokens.size() && tokens[p].kind == IgnoreRule::Star) {
+            starP = p++;
+            starT = t;
+            continue;
+        }
+        if (p < tokens.size()) {
+            const IgnoreRule::Token& k = tokens[p];
+            unsigned char c = static_cast<unsigned char>(s[t]);
+            bool ok = k.kind == IgnoreRule::AnyChar || (k.kind == IgnoreRule::Char && k.ch == c) ||
+                      (k.kind == IgnoreRule::Class && rule.classes[k.classIndex].test(c));
+            if (ok) {
+                ++p;
+                ++t;
                 continue;
             }
-            fs::copy(file.path(), backupDir + "/" + filename, fs::copy_options::overwrite_existing | fs::copy_options::recursive);
-            logAction("Saved file to backup: " + filename + " -> " + backupDir + "/" + filename);
         }
-        cout << "Backup saved to: " << backupDir << endl;
-        logAction("Backup completed: " + backupDir);
-    } catch (const exception& e) {
-        cerr << "Error creating backup: " << e.what() << endl;
-        logAction(string("ERROR: ") + e.what());
+        if (starP == string::npos) return false;
+        p = starP + 1;
+        t = ++starT;
     }
+    while (p < tokens.size() && tokens[p].kind == IgnoreRule::Star) ++p;
+    return p == tokens.size();
 }
 
-//* function for automatic backups
-void autoBackup(int minutes) {
-    while (true) {
-        createBackup();
-        cout << "Waiting " << minutes << " minutes for the next backup..." << endl;
-        this_thread::sleep_for(chrono::minutes(minutes));
+//* function to match path segments against a rule; `**` segments backtrack the same way `*` does inside one
+bool matchIgnoreSegments(const IgnoreRule& rule, const vector<string_view>& parts) {
+    const auto& segs = rule.segments;
+    size_t p = 0, t = 0, starP = string::npos, starT = 0;
+    while (t < parts.size()) {
+        if (p < segs.size() && segs[p].anyDepth) {
+            starP = p++;
+            starT = t;
+            continue;
+        }
+        if (p < segs.size() && matchIgnoreSegment(rule, segs[p].tokens, parts[t])) {
+            ++p;
+            ++t;
+            continue;
+        }
+        if (starP == string::npos) return false;
+        p = starP + 1;
+        t = ++starT;
     }
+    while (p < segs.size() && segs[p].anyDepth) ++p;
+    return p == segs.size();
 }
 
-//* function to remove all backups
-void removeAllBackups() {
-    try {
-        fs::remove_all(".backup");
-        cout << "All backups removed." << endl;
-        logAction("All backups removed from .backup/");
-    } catch (const exception& e) {
-        cerr << "Error removing backups: " << e.what() << endl;
-        logAction(string("ERROR: ") + e.what());
+//* gitignore-compatible matcher for .backupignore, compiled once per backup: plain names and `*.ext`
+//* patterns are looked up in hash tables, globs are indexed by a literal they cannot match without
+//* (first folder, a whole segment, or a name prefix) so only a handful are tried per path; the last
+//* matching rule wins so `!pattern` can re-include. Matching runs during the scan, so an ignored folder
+//* is never opened and nothing below it can be re-included (same as git)
+struct IgnoreMatcher {
+    vector<IgnoreRule> rules;
+    unordered_map<string, vector<uint32_t>> byName;          // rules that are one literal name
+    unordered_map<string, vector<uint32_t>> bySuffix;        // `*.tar.gz` is found under ".gz"
+    vector<string> suffixes;                                 // per rule: the literal after `*`, for bySuffix rules
+    unordered_map<string, vector<uint32_t>> byFirstSegment;  // `/build/*.o` needs a path starting with build
+    unordered_map<string, vector<uint32_t>> bySegment;       // `**/cache/**` needs a folder named cache
+    unordered_map<string, vector<uint32_t>> byPrefix;        // `test[0-9]*` needs a name starting with test
+    vector<size_t> prefixLengths;
+    vector<uint32_t> globs;                                  // globs without any literal to index by
+
+    //* function to compile one .backupignore line
+    void add(string line) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        // trailing spaces are dropped unless escaped with a backslash
+        while (!line.empty() && line.back() == ' ' && !(line.size() >= 2 && line[line.size() - 2] == '\\')) line.pop_back();
+        if (line.empty() || line[0] == '#') return;
+        IgnoreRule rule;
+        rule.text = line;
+        size_t start = 0;
+        if (line[0] == '!') {
+            rule.negate = true;
+            start = 1;
+        } else if (line[0] == '\\' && line.size() > 1 && (line[1] == '#' || line[1] == '!')) {
+            start = 1;
+        }
+        string body = line.substr(start);
+        if (!body.empty() && body.back() == '/' && !(body.size() >= 2 && body[body.size() - 2] == '\\')) {
+            rule.dirOnly = true;
+            while (!body.empty() && body.back() == '/') body.pop_back();
+        }
+        if (body.empty()) return;
+        rule.anchored = body.find('/') != string::npos;
+        if (body[0] == '/') body.erase(0, 1);
+
+        string_view rest(body);
+        while (true) {
+            size_t slash = rest.find('/');
+            string_view seg = rest.substr(0, slash);
+            if (!seg.empty()) compileSegment(rule, seg);
+            if (slash == string_view::npos) break;
+            rest.remove_prefix(slash + 1);
+        }
+        if (rule.segments.empty()) return;
+        // `dir/**` matches what is inside dir but not dir itself: require at least one more segment
+        if (rule.segments.back().anyDepth) {
+            IgnoreRule::Segment one;
+            one.tokens.push_back({IgnoreRule::Star, 0, 0});
+            rule.segments.insert(rule.segments.end() - 1, one);
+        }
+
+        uint32_t index = static_cast<uint32_t>(rules.size());
+        suffixes.emplace_back();
+        if (!rule.anchored && rule.segments.size() == 1) {
+            const auto& tokens = rule.segments[0].tokens;
+            bool literal = all_of(tokens.begin(), tokens.end(), [](const IgnoreRule::Token& k) { return k.kind == IgnoreRule::Char; });
+            bool starLiteral = tokens.size() > 1 && tokens[0].kind == IgnoreRule::Star &&
+                               all_of(tokens.begin() + 1, tokens.end(), [](const IgnoreRule::Token& k) { return k.kind == IgnoreRule::Char; });
+            string text;
+            for (size_t i = literal ? 0 : 1; i < tokens.size(); ++i) text += static_cast<char>(tokens[i].ch);
+            if (literal) {
+                byName[text].push_back(index);
+            } else if (starLiteral && text.find('.') != string::npos) {
+                bySuffix[text.substr(text.rfind('.'))].push_back(index);
+                suffixes.back() = text;
+            } else {
+                indexGlob(rule, index);
+            }
+        } else {
+            indexGlob(rule, index);
+        }
+        rules.push_back(move(rule));
     }
-}
 
-//* function to restore from a backup directory
-void restoreBackup(const fs::path& backupDir) {
-    try {
-        for (const auto& file : fs::directory_iterator(backupDir)) {
-            fs::copy(file.path(), "./" + file.path().filename().string(), fs::copy_options::overwrite_existing);
-            logAction("Restored file: " + file.path().filename().string() + " from " + backupDir.string());
+    static string literalOf(const IgnoreRule::Segment& seg, bool prefixOnly) {
+        string text;
+        for (const auto& k : seg.tokens) {
+            if (k.kind != IgnoreRule::Char) return prefixOnly ? text : string();
+            text += static_cast<char>(k.ch);
         }
-        cout << "Restored from backup: " << backupDir.string() << endl;
-        logAction("Restored from backup: " + backupDir.string());
-    } catch (const exception& e) {
-        cerr << "Error restoring backup: " << e.what() << endl;
-        logAction(string("ERROR: ") + e.what());
+        return text;
     }
-}
 
-//* function to pull last backup
-void pullLastBackup() {
-    try {
-        vector<fs::directory_entry> backups;
-        if (fs::exists(".backup") && fs::is_directory(".backup")) {
-            for (const auto& entry : fs::directory_iterator(".backup")) {
-                if (fs::is_directory(entry)) backups.push_back(entry);
+    void indexGlob(const IgnoreRule& rule, uint32_t index) {
+        if (!rule.anchored) {
+            string prefix = literalOf(rule.segments[0], true);
+            if (prefix.empty()) {
+                globs.push_back(index);
+                return;
             }
-            sort(backups.begin(), backups.end(), [](const fs::directory_entry& a, const fs::directory_entry& b) {
-                return a.path().filename().string() > b.path().filename().string();
-            });
+            byPrefix[prefix].push_back(index);
+            if (find(prefixLengths.begin(), prefixLengths.end(), prefix.size()) == prefixLengths.end()) {
+                prefixLengths.push_back(prefix.size());
+            }
+            return;
+        }
+        string first = rule.segments[0].anyDepth ? string() : literalOf(rule.segments[0], false);
+        if (!first.empty()) {
+            byFirstSegment[first].push_back(index);
+            return;
+        }
+        for (const auto& seg : rule.segments) {
+            string literal = seg.anyDepth ? string() : literalOf(seg, false);
+            if (!literal.empty()) {
+                bySegment[literal].push_back(index);
+                return;
+            }
+        }
+        globs.push_back(index);
+    }
 
-            if (!backups.empty()) {
-                restoreBackup(backups[0].path());
+    static void compileSegment(IgnoreRule& rule, string_view seg) {
+        IgnoreRule::Segment out;
+        if (seg == "**") {
+            out.anyDepth = true;
+            rule.segments.push_back(out);
+            return;
+        }
+        for (size_t i = 0; i < seg.size(); ++i) {
+            char c = seg[i];
+            if (c == '\\' && i + 1 < seg.size()) {
+                out.tokens.push_back({IgnoreRule::Char, static_cast<uint8_t>(seg[++i]), 0});
+            } else if (c == '?') {
+                out.tokens.push_back({IgnoreRule::AnyChar, 0, 0});
+            } else if (c == '*') {
+                // `a**b` inside a segment behaves like `a*b`
+                if (out.tokens.empty() || out.tokens.back().kind != IgnoreRule::Star) out.tokens.push_back({IgnoreRule::Star, 0, 0});
+            } else if (c == '[') {
+                size_t end = i;
+                bitset<256> set;
+                if (!compileClass(seg, i, end, set)) {
+                    out.tokens.push_back({IgnoreRule::Char, static_cast<uint8_t>(c), 0});
+                    continue;
+                }
+                rule.classes.push_back(set);
+                out.tokens.push_back({IgnoreRule::Class, 0, static_cast<uint16_t>(rule.classes.size() - 1)});
+                i = end;
             } else {
-                cout << "No backups found." << endl;
+                out.tokens.push_back({IgnoreRule::Char, static_cast<uint8_t>(c), 0});
             }
         }
-    } catch (const exception& e) {
-        cerr << "Error pulling last backup: " << e.what() << endl;
+        rule.segments.push_back(move(out));
     }
-}
 
-//* function to show help menu
-void showHelp() {
-    cout << ".backup Commands:\n";
-    cout << "  backup init              -> Initialize backup system\n";
-    cout << "  backup do                -> Create a new backup\n";
-    cout << "  backup auto --min X      -> Auto backup every X minutes\n";
-    cout << "  backup remove --all      -> Delete all backups\n";
-    cout << "  backup pull --last       -> Restore from the last backup\n";
-    cout << "  backup meta              -> Show backup meta information\n";
-    cout << "  backup logs              -> Show backup logs\n";
-    cout << "  backup logs --copy       -> Copy logs to current directory\n";
-    cout << "  backup --version | --v   -> Show version\n";
-    cout << "  backup help              -> Show available commands\n";
-}
+    //* parses `[...]` starting at seg[begin]; returns false for an unterminated bracket (then it is a plain '[')
+    static bool compileClass(string_view seg, size_t begin, size_t& end, bitset<256>& set) {
+        size_t i = begin + 1;
+        bool invert = i < seg.size() && (seg[i] == '!' || seg[i] == '^');
+        if (invert) ++i;
+        bool first = true;
+        for (; i < seg.size(); ++i) {
+            unsigned char c = static_cast<unsigned char>(seg[i]);
+            if (c == ']' && !first) {
+                end = i;
+                if (invert) set.flip();
+                set.reset('/');
+                return true;
+            }
+            first = false;
+            if (c == '[' && i + 1 < seg.size() && seg[i + 1] == ':') {
+                size_t close = seg.find(":]", i + 2);
+                if (close != string_view::npos) {
+                    string_view name = seg.substr(i + 2, close - i - 2);
+                    for (int ch = 0; ch < 256; ++ch) {
+                        bool in = (name == "alpha" && isalpha(ch)) || (name == "digit" && isdigit(ch)) ||
+                                  (name == "alnum" && isalnum(ch)) || (name == "upper" && isupper(ch)) ||
+                                  (name == "lower" && islower(ch)) || (name == "space" && isspace(ch)) ||
+                                  (name == "punct" && ispunct(ch)) || (name == "xdigit" && isxdigit(ch));
+                        if (in) set.set(ch);
+                    }
+                    i = close + 1;
+                    continue;
+                }
+            }
+            if (c == '\\' && i + 1 < seg.size()) c = static_cast<unsigned char>(seg[++i]);
+            if (i + 2 < seg.size() && seg[i + 1] == '-' && seg[i + 2] != ']') {
+                unsigned char hi = static_cast<unsigned char>(seg[i + 2]);
+                for (int ch = c; ch <= hi; ++ch) set.set(ch);
+                i += 2;
+            } else {
+                set.set(c);
+            }
+        }
+        return false;
+    }
 
-void showBackupMeta() {
-    try {
-        ifstream metaFile(".backup/__init__");
-        if (!metaFile) {
-            cout << "No backup metadata found. Is the backup system initialized?" << endl;
-            return;
+    bool applies(uint32_t index, bool isDir) const { return isDir || !rules[index].dirOnly; }
+
+    //* returns the index of the rule that decides `path` (relative, '/'-separated), or -1 if none matches
+    long decidingRule(string_view path, bool isDir) const {
+        size_t slash = path.rfind('/');
+        string_view name = slash == string_view::npos ? path : path.substr(slash + 1);
+        long best = -1;
+        if (!byName.empty()) {
+            auto it = byName.find(string(name));
+            if (it != byName.end()) {
+                for (auto i = it->second.rbegin(); i != it->second.rend(); ++i) {
+                    if (applies(*i, isDir)) {
+                        best = max<long>(best, *i);
+                        break;
+                    }
+                }
+            }
         }
-        cout << "Backup Metadata:" << endl;
-        string line;
-        while (getline(metaFile, line)) {
-            cout << "  " << line << endl;
+        size_t dot = name.rfind('.');
+        if (!bySuffix.empty() && dot != string_view::npos) {
+            auto it = bySuffix.find(string(name.substr(dot)));
+            if (it != bySuffix.end()) {
+                for (auto i = it->second.rbegin(); i != it->second.rend(); ++i) {
+                    const string& suffix = suffixes[*i];
+                    if (long(*i) > best && applies(*i, isDir) && name.size() >= suffix.size() &&
+                        name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0) {
+                        best = *i;
+                        break;
+                    }
+                }
+            }
         }
-    } catch (const exception& e) {
-        cerr << "Error reading backup metadata: " << e.what() << endl;
+
+        // collect the glob rules that could match, then try them newest first
+        thread_local vector<string_view> parts;
+        thread_local vector<uint32_t> candidates;
+        parts.clear();
+        candidates.clear();
+        auto collect = [&](const unordered_map<string, vector<uint32_t>>& index, string_view key) {
+            auto it = index.find(string(key));
+            if (it == index.end()) return;
+            for (uint32_t i : it->second) {
+                if (long(i) > best) candidates.push_back(i);
+            }
+        };
+        string_view rest = path;
+        while (true) {
+            size_t s = rest.find('/');
+            parts.push_back(rest.substr(0, s));
+            if (s == string_view::npos) break;
+            rest.remove_prefix(s + 1);
+        }
+        if (!byFirstSegment.empty()) collect(byFirstSegment, parts[0]);
+        if (!bySegment.empty()) {
+            for (string_view part : parts) collect(bySegment, part);
+        }
+        for (size_t len : prefixLengths) {
+            if (name.size() >= len) collect(byPrefix, name.substr(0, len));
+        }
+        for (uint32_t i : globs) {
+            if (long(i) > best) candidates.push_back(i);
+        }
+        sort(candidates.begin(), candidates.end(), greater<uint32_t>());
+        candidates.erase(unique(candidates.begin(), candidates.end()), candidates.end());
+        for (uint32_t i : candidates) {
+            const IgnoreRule& rule = rules[i];
+            if (!applies(i, isDir)) continue;
+            bool hit = rule.anchored ? matchIgnoreSegments(rule, parts) : matchIgnoreSegment(rule, rule.segments[0].tokens, name);
+            if (hit) return i;
+        }
+        return best;
+    }
+
+    bool ignored(string_view path, bool isDir) const {
+        long rule = decidingRule(path, isDir);
+        return rule >= 0 && !rules[rule].negate;
     }
+};
+
+//* function to read and compile the .backupignore patterns
+IgnoreMatcher readBackupIgnore() {
+    IgnoreMatcher ignore;
+    ifstream ignoreFile(".backupignore");
+    string line;
+    while (getline(ignoreFile, line)) ignore.add(line);
+    return ignore;
 }
 
-//* function to get the path to the running executable
-string getExecutableDir() {
-#ifdef _WIN32
-    char path[MAX_PATH];
-    GetModuleFileNameA(NULL, path, MAX_PATH);
-    string exePath(path);
-    size_t pos = exePath.find_last_of("/\\");
-    return (pos != string::npos) ? exePath.substr(0, pos) : "";
+//* CPU feature detection for the vectorized code paths (checked once at runtime)
+struct CpuFeatures {
+    bool sse41 = false;
+    bool avx2 = false;
+};
+
+const CpuFeatures& cpuFeatures() {
+    static const CpuFeatures features = [] {
+        CpuFeatures f;
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+        int info[4];
+        __cpuid(info, 1);
+        f.sse41 = (info[2] & (1 << 19)) != 0;
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        __cpuidex(info, 7, 0);
+        f.avx2 = osxsave && (info[1] & (1 << 5)) != 0 && (_xgetbv(0) & 6) == 6;
+#elif BACKUP_X86
+        __builtin_cpu_init();
+        f.sse41 = __builtin_cpu_supports("sse4.1");
+        f.avx2 = __builtin_cpu_supports("avx2");
+#endif
+        return f;
+    }();
+    return features;
+}
+
+//* BLAKE3 hash (portable implementation, whole chunks also with SSE4.1/AVX2), used as the content id of stored files
+static const uint32_t BLAKE3_IV[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+static const uint8_t BLAKE3_MSG_SCHEDULE[7][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+    {3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+    {10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+    {12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+    {9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+    {11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13},
+};
+enum : uint8_t { BLAKE3_CHUNK_START = 1, BLAKE3_CHUNK_END = 2, BLAKE3_PARENT = 4, BLAKE3_ROOT = 8 };
+const size_t BLAKE3_BLOCK_LEN = 64;
+const size_t BLAKE3_CHUNK_LEN = 1024;
+
+static inline uint32_t rotr32(uint32_t w, int c) { return (w >> c) | (w << (32 - c)); }
+
+static inline void blake3G(uint32_t* s, int a, int b, int c, int d, uint32_t x, uint32_t y) {
+    s[a] = s[a] + s[b] + x; s[d] = rotr32(s[d] ^ s[a], 16);
+    s[c] = s[c] + s[d];     s[b] = rotr32(s[b] ^ s[c], 12);
+    s[a] = s[a] + s[b] + y; s[d] = rotr32(s[d] ^ s[a], 8);
+    s[c] = s[c] + s[d];     s[b] = rotr32(s[b] ^ s[c], 7);
+}
+
+static inline int countTrailingZeros64(uint64_t v) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, v);
+    return int(index);
 #else
-    char result[1024];
-    ssize_t count = readlink("/proc/self/exe", result, 1024);
-    string exePath(count != -1 ? string(result, count) : "");
-    size_t pos = exePath.find_last_of("/");
-    return (pos != string::npos) ? exePath.substr(0, pos) : "";
+    return __builtin_ctzll(v);
 #endif
 }
 
-//* function to set the working directory to the executable's directory
-void setWorkingDirToExe() {
-    try {
-        string exeDir = getExecutableDir();
-        if (!exeDir.empty()) {
-            fs::current_path(exeDir);
+static inline uint32_t load32le(const uint8_t* p) {
+    return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+}
+
+//* BLAKE3 compression function, writes the full 16-word output state
+static void blake3Compress(const uint32_t cv[8], const uint8_t block[64], uint8_t blockLen,
+                           uint64_t counter, uint8_t flags, uint32_t out[16]) {
+    uint32_t m[16];
+    for (int i = 0; i < 16; ++i) m[i] = load32le(block + 4 * i);
+    uint32_t s[16] = {
+        cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+        BLAKE3_IV[0], BLAKE3_IV[1], BLAKE3_IV[2], BLAKE3_IV[3],
+        uint32_t(counter), uint32_t(counter >> 32), blockLen, flags
+    };
+    for (int r = 0; r < 7; ++r) {
+        const uint8_t* sc = BLAKE3_MSG_SCHEDULE[r];
+        blake3G(s, 0, 4, 8, 12, m[sc[0]], m[sc[1]]);
+        blake3G(s, 1, 5, 9, 13, m[sc[2]], m[sc[3]]);
+        blake3G(s, 2, 6, 10, 14, m[sc[4]], m[sc[5]]);
+        blake3G(s, 3, 7, 11, 15, m[sc[6]], m[sc[7]]);
+        blake3G(s, 0, 5, 10, 15, m[sc[8]], m[sc[9]]);
+        blake3G(s, 1, 6, 11, 12, m[sc[10]], m[sc[11]]);
+        blake3G(s, 2, 7, 8, 13, m[sc[12]], m[sc[13]]);
+        blake3G(s, 3, 4, 9, 14, m[sc[14]], m[sc[15]]);
+    }
+    for (int i = 0; i < 8; ++i) {
+        out[i] = s[i] ^ s[i + 8];
+        out[i + 8] = s[i + 8] ^ cv[i];
+    }
+}
+
+//* which BLAKE3 code hashes whole chunks: the widest the CPU supports unless lowered (`backup bench hash`)
+enum class HashPath { Scalar, Sse41, Avx2 };
+
+const char* hashPathName(HashPath p) {
+    return p == HashPath::Avx2 ? "avx2" : p == HashPath::Sse41 ? "sse4.1" : "scalar";
+}
+
+HashPath& hashPath() {
+    static HashPath path = cpuFeatures().avx2 ? HashPath::Avx2 : cpuFeatures().sse41 ? HashPath::Sse41 : HashPath::Scalar;
+    return path;
+}
+
+#if BACKUP_X86
+//* SIMD BLAKE3: several whole chunks are hashed side by side, one chunk per 32-bit lane; the message
+//* words of the lanes are transposed into place so every lane runs the plain compression rounds
+BACKUP_TARGET_SSE41 static inline __m128i rot16Sse41(__m128i x) {
+    return _mm_shuffle_epi8(x, _mm_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13));
+}
+BACKUP_TARGET_SSE41 static inline __m128i rot8Sse41(__m128i x) {
+    return _mm_shuffle_epi8(x, _mm_setr_epi8(1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12));
+}
+
+BACKUP_TARGET_SSE41 static inline void gSse41(__m128i* v, int a, int b, int c, int d, __m128i x, __m128i y) {
+    v[a] = _mm_add_epi32(_mm_add_epi32(v[a], v[b]), x);
+    v[d] = rot16Sse41(_mm_xor_si128(v[d], v[a]));
+    v[c] = _mm_add_epi32(v[c], v[d]);
+    v[b] = _mm_xor_si128(v[b], v[c]);
+    v[b] = _mm_or_si128(_mm_srli_epi32(v[b], 12), _mm_slli_epi32(v[b], 20));
+    v[a] = _mm_add_epi32(_mm_add_epi32(v[a], v[b]), y);
+    v[d] = rot8Sse41(_mm_xor_si128(v[d], v[a]));
+    v[c] = _mm_add_epi32(v[c], v[d]);
+    v[b] = _mm_xor_si128(v[b], v[c]);
+    v[b] = _mm_or_si128(_mm_srli_epi32(v[b], 7), _mm_slli_epi32(v[b], 25));
+}
+
+BACKUP_TARGET_SSE41 static inline void transpose4Sse41(__m128i* v) {
+    __m128i ab01 = _mm_unpacklo_epi32(v[0], v[1]), ab23 = _mm_unpackhi_epi32(v[0], v[1]);
+    __m128i cd01 = _mm_unpacklo_epi32(v[2], v[3]), cd23 = _mm_unpackhi_epi32(v[2], v[3]);
+    v[0] = _mm_unpacklo_epi64(ab01, cd01);
+    v[1] = _mm_unpackhi_epi64(ab01, cd01);
+    v[2] = _mm_unpacklo_epi64(ab23, cd23);
+    v[3] = _mm_unpackhi_epi64(ab23, cd23);
+}
+
+//* SSE4.1 version: 4 chunks of `input` (counters counter..counter+3), writes their chaining values
+BACKUP_TARGET_SSE41 static void blake3HashChunksSse41(const uint8_t* input, uint64_t counter, uint32_t out[][8]) {
+    __m128i cv[8];
+    for (int i = 0; i < 8; ++i) cv[i] = _mm_set1_epi32(int(BLAKE3_IV[i]));
+    const __m128i counterLo = _mm_setr_epi32(int(uint32_t(counter)), int(uint32_t(counter + 1)),
+                                             int(uint32_t(counter + 2)), int(uint32_t(counter + 3)));
+    const __m128i counterHi = _mm_setr_epi32(int((counter) >> 32), int((counter + 1) >> 32),
+                                             int((counter + 2) >> 32), int((counter + 3) >> 32));
+    for (size_t block = 0; block < BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN; ++block) {
+        __m128i m[16];
+        for (int q = 0; q < 4; ++q) {
+            for (int lane = 0; lane < 4; ++lane) {
+                m[4 * q + lane] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + lane * BLAKE3_CHUNK_LEN + block * BLAKE3_BLOCK_LEN + 16 * q));
+            }
+            transpose4Sse41(m + 4 * q);
         }
-    } catch (const exception& e) {
-        cerr << "Error setting working directory: " << e.what() << endl;
+        uint32_t flags = (block == 0 ? BLAKE3_CHUNK_START : 0) | (block == 15 ? BLAKE3_CHUNK_END : 0);
+        __m128i v[16] = {cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+                         _mm_set1_epi32(int(BLAKE3_IV[0])), _mm_set1_epi32(int(BLAKE3_IV[1])),
+                         _mm_set1_epi32(int(BLAKE3_IV[2])), _mm_set1_epi32(int(BLAKE3_IV[3])),
+                         counterLo, counterHi, _mm_set1_epi32(int(BLAKE3_BLOCK_LEN)), _mm_set1_epi32(int(flags))};
+        for (int r = 0; r < 7; ++r) {
+            const uint8_t* sc = BLAKE3_MSG_SCHEDULE[r];
+            gSse41(v, 0, 4, 8, 12, m[sc[0]], m[sc[1]]);
+            gSse41(v, 1, 5, 9, 13, m[sc[2]], m[sc[3]]);
+            gSse41(v, 2, 6, 10, 14, m[sc[4]], m[sc[5]]);
+            gSse41(v, 3, 7, 11, 15, m[sc[6]], m[sc[7]]);
+            gSse41(v, 0, 5, 10, 15, m[sc[8]], m[sc[9]]);
+            gSse41(v, 1, 6, 11, 12, m[sc[10]], m[sc[11]]);
+            gSse41(v, 2, 7, 8, 13, m[sc[12]], m[sc[13]]);
+            gSse41(v, 3, 4, 9, 14, m[sc[14]], m[sc[15]]);
+        }
+        for (int i = 0; i < 8; ++i) cv[i] = _mm_xor_si128(v[i], v[i + 8]);
+    }
+    transpose4Sse41(cv);
+    transpose4Sse41(cv + 4);
+    for (int lane = 0; lane < 4; ++lane) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out[lane]), cv[lane]);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out[lane] + 4), cv[4 + lane]);
     }
 }
 
-//* function to log to .backup-logs in logs/ folder in %LOCALAPPDATA%/backup-setup
-void logAction(const string& entry) {
-    // Log to appdata
-    string logDir = getLogDir();
-    fs::create_directories(logDir);
-    string logFile = logDir + "/.backup-logs";
-    ofstream log(logFile, ios::app);
-    if (log) {
-        time_t now = time(nullptr);
-        tm localTime;
-#ifdef _WIN32
-        localtime_s(&localTime, &now);
-#else
-        localtime_r(&now, &localTime);
+BACKUP_TARGET_AVX2 static inline __m256i rot16Avx2(__m256i x) {
+    return _mm256_shuffle_epi8(x, _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+                                                   2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13));
+}
+BACKUP_TARGET_AVX2 static inline __m256i rot8Avx2(__m256i x) {
+    return _mm256_shuffle_epi8(x, _mm256_setr_epi8(1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12,
+                                                   1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12));
+}
+
+BACKUP_TARGET_AVX2 static inline void gAvx2(__m256i* v, int a, int b, int c, int d, __m256i x, __m256i y) {
+    v[a] = _mm256_add_epi32(_mm256_add_epi32(v[a], v[b]), x);
+    v[d] = rot16Avx2(_mm256_xor_si256(v[d], v[a]));
+    v[c] = _mm256_add_epi32(v[c], v[d]);
+    v[b] = _mm256_xor_si256(v[b], v[c]);
+    v[b] = _mm256_or_si256(_mm256_srli_epi32(v[b], 12), _mm256_slli_epi32(v[b], 20));
+    v[a] = _mm256_add_epi32(_mm256_add_epi32(v[a], v[b]), y);
+    v[d] = rot8Avx2(_mm256_xor_si256(v[d], v[a]));
+    v[c] = _mm256_add_epi32(v[c], v[d]);
+    v[b] = _mm256_xor_si256(v[b], v[c]);
+    v[b] = _mm256_or_si256(_mm256_srli_epi32(v[b], 7), _mm256_slli_epi32(v[b], 25));
+}
+
+BACKUP_TARGET_AVX2 static inline void transpose8Avx2(__m256i* v) {
+    __m256i ab0145 = _mm256_unpacklo_epi32(v[0], v[1]), ab2367 = _mm256_unpackhi_epi32(v[0], v[1]);
+    __m256i cd0145 = _mm256_unpacklo_epi32(v[2], v[3]), cd2367 = _mm256_unpackhi_epi32(v[2], v[3]);
+    __m256i ef0145 = _mm256_unpacklo_epi32(v[4], v[5]), ef2367 = _mm256_unpackhi_epi32(v[4], v[5]);
+    __m256i gh0145 = _mm256_unpacklo_epi32(v[6], v[7]), gh2367 = _mm256_unpackhi_epi32(v[6], v[7]);
+    __m256i abcd04 = _mm256_unpacklo_epi64(ab0145, cd0145), abcd15 = _mm256_unpackhi_epi64(ab0145, cd0145);
+    __m256i abcd26 = _mm256_unpacklo_epi64(ab2367, cd2367), abcd37 = _mm256_unpackhi_epi64(ab2367, cd2367);
+    __m256i efgh04 = _mm256_unpacklo_epi64(ef0145, gh0145), efgh15 = _mm256_unpackhi_epi64(ef0145, gh0145);
+    __m256i efgh26 = _mm256_unpacklo_epi64(ef2367, gh2367), efgh37 = _mm256_unpackhi_epi64(ef2367, gh2367);
+    v[0] = _mm256_permute2x128_si256(abcd04, efgh04, 0x20);
+    v[1] = _mm256_permute2x128_si256(abcd15, efgh15, 0x20);
+    v[2] = _mm256_permute2x128_si256(abcd26, efgh26, 0x20);
+    v[3] = _mm256_permute2x128_si256(abcd37, efgh37, 0x20);
+    v[4] = _mm256_permute2x128_si256(abcd04, efgh04, 0x31);
+    v[5] = _mm256_permute2x128_si256(abcd15, efgh15, 0x31);
+    v[6] = _mm256_permute2x128_si256(abcd26, efgh26, 0x31);
+    v[7] = _mm256_permute2x128_si256(abcd37, efgh37, 0x31);
+}
+
+//* AVX2 version: 8 chunks of `input` (counters counter..counter+7), writes their chaining values
+BACKUP_TARGET_AVX2 static void blake3HashChunksAvx2(const uint8_t* input, uint64_t counter, uint32_t out[][8]) {
+    __m256i cv[8];
+    for (int i = 0; i < 8; ++i) cv[i] = _mm256_set1_epi32(int(BLAKE3_IV[i]));
+    uint32_t lo[8], hi[8];
+    for (int lane = 0; lane < 8; ++lane) {
+        lo[lane] = uint32_t(counter + lane);
+        hi[lane] = uint32_t((counter + lane) >> 32);
+    }
+    const __m256i counterLo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lo));
+    const __m256i counterHi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(hi));
+    for (size_t block = 0; block < BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN; ++block) {
+        __m256i m[16];
+        for (int half = 0; half < 2; ++half) {
+            for (int lane = 0; lane < 8; ++lane) {
+                m[8 * half + lane] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + lane * BLAKE3_CHUNK_LEN + block * BLAKE3_BLOCK_LEN + 32 * half));
+            }
+            transpose8Avx2(m + 8 * half);
+        }
+        uint32_t flags = (block == 0 ? BLAKE3_CHUNK_START : 0) | (block == 15 ? BLAKE3_CHUNK_END : 0);
+        __m256i v[16] = {cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+                         _mm256_set1_epi32(int(BLAKE3_IV[0])), _mm256_set1_epi32(int(BLAKE3_IV[1])),
+                         _mm256_set1_epi32(int(BLAKE3_IV[2])), _mm256_set1_epi32(int(BLAKE3_IV[3])),
+                         counterLo, counterHi, _mm256_set1_epi32(int(BLAKE3_BLOCK_LEN)), _mm256_set1_epi32(int(flags))};
+        for (int r = 0; r < 7; ++r) {
+            const uint8_t* sc = BLAKE3_MSG_SCHEDULE[r];
+            gAvx2(v, 0, 4, 8, 12, m[sc[0]], m[sc[1]]);
+            gAvx2(v, 1, 5, 9, 13, m[sc[2]], m[sc[3]]);
+            gAvx2(v, 2, 6, 10, 14, m[sc[4]], m[sc[5]]);
+            gAvx2(v, 3, 7, 11, 15, m[sc[6]], m[sc[7]]);
+            gAvx2(v, 0, 5, 10, 15, m[sc[8]], m[sc[9]]);
+            gAvx2(v, 1, 6, 11, 12, m[sc[10]], m[sc[11]]);
+            gAvx2(v, 2, 7, 8, 13, m[sc[12]], m[sc[13]]);
+            gAvx2(v, 3, 4, 9, 14, m[sc[14]], m[sc[15]]);
+        }
+        for (int i = 0; i < 8; ++i) cv[i] = _mm256_xor_si256(v[i], v[i + 8]);
+    }
+    transpose8Avx2(cv);
+    for (int lane = 0; lane < 8; ++lane) _mm256_storeu_si256(reinterpret_cast<__m256i*>(out[lane]), cv[lane]);
+}
 #endif
-        char timebuf[32];
-        strftime(timebuf, sizeof(timebuf), "%Y-%m-%d %H:%M:%S", &localTime);
-        log << "[" << timebuf << "] " << entry << endl;
+
+//* function to hash whole chunks with the vector unit, returns how many it hashed (0: use the scalar code)
+static size_t blake3HashChunks(const uint8_t* input, size_t chunks, uint64_t counter, uint32_t out[][8]) {
+#if BACKUP_X86
+    HashPath path = hashPath();
+    if (path == HashPath::Avx2 && chunks >= 8) {
+        blake3HashChunksAvx2(input, counter, out);
+        return 8;
     }
+    if (path != HashPath::Scalar && chunks >= 4) {
+        blake3HashChunksSse41(input, counter, out);
+        return 4;
+    }
+#endif
+    (void)input;
+    (void)chunks;
+    (void)counter;
+    (void)out;
+    return 0;
 }
 
-//* function to parse and execute commands
-void executeCommand(const string& cmd) {
-    if (cmd == "backup --version") {
+//* incremental BLAKE3 hasher (unkeyed, 32 byte output)
+struct Blake3Hasher {
+    uint32_t chunkCv[8];
+    uint64_t chunkCounter = 0;
+    uint8_t block[BLAKE3_BLOCK_LEN];
+    uint8_t blockLen = 0;
+    uint8_t blocksCompressed = 0;
+    uint32_t cvStack[54][8];
+    uint8_t cvStackLen = 0;
+
+    Blake3Hasher() { memcpy(chunkCv, BLAKE3_IV, sizeof(chunkCv)); }
+
+    size_t chunkLen() const { return BLAKE3_BLOCK_LEN * blocksCompressed + blockLen; }
+    uint8_t startFlag() const { return blocksCompressed == 0 ? BLAKE3_CHUNK_START : 0; }
+
+    void resetChunk(uint64_t counter) {
+        memcpy(chunkCv, BLAKE3_IV, sizeof(chunkCv));
+        chunkCounter = counter;
+        blockLen = 0;
+        blocksCompressed = 0;
+    }
+
+    void pushChunkCv(uint32_t cv[8], uint64_t totalChunks) {
+        // merge completed subtrees: one merge per trailing zero bit of the chunk count
+        while ((totalChunks & 1) == 0) {
+            uint8_t parentBlock[64];
+            memcpy(parentBlock, cvStack[--cvStackLen], 32);
+            memcpy(parentBlock + 32, cv, 32);
+            uint32_t out[16];
+            blake3Compress(BLAKE3_IV, parentBlock, 64, 0, BLAKE3_PARENT, out);
+            memcpy(cv, out, 32);
+            totalChunks >>= 1;
+        }
+        memcpy(cvStack[cvStackLen++], cv, 32);
+    }
+
+    void update(const void* data, size_t len) {
+        const uint8_t* in = static_cast<const uint8_t*>(data);
+        while (len > 0) {
+            if (chunkLen() == BLAKE3_CHUNK_LEN) {
+                uint32_t out[16];
+                blake3Compress(chunkCv, block, blockLen, chunkCounter, startFlag() | BLAKE3_CHUNK_END, out);
+                uint64_t total = chunkCounter + 1;
+                pushChunkCv(out, total);
+                resetChunk(total);
+            }
+            // at a chunk boundary, whole chunks that are surely not the last go through the vector unit
+            if (chunkLen() == 0 && len > BLAKE3_CHUNK_LEN) {
+                uint32_t cvs[8][8];
+                size_t done = blake3HashChunks(in, (len - 1) / BLAKE3_CHUNK_LEN, chunkCounter, cvs);
+                if (done > 0) {
+                    for (size_t k = 0; k < done; ++k) pushChunkCv(cvs[k], chunkCounter + k + 1);
+                    chunkCounter += done;
+                    in += done * BLAKE3_CHUNK_LEN;
+                    len -= done * BLAKE3_CHUNK_LEN;
+                    continue;
+                }
+            }
+            if (blockLen == BLAKE3_BLOCK_LEN) {
+                uint32_t out[16];
+                blake3Compress(chunkCv, block, BLAKE3_BLOCK_LEN, chunkCounter, startFlag(), out);
+                memcpy(chunkCv, out, 32);
+                ++blocksCompressed;
+                blockLen = 0;
+            }
+            size_t want = min(BLAKE3_BLOCK_LEN - blockLen, len);
+            want = min(want, BLAKE3_CHUNK_LEN - chunkLen());
+            memcpy(block + blockLen, in, want);
+            blockLen += uint8_t(want);
+            in += want;
+            len -= want;
+        }
+    }
+
+    //* the last compression of a (sub)tree that is still open: the last chunk or, after merging, a parent
+    struct Node {
+        uint32_t cv[8];
+        uint8_t block[64];
+        uint8_t len;
+        uint64_t counter;
+        uint8_t flags;
+
+        void chainingValue(uint32_t out[8]) const {
+            uint32_t full[16];
+            blake3Compress(cv, block, len, counter, flags, full);
+            memcpy(out, full, 32);
+        }
+    };
+
+    Node lastChunk() const {
+        Node node;
+        memcpy(node.cv, chunkCv, sizeof(node.cv));
+        memset(node.block, 0, sizeof(node.block));
+        memcpy(node.block, block, blockLen);
+        node.len = blockLen;
+        node.counter = chunkCounter;
+        node.flags = startFlag() | BLAKE3_CHUNK_END;
+        return node;
+    }
+
+    //* function to merge `node` (everything after this hasher's input) with the subtrees on the stack
+    Node mergeUp(Node node) const {
+        for (int i = cvStackLen; i > 0; --i) {
+            uint32_t right[8];
+            node.chainingValue(right);
+            memcpy(node.block, cvStack[i - 1], 32);
+            memcpy(node.block + 32, right, 32);
+            memcpy(node.cv, BLAKE3_IV, sizeof(node.cv));
+            node.len = 64;
+            node.flags = BLAKE3_PARENT;
+            node.counter = 0;
+        }
+        return node;
+    }
+
+    //* a hasher may start at a chunk index of a larger input (`firstChunk`, a multiple of the subtree size)
+    //* to hash one subtree of it; subtree() is then its chaining value and lastNode() the open node of the
+    //* input's last subtree
+    explicit Blake3Hasher(uint64_t firstChunk) : Blake3Hasher() { chunkCounter = firstChunk; }
+
+    void subtree(uint32_t cv[8]) const { mergeUp(lastChunk()).chainingValue(cv); }
+    Node lastNode() const { return mergeUp(lastChunk()); }
+
+    //* function to append the chaining value of a whole subtree of `chunks` (a power of two) chunks,
+    //* the hasher must be at a multiple of that
+    void pushSubtree(const uint32_t cv[8], uint64_t chunks) {
+        uint32_t copy[8];
+        memcpy(copy, cv, sizeof(copy));
+        uint64_t total = chunkCounter + chunks;
+        pushChunkCv(copy, total / chunks);
+        resetChunk(total);
+    }
+
+    //* function to finish the hash with the open node of the input's last subtree
+    static void rootDigest(const Node& node, uint8_t digest[32]) {
+        uint32_t out[16];
+        blake3Compress(node.cv, node.block, node.len, node.counter, node.flags | BLAKE3_ROOT, out);
+        for (int i = 0; i < 8; ++i) {
+            digest[4 * i] = uint8_t(out[i]);
+            digest[4 * i + 1] = uint8_t(out[i] >> 8);
+            digest[4 * i + 2] = uint8_t(out[i] >> 16);
+            digest[4 * i + 3] = uint8_t(out[i] >> 24);
+        }
+    }
+
+    void finalize(uint8_t digest[32]) const {
+        // the last chunk (or the top parent node) is compressed once more with the ROOT flag
+        rootDigest(lastNode(), digest);
+    }
+
+    static string hexOf(const uint8_t digest[32]) {
+        static const char* digits = "0123456789abcdef";
+        string hex(64, '0');
+        for (int i = 0; i < 32; ++i) {
+            hex[2 * i] = digits[digest[i] >> 4];
+            hex[2 * i + 1] = digits[digest[i] & 15];
+        }
+        return hex;
+    }
+
+    string hexDigest() const {
+        uint8_t digest[32];
+        finalize(digest);
+        return hexOf(digest);
+    }
+
+    //* function to finish the hash of the pushed subtrees followed by the input's last subtree
+    string hexDigestWith(const Node& last) const {
+        uint8_t digest[32];
+        rootDigest(mergeUp(last), digest);
+        return hexOf(digest);
+    }
+};
+
+//* content-defined chunking parameters (bytes), configurable in .backup/__init__
+struct ChunkParams {
+    uint32_t minSize = 64 * 1024;
+    uint32_t avgSize = 256 * 1024;
+    uint32_t maxSize = 1024 * 1024;
+};
+
+//* gear values for the rolling hash: gear[b] = A[b & 7] ^ B[(b >> 3) & 7] ^ C[b >> 6]
+//* the three small tables come from a fixed seed so chunk boundaries never change between versions,
+//* and they are small enough for the AVX2 path to look up with in-register permutes instead of gathers
+static const uint32_t* gearParts() {
+    static uint32_t parts[24];
+    static bool ready = [] {
+        uint64_t x = 0x2545F4914F6CDD1DULL;
+        for (int i = 0; i < 24; ++i) {
+            // splitmix64
+            x += 0x9E3779B97F4A7C15ULL;
+            uint64_t z = x;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            parts[i] = uint32_t((z ^ (z >> 31)) >> 32);
+        }
+        return true;
+    }();
+    (void)ready;
+    return parts;
+}
+
+static const uint32_t* gearTable() {
+    static uint32_t table[256];
+    static bool ready = [] {
+        const uint32_t* parts = gearParts();
+        for (int b = 0; b < 256; ++b) table[b] = parts[b & 7] ^ parts[8 + ((b >> 3) & 7)] ^ parts[16 + (b >> 6)];
+        return true;
+    }();
+    (void)ready;
+    return table;
+}
+
+//* FastCDC style chunker with normalized chunking
+//* the rolling hash at byte i is sum(gear[b(i-j)] << j) over the last 32 bytes, so it only depends on
+//* the data around i; cut points are tested on the top bits (a stricter mask before avgSize, a looser one after)
+struct CdcChunker {
+    ChunkParams params;
+    uint32_t maskS = 0;
+    uint32_t maskL = 0;
+    bool vectorized = false;
+
+    CdcChunker(const ChunkParams& p, bool allowSimd = true) : params(p) {
+        int bits = 0;
+        while ((uint64_t(1) << (bits + 1)) <= p.avgSize) ++bits;
+        int bitsS = min(bits + 2, 31), bitsL = max(bits - 2, 1);
+        maskS = ~uint32_t(0) << (32 - bitsS);
+        maskL = ~uint32_t(0) << (32 - bitsL);
+        vectorized = allowSimd && cpuFeatures().avx2;
+    }
+
+    //* returns the length of the chunk starting at data, `hist` bytes before data are readable;
+    //* len must be at least maxSize unless this is the end of the input
+    size_t cut(const uint8_t* data, size_t len, size_t hist) const {
+        if (len <= params.minSize) return len;
+        size_t n = min(len, size_t(params.maxSize));
+        size_t normal = min(n, size_t(params.avgSize));
+        // warm up the hash over the 32 bytes in front of the first position that may cut
+        ptrdiff_t from = ptrdiff_t(params.minSize) - 32;
+        if (from < -ptrdiff_t(hist)) from = -ptrdiff_t(hist);
+        const uint32_t* gear = gearTable();
+        uint32_t h = 0;
+        for (ptrdiff_t i = from; i < ptrdiff_t(params.minSize); ++i) h = (h << 1) + gear[data[i]];
+#if BACKUP_X86
+        if (vectorized) return cutAvx2(data, n, normal, h);
+#endif
+        for (size_t i = params.minSize; i < normal; ++i) {
+            h = (h << 1) + gear[data[i]];
+            if (!(h & maskS)) return i + 1;
+        }
+        for (size_t i = normal; i < n; ++i) {
+            h = (h << 1) + gear[data[i]];
+            if (!(h & maskL)) return i + 1;
+        }
+        return n;
+    }
+
+#if BACKUP_X86
+    //* AVX2 version: hashes 8 positions per step and tests 64 positions per block
+    //* within a step the gear values are combined with a shifted prefix sum, the hash of the step's
+    //* last byte is carried into the next step without leaving the vector registers
+    BACKUP_TARGET_AVX2 size_t cutAvx2(const uint8_t* data, size_t n, size_t normal, uint32_t h) const {
+        const uint32_t* gear = gearTable();
+        const uint32_t* parts = gearParts();
+        const __m256i partA = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(parts));
+        const __m256i partB = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(parts + 8));
+        const __m256i partC = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(parts + 16));
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i shift1 = _mm256_setr_epi32(0, 0, 1, 2, 3, 4, 5, 6);
+        const __m256i shift2 = _mm256_setr_epi32(0, 0, 0, 1, 2, 3, 4, 5);
+        const __m256i shift4 = _mm256_setr_epi32(0, 0, 0, 0, 0, 1, 2, 3);
+        const __m256i keep1 = _mm256_setr_epi32(0, -1, -1, -1, -1, -1, -1, -1);
+        const __m256i keep2 = _mm256_setr_epi32(0, 0, -1, -1, -1, -1, -1, -1);
+        const __m256i keep4 = _mm256_setr_epi32(0, 0, 0, 0, -1, -1, -1, -1);
+        const __m256i lane7 = _mm256_set1_epi32(7);
+        const __m256i carryShift = _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 8);
+        const __m256i vMaskS = _mm256_set1_epi32(int(maskS));
+        const __m256i vMaskL = _mm256_set1_epi32(int(maskL));
+        __m256i prev = _mm256_set1_epi32(int(h));
+        size_t i = params.minSize;
+        while (i + 64 <= n) {
+            uint64_t hitS = 0, hitL = 0;
+            for (int step = 0; step < 8; ++step) {
+                __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(data + i + 8 * step));
+                __m256i b = _mm256_cvtepu8_epi32(bytes);
+                // vpermd only looks at the low 3 bits of each index
+                __m256i g = _mm256_xor_si256(_mm256_permutevar8x32_epi32(partA, b),
+                            _mm256_xor_si256(_mm256_permutevar8x32_epi32(partB, _mm256_srli_epi32(b, 3)),
+                                             _mm256_permutevar8x32_epi32(partC, _mm256_srli_epi32(b, 6))));
+                g = _mm256_add_epi32(g, _mm256_slli_epi32(_mm256_and_si256(_mm256_permutevar8x32_epi32(g, shift1), keep1), 1));
+                g = _mm256_add_epi32(g, _mm256_slli_epi32(_mm256_and_si256(_mm256_permutevar8x32_epi32(g, shift2), keep2), 2));
+                g = _mm256_add_epi32(g, _mm256_slli_epi32(_mm256_and_si256(_mm256_permutevar8x32_epi32(g, shift4), keep4), 4));
+                __m256i hv = _mm256_add_epi32(g, _mm256_sllv_epi32(_mm256_permutevar8x32_epi32(prev, lane7), carryShift));
+                prev = hv;
+                uint32_t s = uint32_t(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(hv, vMaskS), zero))));
+                uint32_t l = uint32_t(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(hv, vMaskL), zero))));
+                hitS |= uint64_t(s) << (8 * step);
+                hitL |= uint64_t(l) << (8 * step);
+            }
+            // positions before `normal` use the strict mask, the rest the loose one
+            uint64_t strictBits = (normal <= i) ? 0 : (normal >= i + 64) ? ~uint64_t(0) : ((uint64_t(1) << (normal - i)) - 1);
+            uint64_t hits = (hitS & strictBits) | (hitL & ~strictBits);
+            if (hits) return i + countTrailingZeros64(hits) + 1;
+            i += 64;
+        }
+        h = uint32_t(_mm256_extract_epi32(prev, 7));
+        for (; i < n; ++i) {
+            h = (h << 1) + gear[data[i]];
+            if (!(h & (i < normal ? maskS : maskL))) return i + 1;
+        }
+        return n;
+    }
+#endif
+};
+
+//* function to load the chunk sizes from .backup/__init__ (chunk-min, chunk-avg, chunk-max)
+ChunkParams loadChunkParams(const map<string, string>& config) {
+    ChunkParams p;
+    p.minSize = static_cast<uint32_t>(configNumber(config, "chunk-min", p.minSize));
+    p.avgSize = static_cast<uint32_t>(configNumber(config, "chunk-avg", p.avgSize));
+    p.maxSize = static_cast<uint32_t>(configNumber(config, "chunk-max", p.maxSize));
+    if (p.minSize < 64 || p.minSize > p.avgSize || p.avgSize > p.maxSize || p.maxSize > (256u << 20)) {
+        throw runtime_error("Invalid chunk sizes in .backup/__init__ (need 64 <= chunk-min <= chunk-avg <= chunk-max <= 256 MiB)");
+    }
+    return p;
+}
+
+//* functions to convert std::filesystem times to and from unix nanoseconds
+//* (the file clock's epoch and tick size depend on the standard library)
+int64_t fileTimeToUnixNs(fs::file_time_type t) {
+#if defined(_MSC_VER)
+    // MSVC: 100ns ticks since 1601-01-01
+    return (static_cast<int64_t>(t.time_since_epoch().count()) - 116444736000000000LL) * 100;
+#elif defined(__GLIBCXX__)
+    // libstdc++: nanoseconds relative to 2174-01-01
+    return chrono::duration_cast<chrono::nanoseconds>(t.time_since_epoch()).count() + 6437664000LL * 1000000000LL;
+#else
+    return chrono::duration_cast<chrono::nanoseconds>(t.time_since_epoch()).count();
+#endif
+}
+
+fs::file_time_type unixNsToFileTime(int64_t ns) {
+#if defined(_MSC_VER)
+    return fs::file_time_type(fs::file_time_type::duration(ns / 100 + 116444736000000000LL));
+#elif defined(__GLIBCXX__)
+    return fs::file_time_type(chrono::duration_cast<fs::file_time_type::duration>(
+        chrono::nanoseconds(ns - 6437664000LL * 1000000000LL)));
+#else
+    return fs::file_time_type(chrono::duration_cast<fs::file_time_type::duration>(chrono::nanoseconds(ns)));
+#endif
+}
+
+//* one file or directory recorded in a snapshot manifest
+struct ManifestEntry {
+    char type = 'f';        // 'f' = file, 'd' = directory, 'l' = symbolic link to a directory
+    uint64_t size = 0;
+    int64_t mtime = 0;      // last write time in unix nanoseconds
+    uint32_t mode = 0;      // permission bits
+    string id = "-";        // BLAKE3 content id (hex) of the whole file (of a link: its target), "-" for directories
+    string chunks = "-";    // id of the chunk list object, "-" if the file is stored as the single blob `id`
+    string source;          // only set for v1 manifests: snapshot folder that holds a plain copy
+    string path;            // relative to the project root, '/' separated
+};
+
+const string MANIFEST_NAME = "__manifest__";
+const string TREE_NAME = "__tree__";  // root id of the snapshot's tree objects
+const int MANIFEST_VERSION = 4;
+const string MANIFEST_HEADER = "# .backup manifest v";
+const string OBJECTS_DIR = ".backup/objects";
+
+//* function to escape tabs, newlines and backslashes in manifest paths
+string escapeManifestPath(const string& path) {
+    string out;
+    out.reserve(path.size());
+    for (char c : path) {
+        if (c == '\\') out += "\\\\";
+        else if (c == '\t') out += "\\t";
+        else if (c == '\n') out += "\\n";
+        else out += c;
+    }
+    return out;
+}
+
+string unescapeManifestPath(const string& path) {
+    string out;
+    out.reserve(path.size());
+    for (size_t i = 0; i < path.size(); ++i) {
+        if (path[i] == '\\' && i + 1 < path.size()) {
+            char c = path[++i];
+            out += (c == 't') ? '\t' : (c == 'n') ? '\n' : c;
+        } else {
+            out += path[i];
+        }
+    }
+    return out;
+}
+
+//* function to flush a written file, or a folder's entries after a rename into it, to disk: a snapshot's
+//* files must be there before the catalog record that commits it (the catalog append is synced too)
+void syncFile(const fs::path& file) {
+#ifndef _WIN32
+    int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    int error = fd < 0 || fsync(fd) != 0 ? errno : 0;
+    if (fd >= 0) close(fd);
+    if (error) throw runtime_error("Failed to flush " + file.string() + ": " + strerror(error));
+#else
+    (void)file;
+#endif
+}
+
+//* streaming manifest writer: entries go to a temp file that is renamed into place on commit,
+//* so a crash never leaves half a manifest
+struct ManifestWriter {
+    fs::path file;
+    fs::path tmp;
+    ofstream out;
+
+    explicit ManifestWriter(const fs::path& target) : file(target), tmp(target) {
+        tmp += ".tmp";
+        out.open(tmp, ios::binary | ios::trunc);
+        if (!out) throw runtime_error("Failed to write manifest: " + tmp.string());
+        out << MANIFEST_HEADER << MANIFEST_VERSION << "\n";
+        out << "# created: " << getTimestamp() << "\n";
+    }
+
+    void add(const ManifestEntry& e) {
+        out << e.type << '\t' << e.size << '\t' << e.mtime << '\t' << e.mode << '\t'
+            << e.id << '\t' << e.chunks << '\t' << escapeManifestPath(e.path) << '\n';
+    }
+
+    void comment(const string& text) {
+        out << "# " << text << '\n';
+    }
+
+    void commit() {
+        if (!out.flush()) throw runtime_error("Failed to write manifest: " + tmp.string());
+        out.close();
+        syncFile(tmp);
+        fs::rename(tmp, file);
+    }
+};
+
+//* function to write a whole manifest at once
+void writeManifest(const fs::path& file, const vector<ManifestEntry>& entries) {
+    ManifestWriter writer(file);
+    for (const auto& e : entries) writer.add(e);
+    writer.commit();
+}
+
+//* function to read a manifest written by writeManifest
+vector<ManifestEntry> readManifest(const fs::path& file) {
+    vector<ManifestEntry> entries;
+    ifstream in(file, ios::binary);
+    if (!in) throw runtime_error("Failed to read manifest: " + file.string());
+    string line;
+    int version = MANIFEST_VERSION;
+    while (getline(in, line)) {
+        if (line.rfind(MANIFEST_HEADER, 0) == 0) version = stoi(line.substr(MANIFEST_HEADER.size()));
+        if (line.empty() || line[0] == '#') continue;
+        // v1 has a source folder column instead of the chunk list, v2 has neither
+        int fieldCount = (version == 2) ? 6 : 7;
+        bool v1 = (version == 1);
+        ManifestEntry e;
+        string fields[7];
+        size_t start = 0;
+        for (int i = 0; i < fieldCount; ++i) {
+            size_t tab = (i < fieldCount - 1) ? line.find('\t', start) : string::npos;
+            if (i < fieldCount - 1 && tab == string::npos) throw runtime_error("Corrupt manifest line in " + file.string());
+            fields[i] = line.substr(start, tab == string::npos ? string::npos : tab - start);
+            start = tab + 1;
+        }
+        e.type = fields[0].empty() ? 'f' : fields[0][0];
+        e.size = stoull(fields[1]);
+        e.mtime = stoll(fields[2]);
+        // before v4 the mtime was stored as raw std::filesystem clock ticks
+        if (version < 4) e.mtime = fileTimeToUnixNs(fs::file_time_type(fs::file_time_type::duration(e.mtime)));
+        e.mode = static_cast<uint32_t>(stoul(fields[3]));
+        e.id = fields[4];
+        if (v1 && fields[5] != "-") e.source = fields[5];
+        if (!v1 && fieldCount == 7) e.chunks = fields[5];
+        e.path = unescapeManifestPath(fields[fieldCount - 1]);
+        entries.push_back(move(e));
+    }
+    return entries;
+}
+
+//* function to list all Backup_* snapshot folders, newest first
+vector<fs::path> listBackups() {
+    vector<fs::path> backups;
+    if (!fs::exists(".backup") || !fs::is_directory(".backup")) return backups;
+    for (const auto& entry : fs::directory_iterator(".backup")) {
+        if (fs::is_directory(entry) && entry.path().filename().string().rfind("Backup_", 0) == 0) {
+            backups.push_back(entry.path());
+        }
+    }
+    // Backup_<timestamp>[-n]: by timestamp, then by the number of same-second backups
+    auto key = [](const fs::path& p) {
+        string name = p.filename().string();
+        size_t dash = name.size() > 26 && name[26] == '-' ? 26 : string::npos;
+        return make_pair(name.substr(0, dash), dash == string::npos ? 0 : atoi(name.c_str() + dash + 1));
+    };
+    sort(backups.begin(), backups.end(), [&](const fs::path& a, const fs::path& b) { return key(a) > key(b); });
+    return backups;
+}
+
+//* function to find the manifest of the newest complete backup (empty path if there is none)
+fs::path findLastManifest() {
+    for (const auto& dir : listBackups()) {
+        if (fs::exists(dir / MANIFEST_NAME)) return dir / MANIFEST_NAME;
+    }
+    return fs::path();
+}
+
+//* function to get the path of a blob in the object store (.backup/objects/ab/cdef...)
+fs::path objectPath(const string& id) {
+    return fs::path(OBJECTS_DIR) / id.substr(0, 2) / id.substr(2);
+}
+
+//* function to get a unique temp file name inside the object store
+fs::path objectTempPath() {
+    static atomic<uint64_t> counter{0};
+#ifdef _WIN32
+    unsigned long pid = GetCurrentProcessId();
+#else
+    unsigned long pid = static_cast<unsigned long>(getpid());
+#endif
+    return fs::path(OBJECTS_DIR) / "tmp" / (to_string(pid) + "-" + to_string(counter++));
+}
+
+//* function to hash a buffer, returns the hex BLAKE3 id
+string hashBytes(const void* data, size_t len) {
+    Blake3Hasher hasher;
+    hasher.update(data, len);
+    return hasher.hexDigest();
+}
+
+//* compression of stored objects (`compression` in .backup/__init__ or --compress)
+//*   off   objects are stored as they are
+//*   fast  LZ4 block format, greedy matches from a hash table (default)
+//*   high  the same format with a hash-chain search for longer matches (slower, smaller)
+enum class Compression { Off, Fast, High };
+
+Compression parseCompression(const string& value) {
+    if (value == "off") return Compression::Off;
+    if (value == "fast") return Compression::Fast;
+    if (value == "high") return Compression::High;
+    throw runtime_error("Unknown --compress: " + value + " (use off, fast or high)");
+}
+
+string compressionName(Compression c) {
+    switch (c) {
+        case Compression::Off: return "off";
+        case Compression::Fast: return "fast";
+        case Compression::High: return "high";
+    }
+    return "?";
+}
+
+//* function to guess from a sample of the bytes whether data is worth compressing:
+//* already compressed data (archives, media) has close to 8 bits of entropy per byte
+bool looksCompressible(const uint8_t* data, size_t len) {
+    uint32_t counts[256] = {};
+    size_t sampled = 0;
+    if (len <= 4096) {
+        for (size_t i = 0; i < len; ++i) ++counts[data[i]];
+        sampled = len;
+    } else {
+        // 16 slices of 256 bytes spread over the data
+        for (size_t s = 0; s < 16; ++s) {
+            const uint8_t* slice = data + (len - 256) / 15 * s;
+            for (size_t i = 0; i < 256; ++i) ++counts[slice[i]];
+        }
+        sampled = 4096;
+    }
+    double bits = 0;
+    for (uint32_t c : counts) {
+        if (c) bits -= c * log2(double(c) / double(sampled));
+    }
+    return bits / double(sampled) < 7.5;
+}
+
+const size_t LZ4_MIN_MATCH = 4, LZ4_LAST_LITERALS = 5, LZ4_MATCH_SAFE = 12, LZ4_MAX_OFFSET = 65535;
+
+inline uint32_t lz4Read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+const int LZ4_HASH_LOG = 14;
+
+inline uint32_t lz4Hash(uint32_t v) {
+    return (v * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+//* function to count how many bytes at a and b are equal, up to `end` (a < b < end)
+inline size_t lz4MatchLength(const uint8_t* a, const uint8_t* b, const uint8_t* end) {
+    const uint8_t* start = b;
+    while (b + 8 <= end) {
+        uint64_t x, y;
+        memcpy(&x, a, 8);
+        memcpy(&y, b, 8);
+        if (x != y) {
+#if defined(_MSC_VER)
+            unsigned long bit;
+            _BitScanForward64(&bit, x ^ y);
+            return size_t(b - start) + bit / 8;
+#else
+            return size_t(b - start) + size_t(__builtin_ctzll(x ^ y)) / 8;
+#endif
+        }
+        a += 8;
+        b += 8;
+    }
+    while (b < end && *a == *b) {
+        ++a;
+        ++b;
+    }
+    return size_t(b - start);
+}
+
+//* function to write one LZ4 sequence (literals, then a match unless matchLen is 0), returns the new end
+uint8_t* lz4Sequence(uint8_t* op, const uint8_t* literals, size_t literalLen, size_t offset, size_t matchLen) {
+    uint8_t* token = op++;
+    *token = uint8_t(min<size_t>(literalLen, 15) << 4);
+    if (literalLen >= 15) {
+        size_t n = literalLen - 15;
+        for (; n >= 255; n -= 255) *op++ = 255;
+        *op++ = uint8_t(n);
+    }
+    memcpy(op, literals, literalLen);
+    op += literalLen;
+    if (matchLen) {
+        *op++ = uint8_t(offset & 0xFF);
+        *op++ = uint8_t(offset >> 8);
+        size_t m = matchLen - LZ4_MIN_MATCH;
+        *token |= uint8_t(min<size_t>(m, 15));
+        if (m >= 15) {
+            size_t n = m - 15;
+            for (; n >= 255; n -= 255) *op++ = 255;
+            *op++ = uint8_t(n);
+        }
+    }
+    return op;
+}
+
+//* function to compress a buffer into an LZ4 block; `high` searches a hash chain of earlier
+//* positions for the longest match instead of taking the one the hash table remembers
+string lz4Compress(const uint8_t* src, size_t len, bool high) {
+    string out(len + len / 255 + 16, '\0');
+    uint8_t* const begin = reinterpret_cast<uint8_t*>(out.data());
+    uint8_t* op = begin;
+    size_t anchor = 0;
+    if (len > LZ4_MATCH_SAFE) {
+        const uint32_t NONE = UINT32_MAX;
+        // the tables are reused by each worker thread, chunks are compressed one after the other
+        thread_local vector<uint32_t> head, chain;
+        head.assign(size_t(1) << LZ4_HASH_LOG, NONE);
+        if (high) chain.assign(LZ4_MAX_OFFSET + 1, NONE);
+        const int depth = 64;
+        const uint8_t* matchEnd = src + len - LZ4_LAST_LITERALS;
+        const size_t limit = len - LZ4_MATCH_SAFE;
+        size_t ip = 0, next = 0;  // next: first position not in the hash chain yet
+        while (ip < limit) {
+            size_t bestLen = 0, bestPos = 0;
+            uint32_t h = lz4Hash(lz4Read32(src + ip));
+            if (high) {
+                for (; next < ip; ++next) {
+                    uint32_t hn = lz4Hash(lz4Read32(src + next));
+                    chain[next & LZ4_MAX_OFFSET] = head[hn];
+                    head[hn] = uint32_t(next);
+                }
+                uint32_t candidate = head[h];
+                for (int d = 0; d < depth && candidate != NONE && ip - candidate <= LZ4_MAX_OFFSET; ++d) {
+                    // a longer match must at least agree on the byte that would make it longer
+                    if (src[candidate + bestLen] == src[ip + bestLen] && lz4Read32(src + candidate) == lz4Read32(src + ip)) {
+                        size_t m = LZ4_MIN_MATCH + lz4MatchLength(src + candidate + 4, src + ip + 4, matchEnd);
+                        if (m > bestLen) {
+                            bestLen = m;
+                            bestPos = candidate;
+                        }
+                    }
+                    uint32_t older = chain[candidate & LZ4_MAX_OFFSET];
+                    if (older >= candidate) break;  // slot reused by a newer position
+                    candidate = older;
+                }
+                chain[ip & LZ4_MAX_OFFSET] = head[h];
+                head[h] = uint32_t(ip);
+                next = ip + 1;
+            } else {
+                uint32_t candidate = head[h];
+                head[h] = uint32_t(ip);
+                if (candidate != NONE && ip - candidate <= LZ4_MAX_OFFSET && lz4Read32(src + candidate) == lz4Read32(src + ip)) {
+                    bestLen = LZ4_MIN_MATCH + lz4MatchLength(src + candidate + 4, src + ip + 4, matchEnd);
+                    bestPos = candidate;
+                }
+            }
+            if (!bestLen) {
+                // skip faster through data that does not match (LZ4's acceleration)
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+            while (ip > anchor && bestPos > 0 && src[ip - 1] == src[bestPos - 1]) {
+                --ip;
+                --bestPos;
+                ++bestLen;
+            }
+            op = lz4Sequence(op, src + anchor, ip - anchor, ip - bestPos, bestLen);
+            ip += bestLen;
+            anchor = ip;
+            if (!high && ip < limit) head[lz4Hash(lz4Read32(src + ip - 2))] = uint32_t(ip - 2);
+        }
+    }
+    op = lz4Sequence(op, src + anchor, len - anchor, 0, 0);
+    out.resize(size_t(op - begin));
+    return out;
+}
+
+//* function to decompress an LZ4 block of known decompressed size
+string lz4Decompress(const uint8_t* src, size_t len, size_t rawLen) {
+    string out(rawLen, '\0');
+    uint8_t* dst = reinterpret_cast<uint8_t*>(out.data());
+    size_t ip = 0, op = 0;
+    auto corrupt = [] { return runtime_error("Corrupt compressed object"); };
+    auto length = [&](size_t n) {
+        if (n != 15) return n;
+        uint8_t b;
+        do {
+            if (ip >= len) throw corrupt();
+            b = src[ip++];
+            n += b;
+        } while (b == 255);
+        return n;
+    };
+    while (ip < len) {
+        uint8_t token = src[ip++];
+        size_t literals = length(token >> 4);
+        if (literals > len - ip || literals > rawLen - op) throw corrupt();
+        memcpy(dst + op, src + ip, literals);
+        ip += literals;
+        op += literals;
+        if (ip == len) break;  // the last sequence has no match
+        if (len - ip < 2) throw corrupt();
+        size_t offset = src[ip] | (size_t(src[ip + 1]) << 8);
+        ip += 2;
+        size_t match = length(token & 15) + LZ4_MIN_MATCH;
+        if (offset == 0 || offset > op || match > rawLen - op) throw corrupt();
+        if (offset >= 8 && op + match + 8 <= rawLen) {
+            // 8 bytes at a time, may write a few bytes past the match that the next sequence overwrites
+            for (size_t i = 0; i < match; i += 8) memcpy(dst + op + i, dst + op - offset + i, 8);
+        } else if (offset >= match) {
+            memcpy(dst + op, dst + op - offset, match);
+        } else {
+            for (size_t i = 0; i < match; ++i) dst[op + i] = dst[op + i - offset];  // overlapping run
+        }
+        op += match;
+    }
+    if (op != rawLen) throw corrupt();
+    return out;
+}
+
+//* function to append a 64-bit integer little-endian (the byte order of the store's file formats; only
+//* the hash cache, which never leaves the machine, is written in host order)
+void appendLe64(string& out, uint64_t v) {
+    for (int i = 0; i < 8; ++i) out.push_back(char(v >> (8 * i)));
+}
+
+//* function to read a little-endian 64-bit integer
+uint64_t readLe64(const void* p) {
+    const uint8_t* b = static_cast<const uint8_t*>(p);
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i) v = v << 8 | b[i];
+    return v;
+}
+
+void appendLe32(string& out, uint32_t v) {
+    for (int i = 0; i < 4; ++i) out.push_back(char(v >> (8 * i)));
+}
+
+uint32_t readLe32(const void* p) {
+    const uint8_t* b = static_cast<const uint8_t*>(p);
+    return uint32_t(b[0]) | uint32_t(b[1]) << 8 | uint32_t(b[2]) << 16 | uint32_t(b[3]) << 24;
+}
+
+//* compressed objects are framed: magic, method, reserved bytes and the original size (little-endian), then
+//* the data;
+//* anything without the magic is a raw object (older stores, cloned chunks, data that did not compress);
+//* raw data that happens to start with the magic is framed with method 0 so it is never misread
+const char OBJECT_FRAME_MAGIC[8] = {'\x89', 'B', 'K', 'Z', '\r', '\n', '\x1a', '\n'};
+const size_t OBJECT_FRAME_HEADER = 24;
+enum : uint8_t { FRAME_STORED = 0, FRAME_LZ4 = 1 };
+
+bool isFramedObject(const void* data, size_t len) {
+    return len >= 8 && memcmp(data, OBJECT_FRAME_MAGIC, 8) == 0;
+}
+
+//* function to encode an object for storage, returns an empty string if it is best stored raw
+string encodeObject(const uint8_t* data, size_t len, Compression c) {
+    string frame;
+    auto header = [&](uint8_t method) {
+        frame.assign(OBJECT_FRAME_MAGIC, 8);
+        frame.push_back(char(method));
+        frame.append(7, '\0');
+        appendLe64(frame, len);
+    };
+    if (c != Compression::Off && len >= 64 && looksCompressible(data, len)) {
+        PhaseTimer timer(RunStats::Compress);
+        string packed = lz4Compress(data, len, c == Compression::High);
+        // only keep it if it saves at least 1/32 of the size
+        if (packed.size() + OBJECT_FRAME_HEADER < len - len / 32) {
+            header(FRAME_LZ4);
+            frame += packed;
+            return frame;
+        }
+    }
+    if (!isFramedObject(data, len)) return frame;
+    header(FRAME_STORED);
+    frame.append(reinterpret_cast<const char*>(data), len);
+    return frame;
+}
+
+//* function to turn a stored object back into its content
+string decodeObject(string stored) {
+    if (!isFramedObject(stored.data(), stored.size())) return stored;
+    if (stored.size() < OBJECT_FRAME_HEADER) throw runtime_error("Corrupt compressed object");
+    uint64_t raw = readLe64(stored.data() + 16);
+    const uint8_t* body = reinterpret_cast<const uint8_t*>(stored.data()) + OBJECT_FRAME_HEADER;
+    size_t bodyLen = stored.size() - OBJECT_FRAME_HEADER;
+    switch (uint8_t(stored[8])) {
+        case FRAME_STORED:
+            if (bodyLen != raw) throw runtime_error("Corrupt object frame");
+            return stored.substr(OBJECT_FRAME_HEADER);
+        case FRAME_LZ4: {
+            PhaseTimer timer(RunStats::Compress);
+            return lz4Decompress(body, bodyLen, raw);
+        }
+    }
+    throw runtime_error("Unknown object compression method " + to_string(int(uint8_t(stored[8]))));
+}
+
+
+//* read-only memory mapping of a whole file (index files are searched in place, never parsed)
+struct MappedFile {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+
+    explicit MappedFile(const fs::path& path) {
+        size = static_cast<size_t>(fs::file_size(path));
+        if (size == 0) return;
+#ifdef _WIN32
+        file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, 0, nullptr);
+        if (file == INVALID_HANDLE_VALUE) throw runtime_error("Failed to open: " + path.string());
+        mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping) data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        if (!data) throw runtime_error("Failed to map: " + path.string());
+#else
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) throw runtime_error("Failed to open: " + path.string() + ": " + strerror(errno));
+        void* p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) throw runtime_error("Failed to map: " + path.string() + ": " + strerror(errno));
+        data = static_cast<const uint8_t*>(p);
+#endif
+    }
+
+    ~MappedFile() {
+#ifdef _WIN32
+        if (data) UnmapViewOfFile(data);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+        if (data) munmap(const_cast<uint8_t*>(data), size);
+#endif
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+};
+
+//* function to convert a 64 character hex id into its 32 bytes (false if it is not a valid id)
+bool idToBytes(const string& id, uint8_t out[32]) {
+    if (id.size() != 64) return false;
+    for (int i = 0; i < 32; ++i) {
+        int v = 0;
+        for (int k = 0; k < 2; ++k) {
+            char c = id[i * 2 + k];
+            int d = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+            if (d < 0) return false;
+            v = v * 16 + d;
+        }
+        out[i] = uint8_t(v);
+    }
+    return true;
+}
+
+string bytesToId(const uint8_t* bytes) {
+    static const char* hex = "0123456789abcdef";
+    string id(64, '0');
+    for (int i = 0; i < 32; ++i) {
+        id[i * 2] = hex[bytes[i] >> 4];
+        id[i * 2 + 1] = hex[bytes[i] & 15];
+    }
+    return id;
+}
+
+//* pack files (--store=pack): all objects a backup adds go into one append-only .backup/packs/<name>.pack,
+//* next to it <name>.idx holds one fixed 48-byte record per object (id, offset, length) sorted by id,
+//* after a 16-byte header ("BKPACK1" + record count); integers are little-endian
+const string PACKS_DIR = ".backup/packs";
+const char PACK_INDEX_MAGIC[8] = {'B', 'K', 'P', 'A', 'C', 'K', '1', 0};
+const size_t PACK_INDEX_HEADER = 16, PACK_INDEX_RECORD = 48;
+
+//* function to get the inode of a file, 0 if it does not exist (or on Windows)
+uint64_t fileInode(const fs::path& path) {
+#ifdef _WIN32
+    (void)path;
+    return 0;
+#else
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? uint64_t(st.st_ino) : 0;
+#endif
+}
+
+//* at most this many pack data files stay open; reads from further packs open the file for each read
+const int PACK_OPEN_LIMIT = 64;
+//* packs with up to this many objects get an in-memory filter, so a lookup skips them without a search
+const uint64_t PACK_FILTER_MAX_OBJECTS = uint64_t(1) << 20;
+atomic<int> openPackFiles{0};
+
+//* one mapped pack index plus the pack's data file, looked up with a binary search over the records
+struct PackIndex {
+    // the inode of the index is taken before it is mapped: if the file is replaced in between, the
+    // next PackStore::current() sees the difference and the indexes are loaded again
+    uint64_t indexInode;
+    fs::path dataPath;
+    MappedFile index;
+    uint64_t count = 0;
+    uint64_t dataInode = 0;
+    vector<uint64_t> filter;  // bloom filter over the ids (empty: the pack is too big, always searched)
+#ifndef _WIN32
+    mutable mutex fdLock;
+    mutable int fd = -1;  // opened on the first read, kept while fewer than PACK_OPEN_LIMIT are open
+#endif
+
+    explicit PackIndex(const fs::path& idxPath)
+        : indexInode(fileInode(idxPath)), dataPath(fs::path(idxPath).replace_extension(".pack")), index(idxPath) {
+        if (index.size < PACK_INDEX_HEADER || memcmp(index.data, PACK_INDEX_MAGIC, 8) != 0) {
+            throw runtime_error("Not a pack index: " + idxPath.string());
+        }
+        count = readLe64(index.data + 8);
+        if (index.size < PACK_INDEX_HEADER + count * PACK_INDEX_RECORD) throw runtime_error("Truncated pack index: " + idxPath.string());
+#ifndef _WIN32
+        dataInode = fileInode(dataPath);
+        if (dataInode == 0) throw runtime_error("Missing pack data: " + dataPath.string());
+#endif
+        if (count <= PACK_FILTER_MAX_OBJECTS) {
+            // ids are hashes already, so three of their words serve as the filter's hash functions (16 bits per id)
+            filter.assign(max<uint64_t>(1, count / 4), 0);
+            for (uint64_t i = 0; i < count; ++i) {
+                const uint8_t* id = index.data + PACK_INDEX_HEADER + i * PACK_INDEX_RECORD;
+                for (int k = 0; k < 3; ++k) {
+                    uint64_t bit = filterBit(id, k);
+                    filter[bit / 64] |= uint64_t(1) << (bit % 64);
+                }
+            }
+        }
+    }
+
+#ifndef _WIN32
+    ~PackIndex() {
+        if (fd >= 0) {
+            close(fd);
+            --openPackFiles;
+        }
+    }
+#endif
+
+    uint64_t filterBit(const uint8_t id[32], int k) const {
+        uint64_t word;
+        memcpy(&word, id + k * 8, 8);
+        return word % (filter.size() * 64);
+    }
+
+    //* function to rule out an id cheaply: false means the pack does not have it
+    bool mayContain(const uint8_t id[32]) const {
+        if (filter.empty()) return true;
+        for (int k = 0; k < 3; ++k) {
+            uint64_t bit = filterBit(id, k);
+            if (!(filter[bit / 64] >> (bit % 64) & 1)) return false;
+        }
+        return true;
+    }
+
+    //* function to read record i of the index: object id, offset and length in the pack
+    string entry(uint64_t i, uint64_t& offset, uint64_t& length) const {
+        const uint8_t* record = index.data + PACK_INDEX_HEADER + i * PACK_INDEX_RECORD;
+        offset = readLe64(record + 32);
+        length = readLe64(record + 40);
+        return bytesToId(record);
+    }
+
+    bool find(const uint8_t id[32], uint64_t& offset, uint64_t& length) const {
+        const uint8_t* records = index.data + PACK_INDEX_HEADER;
+        uint64_t lo = 0, hi = count;
+        while (lo < hi) {
+            uint64_t mid = lo + (hi - lo) / 2;
+            int c = memcmp(records + mid * PACK_INDEX_RECORD, id, 32);
+            if (c == 0) {
+                offset = readLe64(records + mid * PACK_INDEX_RECORD + 32);
+                length = readLe64(records + mid * PACK_INDEX_RECORD + 40);
+                return true;
+            }
+            if (c < 0) lo = mid + 1;
+            else hi = mid;
+        }
+        return false;
+    }
+
+#ifndef _WIN32
+    //* function to get a descriptor of the data file; `keep` is false if the caller has to close it
+    int openData(bool& keep) const {
+        lock_guard<mutex> guard(fdLock);
+        keep = true;
+        if (fd >= 0) return fd;
+        int handle = open(dataPath.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (handle >= 0 && (fstat(handle, &st) != 0 || uint64_t(st.st_ino) != dataInode)) {
+            close(handle);
+            throw runtime_error("Pack data changed: " + dataPath.string());
+        }
+        if (handle < 0) throw runtime_error("Missing pack data: " + dataPath.string() + ": " + strerror(errno));
+        if (++openPackFiles <= PACK_OPEN_LIMIT) return fd = handle;
+        --openPackFiles;
+        keep = false;
+        return handle;
+    }
+#endif
+
+    string read(uint64_t offset, uint64_t length) const {
+        string data(length, '\0');
+#ifdef _WIN32
+        ifstream in(dataPath, ios::binary);
+        in.seekg(static_cast<streamoff>(offset));
+        in.read(data.data(), static_cast<streamsize>(length));
+        if (static_cast<uint64_t>(in.gcount()) != length) throw runtime_error("Truncated pack: " + dataPath.string());
+#else
+        bool keep;
+        int handle = openData(keep);
+        for (uint64_t done = 0; done < length;) {
+            ssize_t got = pread(handle, data.data() + done, length - done, static_cast<off_t>(offset + done));
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) {
+                if (!keep) close(handle);
+                throw runtime_error("Truncated pack: " + dataPath.string());
+            }
+            done += uint64_t(got);
+        }
+        if (!keep) close(handle);
+#endif
+        return data;
+    }
+};
+
+//* all pack indexes of the store, mapped on first use
+struct PackStore {
+    mutex lock;
+    bool loaded = false;
+    vector<unique_ptr<PackIndex>> packs;
+
+    void load() {
+        if (loaded) return;
+        loaded = true;
+        if (!fs::exists(PACKS_DIR)) return;
+        for (const auto& entry : fs::directory_iterator(PACKS_DIR)) {
+            if (entry.path().extension() == ".idx") packs.push_back(make_unique<PackIndex>(entry.path()));
+        }
+    }
+
+    //* returns the pack holding the object (nullptr if none does)
+    const PackIndex* find(const string& id, uint64_t& offset, uint64_t& length) {
+        uint8_t key[32];
+        if (!idToBytes(id, key)) return nullptr;
+        lock_guard<mutex> guard(lock);
+        load();
+        for (const auto& pack : packs) {
+            if (pack->mayContain(key) && pack->find(key, offset, length)) return pack.get();
+        }
+        return nullptr;
+    }
+
+    void add(const fs::path& idxPath) {
+        lock_guard<mutex> guard(lock);
+        if (loaded) packs.push_back(make_unique<PackIndex>(idxPath));
+    }
+
+    //* function to check that the loaded indexes are still the packs on disk (by name and inode), so a
+    //* long-running process notices packs that another process pruned, rewrote or added
+    bool current() {
+        lock_guard<mutex> guard(lock);
+        if (!loaded) return true;
+        map<string, pair<uint64_t, uint64_t>> disk, mine;
+        error_code ec;
+        for (fs::directory_iterator it(PACKS_DIR, ec), end; !ec && it != end; it.increment(ec)) {
+            if (it->path().extension() != ".idx") continue;
+            fs::path data = fs::path(it->path()).replace_extension(".pack");
+            disk[it->path().filename().string()] = {fileInode(it->path()), fileInode(data)};
+        }
+        for (const auto& pack : packs) {
+            mine[fs::path(pack->dataPath).replace_extension(".idx").filename().string()] = {pack->indexInode, pack->dataInode};
+        }
+        return disk == mine;
+    }
+
+    //* function to forget the loaded indexes (after prune deleted or rewrote packs)
+    void reset() {
+        lock_guard<mutex> guard(lock);
+        packs.clear();
+        loaded = false;
+    }
+};
+
+PackStore& packStore() {
+    static PackStore store;
+    return store;
+}
+
+//* function to drop the pack indexes a long-running process (the daemon) has loaded if prune changed the
+//* packs since; called with the store lock held, so no prune step deletes a pack between the check and
+//* the lookups that dedup against it
+void refreshPackStore() {
+    if (!packStore().current()) packStore().reset();
+}
+
+//* the pack a running backup appends its new objects to; workers reserve a range under the lock and
+//* write it in parallel, the index is written (sorted) when the backup commits
+struct PackWriter {
+    fs::path dataPath, indexPath, tmpPath;
+    mutex lock;
+    uint64_t size = 0;
+    map<string, pair<uint64_t, uint64_t>> objects;  // id -> offset, length (sorted by id for the index)
+#ifdef _WIN32
+    fstream out;
+#else
+    int fd = -1;
+#endif
+
+    explicit PackWriter(const string& name) {
+        fs::create_directories(PACKS_DIR);
+        // a unique name even if two backups get the same timestamp: the temp file is created exclusively,
+        // so of two writers probing the same name only one gets it
+        string unique = name;
+        for (int n = 1;; unique = name + "-" + to_string(n++)) {
+            dataPath = fs::path(PACKS_DIR) / (unique + ".pack");
+            indexPath = fs::path(PACKS_DIR) / (unique + ".idx");
+            tmpPath = fs::path(PACKS_DIR) / (unique + ".pack.tmp");
+            if (fs::exists(dataPath) || fs::exists(indexPath)) continue;
+#ifdef _WIN32
+            if (fs::exists(tmpPath)) continue;
+            out.open(tmpPath, ios::binary | ios::in | ios::out | ios::trunc);
+            if (!out) throw runtime_error("Failed to open for writing: " + tmpPath.string());
+            break;
+#else
+            fd = open(tmpPath.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+            if (fd >= 0) break;
+            if (errno != EEXIST) throw runtime_error("Failed to open for writing: " + tmpPath.string() + ": " + strerror(errno));
+#endif
+        }
+    }
+
+    ~PackWriter() {
+#ifndef _WIN32
+        if (fd >= 0) close(fd);
+#endif
+        error_code ec;
+        fs::remove(tmpPath, ec);  // only still there if the backup failed
+    }
+
+    bool contains(const string& id) {
+        lock_guard<mutex> guard(lock);
+        return objects.count(id) > 0;
+    }
+
+    //* function to append an object, returns false if this pack already has it
+    bool add(const string& id, const void* data, size_t len) {
+        uint64_t offset;
+        {
+            lock_guard<mutex> guard(lock);
+            if (!objects.emplace(id, make_pair(size, uint64_t(len))).second) return false;
+            offset = size;
+            size += len;
+#ifdef _WIN32
+            out.seekp(static_cast<streamoff>(offset));
+            out.write(static_cast<const char*>(data), static_cast<streamsize>(len));
+            if (!out) throw runtime_error("Failed to write pack: " + tmpPath.string());
+            return true;
+#endif
+        }
+#ifndef _WIN32
+        const char* p = static_cast<const char*>(data);
+        for (size_t done = 0; done < len;) {
+            ssize_t put = pwrite(fd, p + done, len - done, static_cast<off_t>(offset + done));
+            if (put < 0 && errno == EINTR) continue;
+            if (put <= 0) throw runtime_error("Failed to write pack: " + tmpPath.string() + ": " + strerror(errno));
+            done += size_t(put);
+        }
+#endif
+        return true;
+    }
+
+    //* function to publish the pack: data first, then the index that makes its objects visible
+    void commit() {
+#ifdef _WIN32
+        out.close();
+#else
+        if (fsync(fd) != 0) throw runtime_error("Failed to flush pack: " + tmpPath.string());
+        close(fd);
+        fd = -1;
+#endif
+        if (objects.empty()) return;  // the temp file is removed by the destructor
+        fs::rename(tmpPath, dataPath);
+        string index(PACK_INDEX_MAGIC, 8);
+        appendLe64(index, objects.size());
+        for (const auto& [id, where] : objects) {
+            uint8_t key[32];
+            idToBytes(id, key);
+            index.append(reinterpret_cast<const char*>(key), 32);
+            appendLe64(index, where.first);
+            appendLe64(index, where.second);
+        }
+        fs::path tmpIndex = fs::path(indexPath).concat(".tmp");
+        {
+            ofstream idx(tmpIndex, ios::binary | ios::trunc);
+            idx.write(index.data(), static_cast<streamsize>(index.size()));
+            if (!idx.flush()) throw runtime_error("Failed to write pack index: " + tmpIndex.string());
+        }
+        syncFile(tmpIndex);
+        fs::rename(tmpIndex, indexPath);
+        syncFile(PACKS_DIR);  // both renames
+        packStore().add(indexPath);
+    }
+};
+
+//* the loose objects a running backup created; they are flushed in one batch before the snapshot is
+//* committed rather than with one fsync per object while the workers write
+struct NewObjects {
+    mutex lock;
+    vector<fs::path> files;
+
+    void add(const fs::path& file) {
+        lock_guard<mutex> guard(lock);
+        files.push_back(file);
+    }
+
+    //* function to flush the objects and the folders they were renamed into
+    void sync() {
+        if (files.empty()) return;
+#ifdef __linux__
+        // one syncfs writes back the data and the folder entries of the whole store's filesystem, far
+        // cheaper than an fsync per object for a tree of small files
+        int fd = open(OBJECTS_DIR.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        int error = fd < 0 || syncfs(fd) != 0 ? errno : 0;
+        if (fd >= 0) close(fd);
+        if (error) throw runtime_error("Failed to flush " + OBJECTS_DIR + ": " + strerror(error));
+#else
+        set<fs::path> folders;
+        for (const auto& file : files) {
+            syncFile(file);
+            folders.insert(file.parent_path());
+        }
+        for (const auto& folder : folders) syncFile(folder);
+        syncFile(OBJECTS_DIR);  // the objects/xx folders created on the way
+#endif
+        files.clear();
+    }
+};
+
+//* where a running backup puts its new objects: its pack (nullptr: every object is stored loose, one
+//* file each) and the compression; with --store=pack every new object goes into the pack, otherwise only
+//* the data of small files. Loose objects are recorded in `created` to be flushed before the commit.
+//* Owned by createBackup and handed down to everything that stores objects
+struct ObjectTarget {
+    PackWriter* pack = nullptr;
+    Compression compression = Compression::Off;
+    NewObjects* created = nullptr;
+};
+
+//* function to check whether the store already has an object, loose or packed (or in the running
+//* backup's pack, which is not published yet)
+bool objectExists(const ObjectTarget& target, const string& id) {
+    if (target.pack && target.pack->contains(id)) return true;
+    uint64_t offset, length;
+    if (packStore().find(id, offset, length)) return true;
+    return fs::exists(objectPath(id));
+}
+
+//* per-snapshot index (`__index__` next to the manifest): the same entries as fixed-size records sorted by
+//* path plus a string table, so a single path is found with a binary search over the mapped file
+//* instead of parsing the whole manifest
+const string SNAPSHOT_INDEX_NAME = "__index__";
+const char SNAPSHOT_INDEX_MAGIC[8] = {'B', 'K', 'S', 'N', 'A', 'P', '1', 0};
+const size_t SNAPSHOT_INDEX_HEADER = 24;  // magic, record count, offset of the string table
+
+struct SnapshotRecord {
+    uint64_t pathOffset;  // into the string table
+    uint32_t pathLength;
+    uint32_t mode;
+    uint64_t size;
+    int64_t mtime;
+    uint8_t type;
+    uint8_t hasChunks;
+    uint8_t reserved[6];
+    uint8_t id[32];
+    uint8_t chunks[32];
+};
+static_assert(sizeof(SnapshotRecord) == 104, "snapshot index records are 104 bytes on disk");
+
+//* function to append a snapshot index record in its on-disk form (the fields in order, little-endian)
+void appendSnapshotRecord(string& out, const SnapshotRecord& r) {
+    appendLe64(out, r.pathOffset);
+    appendLe32(out, r.pathLength);
+    appendLe32(out, r.mode);
+    appendLe64(out, r.size);
+    appendLe64(out, uint64_t(r.mtime));
+    out.push_back(char(r.type));
+    out.push_back(char(r.hasChunks));
+    out.append(sizeof(r.reserved), '\0');
+    out.append(reinterpret_cast<const char*>(r.id), sizeof(r.id));
+    out.append(reinterpret_cast<const char*>(r.chunks), sizeof(r.chunks));
+}
+
+SnapshotRecord readSnapshotRecord(const uint8_t* p) {
+    SnapshotRecord r = {};
+    r.pathOffset = readLe64(p);
+    r.pathLength = readLe32(p + 8);
+    r.mode = readLe32(p + 12);
+    r.size = readLe64(p + 16);
+    r.mtime = int64_t(readLe64(p + 24));
+    r.type = p[32];
+    r.hasChunks = p[33];
+    memcpy(r.id, p + 40, sizeof(r.id));
+    memcpy(r.chunks, p + 72, sizeof(r.chunks));
+    return r;
+}
+
+//* function to write the index of a snapshot (sorts `entries` by path)
+void writeSnapshotIndex(const fs::path& file, vector<ManifestEntry>& entries) {
+    sort(entries.begin(), entries.end(), [](const ManifestEntry& a, const ManifestEntry& b) { return a.path < b.path; });
+    string records, strings;
+    records.reserve(entries.size() * sizeof(SnapshotRecord));
+    for (const auto& e : entries) {
+        SnapshotRecord r = {};
+        r.pathOffset = strings.size();
+        r.pathLength = static_cast<uint32_t>(e.path.size());
+        r.mode = e.mode;
+        r.size = e.size;
+        r.mtime = e.mtime;
+        r.type = uint8_t(e.type);
+        r.hasChunks = e.chunks != "-";
+        idToBytes(e.id, r.id);
+        if (r.hasChunks) idToBytes(e.chunks, r.chunks);
+        appendSnapshotRecord(records, r);
+        strings += e.path;
+    }
+    uint64_t count = entries.size(), stringsOffset = SNAPSHOT_INDEX_HEADER + records.size();
+    fs::path tmp = fs::path(file).concat(".tmp");
+    {
+        ofstream out(tmp, ios::binary | ios::trunc);
+        string header(SNAPSHOT_INDEX_MAGIC, 8);
+        appendLe64(header, count);
+        appendLe64(header, stringsOffset);
+        out.write(header.data(), static_cast<streamsize>(header.size()));
+        out.write(records.data(), static_cast<streamsize>(records.size()));
+        out.write(strings.data(), static_cast<streamsize>(strings.size()));
+        if (!out.flush()) throw runtime_error("Failed to write snapshot index: " + tmp.string());
+    }
+    syncFile(tmp);
+    fs::rename(tmp, file);
+}
+
+//* function to look up one path in a snapshot index, returns false if the snapshot does not have it
+bool findInSnapshotIndex(const fs::path& file, const string& path, ManifestEntry& found) {
+    MappedFile index(file);
+    if (index.size < SNAPSHOT_INDEX_HEADER || memcmp(index.data, SNAPSHOT_INDEX_MAGIC, 8) != 0) {
+        throw runtime_error("Not a snapshot index: " + file.string());
+    }
+    uint64_t count = readLe64(index.data + 8), stringsOffset = readLe64(index.data + 16);
+    if (stringsOffset != SNAPSHOT_INDEX_HEADER + count * sizeof(SnapshotRecord) || stringsOffset > index.size) {
+        throw runtime_error("Corrupt snapshot index: " + file.string());
+    }
+    auto record = [&](uint64_t i) {
+        SnapshotRecord r = readSnapshotRecord(index.data + SNAPSHOT_INDEX_HEADER + i * sizeof(SnapshotRecord));
+        if (stringsOffset + r.pathOffset + r.pathLength > index.size) throw runtime_error("Corrupt snapshot index: " + file.string());
+        return r;
+    };
+    auto pathOf = [&](const SnapshotRecord& r) {
+        return string_view(reinterpret_cast<const char*>(index.data + stringsOffset + r.pathOffset), r.pathLength);
+    };
+    uint64_t lo = 0, hi = count;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        SnapshotRecord r = record(mid);
+        int c = pathOf(r).compare(path);
+        if (c == 0) {
+            found.path = path;
+            found.type = char(r.type);
+            found.mode = r.mode;
+            found.size = r.size;
+            found.mtime = r.mtime;
+            found.id = r.type == 'd' ? "-" : bytesToId(r.id);
+            found.chunks = r.hasChunks ? bytesToId(r.chunks) : "-";
+            return true;
+        }
+        if (c < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return false;
+}
+
+//* snapshot catalog (`.backup/__catalog__`): one fixed 128-byte record per committed snapshot, appended
+//* in sequence order after a 16-byte header ("BKCAT1" + record size); every record carries a CRC-32 so a
+//* torn append at the end is recognised and ignored. The newest snapshot is the last record, a sequence
+//* number or a point in time is a binary search over the mapped file.
+const string CATALOG_FILE = ".backup/__catalog__";
+const char CATALOG_MAGIC[8] = {'B', 'K', 'C', 'A', 'T', '1', 0, 0};
+const size_t CATALOG_HEADER = 16;
+
+struct CatalogRecord {
+    uint64_t seq;       // 1, 2, 3, ... never reused
+    int64_t time;       // creation time, unix seconds
+    uint64_t files;
+    uint64_t folders;
+    uint64_t bytes;     // total size of the files in the snapshot
+    uint64_t bytesNew;  // bytes the snapshot added to the store
+    char name[40];      // snapshot folder in .backup, zero padded
+    uint8_t root[32];   // root tree id with CATALOG_TREE, else the content id of the snapshot's manifest
+    uint32_t flags;
+    uint32_t crc;       // CRC-32 of everything before it
+};
+static_assert(sizeof(CatalogRecord) == 128, "catalog records are 128 bytes on disk");
+const uint32_t CATALOG_TREE = 1;
+
+//* function to compute the CRC-32 (IEEE) of a buffer
+uint32_t crc32(const void* data, size_t len) {
+    static const auto table = [] {
+        array<uint32_t, 256> t{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+    uint32_t crc = 0xFFFFFFFFU;
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < len; ++i) crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFFU;
+}
+
+//* function to append a catalog record in its on-disk form: the fields in order, little-endian, then the
+//* CRC-32 of those bytes
+void appendCatalogRecord(string& out, const CatalogRecord& r) {
+    size_t start = out.size();
+    appendLe64(out, r.seq);
+    appendLe64(out, uint64_t(r.time));
+    appendLe64(out, r.files);
+    appendLe64(out, r.folders);
+    appendLe64(out, r.bytes);
+    appendLe64(out, r.bytesNew);
+    out.append(r.name, sizeof(r.name));
+    out.append(reinterpret_cast<const char*>(r.root), sizeof(r.root));
+    appendLe32(out, r.flags);
+    appendLe32(out, crc32(out.data() + start, out.size() - start));
+}
+
+//* function to read a catalog record, false if its CRC does not match (a torn or damaged record)
+bool readCatalogRecord(const uint8_t* p, CatalogRecord& r) {
+    r.seq = readLe64(p);
+    r.time = int64_t(readLe64(p + 8));
+    r.files = readLe64(p + 16);
+    r.folders = readLe64(p + 24);
+    r.bytes = readLe64(p + 32);
+    r.bytesNew = readLe64(p + 40);
+    memcpy(r.name, p + 48, sizeof(r.name));
+    memcpy(r.root, p + 88, sizeof(r.root));
+    r.flags = readLe32(p + 120);
+    r.crc = readLe32(p + 124);
+    return r.crc == crc32(p, offsetof(CatalogRecord, crc));
+}
+
+string catalogName(const CatalogRecord& r) {
+    return string(r.name, strnlen(r.name, sizeof(r.name)));
+}
+
+//* function to format a catalog time as local time (same format as the snapshot names)
+string formatLocalTime(int64_t unixSeconds) {
+    time_t t = static_cast<time_t>(unixSeconds);
+    tm localTime;
+#ifdef _WIN32
+    localtime_s(&localTime, &t);
+#else
+    localtime_r(&t, &localTime);
+#endif
+    stringstream ss;
+    ss << put_time(&localTime, "%Y-%m-%d_%H-%M-%S");
+    return ss.str();
+}
+
+//* function to parse a local time for `pull --at`: 2024-05-01, 2024-05-01_13-45-00, 2024-05-01T13:45[:00]
+//* or @<unix seconds>; returns the unix time (a date alone means the end of that day)
+int64_t parseLocalTime(const string& text) {
+    if (!text.empty() && text[0] == '@') {
+        try {
+            return stoll(text.substr(1));
+        } catch (...) {
+            throw runtime_error("Invalid time: " + text);
+        }
+    }
+    tm t = {};
+    int fields = sscanf(text.c_str(), "%d-%d-%d%*1[_T ]%d%*1[-:]%d%*1[-:]%d", &t.tm_year, &t.tm_mon, &t.tm_mday,
+                        &t.tm_hour, &t.tm_min, &t.tm_sec);
+    if (fields != 3 && fields < 5) throw runtime_error("Invalid time (use YYYY-MM-DD[_HH-MM[-SS]] or @unix): " + text);
+    if (fields == 3) {
+        t.tm_hour = 23;
+        t.tm_min = 59;
+        t.tm_sec = 59;
+    }
+    t.tm_year -= 1900;
+    t.tm_mon -= 1;
+    t.tm_isdst = -1;
+    time_t result = mktime(&t);
+    if (result == time_t(-1)) throw runtime_error("Invalid time: " + text);
+    return int64_t(result);
+}
+
+//* read-only view of the catalog; records past the last valid one (a torn append) are not counted
+struct Catalog {
+    unique_ptr<MappedFile> file;
+    size_t count = 0;
+
+    Catalog() {
+        if (!fs::exists(CATALOG_FILE)) return;
+        file = make_unique<MappedFile>(CATALOG_FILE);
+        if (file->size < CATALOG_HEADER) return;
+        if (memcmp(file->data, CATALOG_MAGIC, 8) != 0 || readLe32(file->data + 8) != sizeof(CatalogRecord)) {
+            throw runtime_error("Not a snapshot catalog: " + CATALOG_FILE);
+        }
+        count = (file->size - CATALOG_HEADER) / sizeof(CatalogRecord);
+        CatalogRecord r;
+        while (count > 0 && !record(count - 1, r)) --count;
+    }
+
+    //* function to read record i, false if it is damaged
+    bool record(size_t i, CatalogRecord& r) const {
+        return readCatalogRecord(file->data + CATALOG_HEADER + i * sizeof(CatalogRecord), r);
+    }
+
+    //* function to get record i, throws if it is damaged
+    CatalogRecord at(size_t i) const {
+        CatalogRecord r;
+        if (!record(i, r)) throw runtime_error("Damaged catalog record " + to_string(i) + " in " + CATALOG_FILE);
+        return r;
+    }
+
+    bool empty() const { return count == 0; }
+    CatalogRecord last() const { return at(count - 1); }
+
+    //* function to find a snapshot by sequence number (sequence numbers grow with the position)
+    bool findSeq(uint64_t seq, CatalogRecord& found) const {
+        size_t lo = 0, hi = count;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            CatalogRecord r = at(mid);
+            if (r.seq == seq) {
+                found = r;
+                return true;
+            }
+            if (r.seq < seq) lo = mid + 1;
+            else hi = mid;
+        }
+        return false;
+    }
+
+    //* function to find the newest snapshot taken at or before a time
+    bool findAt(int64_t time, CatalogRecord& found) const {
+        size_t lo = 0, hi = count;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (at(mid).time <= time) lo = mid + 1;
+            else hi = mid;
+        }
+        if (lo == 0) return false;
+        found = at(lo - 1);
+        return true;
+    }
+};
+
+//* function to fill in a catalog record from a committed snapshot's manifest entries
+CatalogRecord makeCatalogRecord(const string& name, int64_t time, const vector<ManifestEntry>& entries, uint64_t bytesNew) {
+    CatalogRecord r = {};
+    r.time = time;
+    for (const auto& e : entries) {
+        if (e.type == 'd') {
+            ++r.folders;
+        } else {
+            ++r.files;
+            r.bytes += e.size;
+        }
+    }
+    r.bytesNew = bytesNew;
+    if (name.size() >= sizeof(r.name)) throw runtime_error("Snapshot name too long for the catalog: " + name);
+    memcpy(r.name, name.data(), name.size());
+    fs::path manifest = fs::path(".backup") / name / MANIFEST_NAME;
+    ifstream tree(fs::path(".backup") / name / TREE_NAME);
+    string treeId;
+    if (tree >> treeId && idToBytes(treeId, r.root)) {
+        r.flags |= CATALOG_TREE;
+    } else if (fs::exists(manifest)) {
+        ifstream in(manifest, ios::binary);
+        string content((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        idToBytes(hashBytes(content.data(), content.size()), r.root);
+    }
+    return r;
+}
+
+//* function to write a whole catalog at once (temp file + rename)
+void writeCatalog(const vector<CatalogRecord>& records) {
+    string data(CATALOG_MAGIC, 8);
+    appendLe32(data, sizeof(CatalogRecord));
+    appendLe32(data, 0);
+    for (const auto& r : records) appendCatalogRecord(data, r);
+    fs::path tmp = CATALOG_FILE + ".tmp";
+    {
+        ofstream out(tmp, ios::binary | ios::trunc);
+        out.write(data.data(), static_cast<streamsize>(data.size()));
+        if (!out.flush()) throw runtime_error("Failed to write catalog: " + tmp.string());
+    }
+    syncFile(tmp);
+    fs::rename(tmp, CATALOG_FILE);
+    syncFile(".backup");
+}
+
+//* advisory lock on `.backup/__lock__` between backups and prune: backups (and restores, verifies) hold it
+//* shared for their whole run, prune takes it exclusively only for short steps (dropping snapshots, deleting
+//* one batch of objects), so prune waits for running backups and a new backup waits at most one step
+const string STORE_LOCK_FILE = ".backup/__lock__";
+const string CATALOG_LOCK_FILE = ".backup/__catalog_lock__";  // held exclusively while the catalog is written
+
+struct StoreLock {
+#ifdef _WIN32
+    HANDLE handle = INVALID_HANDLE_VALUE;
+
+    explicit StoreLock(bool exclusive, const string& file = STORE_LOCK_FILE) {
+        handle = CreateFileW(fs::path(file).c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                             nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (handle == INVALID_HANDLE_VALUE) throw runtime_error("Failed to open " + file);
+        OVERLAPPED at = {};
+        if (!LockFileEx(handle, exclusive ? LOCKFILE_EXCLUSIVE_LOCK : 0, 0, 1, 0, &at)) {
+            CloseHandle(handle);
+            throw runtime_error("Failed to lock " + file);
+        }
+    }
+
+    ~StoreLock() { CloseHandle(handle); }
+#else
+    int fd = -1;
+
+    explicit StoreLock(bool exclusive, const string& file = STORE_LOCK_FILE) {
+        fd = open(file.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) throw runtime_error("Failed to open " + file + ": " + strerror(errno));
+        while (flock(fd, exclusive ? LOCK_EX : LOCK_SH) != 0) {
+            if (errno == EINTR) continue;
+            close(fd);
+            throw runtime_error("Failed to lock " + file + ": " + strerror(errno));
+        }
+    }
+
+    ~StoreLock() { close(fd); }  // closing the descriptor releases the lock
+#endif
+    StoreLock(const StoreLock&) = delete;
+    StoreLock& operator=(const StoreLock&) = delete;
+};
+
+//* function to create the catalog for a store that has snapshots from before the catalog existed,
+//* oldest first by name (names are timestamps)
+void ensureCatalog() {
+    if (fs::exists(CATALOG_FILE)) return;
+    vector<fs::path> folders = listBackups();
+    if (folders.empty()) return;
+    StoreLock catalogLock(true, CATALOG_LOCK_FILE);
+    if (fs::exists(CATALOG_FILE)) return;  // another process created it meanwhile
+    reverse(folders.begin(), folders.end());
+    vector<CatalogRecord> records;
+    for (const auto& dir : folders) {
+        // a folder a running backup has claimed but not committed yet is not an old snapshot
+        if (!fs::exists(dir / MANIFEST_NAME) && (fs::is_empty(dir) || fs::exists(dir / (MANIFEST_NAME + ".tmp")))) continue;
+        string name = dir.filename().string();
+        int64_t time;
+        try {
+            time = parseLocalTime(name.substr(7));
+        } catch (...) {
+            time = fileTimeToUnixNs(fs::last_write_time(dir)) / 1000000000;
+        }
+        vector<ManifestEntry> entries;
+        if (fs::exists(dir / MANIFEST_NAME)) {
+            entries = readManifest(dir / MANIFEST_NAME);
+        } else {
+            // plain copies from before the object store
+            for (const auto& f : fs::directory_iterator(dir)) {
+                ManifestEntry e;
+                e.type = f.is_directory() ? 'd' : 'f';
+                e.size = e.type == 'f' ? f.file_size() : 0;
+                entries.push_back(e);
+            }
+        }
+        CatalogRecord r = makeCatalogRecord(name, time, entries, 0);
+        r.seq = records.size() + 1;
+        records.push_back(r);
+    }
+    if (records.empty()) return;
+    writeCatalog(records);
+    logAction("Created snapshot catalog for " + to_string(records.size()) + " existing backups");
+}
+
+//* function to get the sequence number of the newest committed snapshot (0 if there is none); a caller
+//* compares it before and after createBackup to tell whether the snapshot was committed
+uint64_t lastCatalogSeq() {
+    ensureCatalog();
+    Catalog catalog;
+    return catalog.empty() ? 0 : catalog.last().seq;
+}
+
+//* function to append a committed snapshot to the catalog, returns its sequence number (unique and
+//* increasing, also across concurrent backups); one write of one record, so readers see either the old
+//* or the new catalog
+//* (the caller has run ensureCatalog before creating the snapshot folder)
+uint64_t appendToCatalog(CatalogRecord r) {
+    StoreLock catalogLock(true, CATALOG_LOCK_FILE);  // concurrent backups commit one after the other
+    size_t validBytes;
+    {
+        Catalog catalog;
+        r.seq = catalog.empty() ? 1 : catalog.last().seq + 1;
+        validBytes = catalog.file ? CATALOG_HEADER + catalog.count * sizeof(CatalogRecord) : 0;
+    }
+    if (validBytes == 0) {
+        vector<CatalogRecord> records = {r};
+        writeCatalog(records);
+        return r.seq;
+    }
+    string record;
+    appendCatalogRecord(record, r);
+    // drop a torn record from an interrupted append before adding the new one
+    if (fs::file_size(CATALOG_FILE) != validBytes) fs::resize_file(CATALOG_FILE, validBytes);
+#ifdef _WIN32
+    ofstream out(CATALOG_FILE, ios::binary | ios::app);
+    out.write(record.data(), static_cast<streamsize>(record.size()));
+    if (!out.flush()) throw runtime_error("Failed to write catalog: " + CATALOG_FILE);
+#else
+    int fd = open(CATALOG_FILE.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (fd < 0) throw runtime_error("Failed to open catalog: " + CATALOG_FILE + ": " + strerror(errno));
+    bool ok = write(fd, record.data(), record.size()) == ssize_t(record.size()) && fsync(fd) == 0;
+    close(fd);
+    if (!ok) throw runtime_error("Failed to write catalog: " + CATALOG_FILE);
+#endif
+    return r.seq;
+}
+
+//* function to get the folder of the newest snapshot (empty path if there is none);
+//* O(1) with the catalog, stores without one are listed instead
+fs::path latestSnapshot() {
+    ensureCatalog();
+    Catalog catalog;
+    if (!catalog.empty()) return fs::path(".backup") / catalogName(catalog.last());
+    vector<fs::path> backups = listBackups();
+    return backups.empty() ? fs::path() : backups[0];
+}
+
+//* hash cache (`.backup/__hashcache__`): maps a file's identity and change stamps (device, inode, size,
+//* mtime, ctime) to the content id it had when it was last read, so a file whose stamps did not change is
+//* taken over without being opened. The file is a sorted open-addressing table: fixed 120-byte slots after
+//* a 32-byte header, every entry sits at or after its home slot (hash scaled to the home count) in hash
+//* order, so a lookup is one mapped read plus a short forward probe that stops at a gap or a larger hash.
+//* Entries are only written for files whose mtime and ctime are at least one timestamp granule older than
+//* the scan: a file changed again within the same granule after it was read would keep its stamps, so such
+//* "racily clean" files are read again next time instead of being trusted.
+//* Unlike the store's other files the slots are raw structs in host byte order: device and inode numbers
+//* only mean something on the machine that wrote them, so the cache is never portable. A file from a host
+//* of the other byte order fails the size check in HashCache and is rebuilt by the next backup.
+const string HASH_CACHE_FILE = ".backup/__hashcache__";
+const char HASH_CACHE_MAGIC[8] = {'B', 'K', 'H', 'C', 'A', 'C', '1', 0};
+const size_t HASH_CACHE_HEADER = 32;  // magic, slot count, entry count, home count
+
+struct HashCacheEntry {
+    uint64_t hash;  // of device and inode, the table is sorted by it
+    uint64_t device;
+    uint64_t inode;
+    uint64_t size;
+    int64_t mtime;
+    int64_t ctime;
+    uint8_t id[32];
+    uint8_t chunks[32];
+    uint32_t flags;  // HASH_CACHE_USED | HASH_CACHE_CHUNKS
+    uint32_t reserved;
+};
+static_assert(sizeof(HashCacheEntry) == 120, "hash cache slots are written as raw bytes (host order)");
+enum : uint32_t { HASH_CACHE_USED = 1, HASH_CACHE_CHUNKS = 2 };
+
+uint64_t hashCacheKey(uint64_t device, uint64_t inode) {
+    // splitmix64 finaliser over both halves of the identity
+    uint64_t x = device * 0x9E3779B97F4A7C15ULL ^ inode;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+//* function to map a hash onto [0, homes) keeping the order of the hashes
+uint64_t hashCacheHome(uint64_t hash, uint64_t homes) {
+#if defined(__SIZEOF_INT128__)
+    return uint64_t((unsigned __int128)hash * homes >> 64);
+#else
+    return uint64_t(double(hash) / 18446744073709551616.0 * double(homes));
+#endif
+}
+
+//* read-only view of the hash cache of the last backup
+struct HashCache {
+    unique_ptr<MappedFile> file;
+    uint64_t slots = 0, entries = 0, homes = 0;
+
+    explicit HashCache(bool load = true) {
+        if (!load || !fs::exists(HASH_CACHE_FILE)) return;
+        try {
+            file = make_unique<MappedFile>(HASH_CACHE_FILE);
+        } catch (const exception&) {
+            return;  // a cache is only an optimisation
+        }
+        if (file->size < HASH_CACHE_HEADER || memcmp(file->data, HASH_CACHE_MAGIC, 8) != 0) return;
+        uint64_t header[3];
+        memcpy(header, file->data + 8, sizeof(header));
+        if (file->size != HASH_CACHE_HEADER + header[0] * sizeof(HashCacheEntry) || header[2] == 0) return;
+        slots = header[0];
+        entries = header[1];
+        homes = header[2];
+    }
+
+    bool loaded() const { return homes != 0; }
+
+    HashCacheEntry slot(uint64_t i) const {
+        HashCacheEntry e;
+        memcpy(&e, file->data + HASH_CACHE_HEADER + i * sizeof(HashCacheEntry), sizeof(e));
+        return e;
+    }
+
+    //* function to find the content id of a file whose identity and stamps all match
+    bool find(uint64_t device, uint64_t inode, uint64_t size, int64_t mtime, int64_t ctime, string& id, string& chunks) const {
+        if (!loaded()) return false;
+        uint64_t hash = hashCacheKey(device, inode);
+        for (uint64_t i = hashCacheHome(hash, homes); i < slots; ++i) {
+            HashCacheEntry e = slot(i);
+            if (!(e.flags & HASH_CACHE_USED) || e.hash > hash) return false;
+            if (e.hash != hash || e.device != device || e.inode != inode) continue;
+            if (e.size != size || e.mtime != mtime || e.ctime != ctime) return false;
+            id = bytesToId(e.id);
+            chunks = (e.flags & HASH_CACHE_CHUNKS) ? bytesToId(e.chunks) : "-";
+            return true;
+        }
+        return false;
+    }
+};
+
+//* function to make a cache entry for a stored file
+HashCacheEntry makeHashCacheEntry(uint64_t device, uint64_t inode, const ManifestEntry& e, int64_t ctime) {
+    HashCacheEntry c = {};
+    c.hash = hashCacheKey(device, inode);
+    c.device = device;
+    c.inode = inode;
+    c.size = e.size;
+    c.mtime = e.mtime;
+    c.ctime = ctime;
+    idToBytes(e.id, c.id);
+    c.flags = HASH_CACHE_USED;
+    if (e.chunks != "-") {
+        idToBytes(e.chunks, c.chunks);
+        c.flags |= HASH_CACHE_CHUNKS;
+    }
+    return c;
+}
+
+//* function to sort cache entries into slot order and drop duplicate inodes
+void sortHashCacheEntries(vector<HashCacheEntry>& entries) {
+    sort(entries.begin(), entries.end(), [](const HashCacheEntry& a, const HashCacheEntry& b) {
+        return tie(a.hash, a.device, a.inode) < tie(b.hash, b.device, b.inode);
+    });
+    // hard links share an inode and the same content, keep one entry
+    entries.erase(unique(entries.begin(), entries.end(), [](const HashCacheEntry& a, const HashCacheEntry& b) {
+                      return a.device == b.device && a.inode == b.inode;
+                  }),
+                  entries.end());
+}
+
+//* function to write the hash cache; `entries` must be sorted and are streamed into their slots,
+//* gaps are written as empty slots (about one in five slots stays empty)
+void writeHashCache(const vector<HashCacheEntry>& entries) {
+    uint64_t homes = max<uint64_t>(16, entries.size() + entries.size() / 4);
+    fs::path tmp = HASH_CACHE_FILE + ".tmp";
+    ofstream out(tmp, ios::binary | ios::trunc);
+    if (!out) throw runtime_error("Failed to write hash cache: " + tmp.string());
+    uint64_t header[4] = {0, entries.size(), homes, 0};
+    out.write(HASH_CACHE_MAGIC, 8);
+    out.write(reinterpret_cast<const char*>(header), 24);
+    const HashCacheEntry empty = {};
+    uint64_t slot = 0;
+    for (const auto& e : entries) {
+        for (uint64_t home = hashCacheHome(e.hash, homes); slot < home; ++slot) {
+            out.write(reinterpret_cast<const char*>(&empty), sizeof(empty));
+        }
+        out.write(reinterpret_cast<const char*>(&e), sizeof(e));
+        ++slot;
+    }
+    // entries pushed past the last home slot extend the table
+    for (; slot < homes; ++slot) out.write(reinterpret_cast<const char*>(&empty), sizeof(empty));
+    out.seekp(8);
+    out.write(reinterpret_cast<const char*>(&slot), 8);
+    if (!out.flush()) throw runtime_error("Failed to write hash cache: " + tmp.string());
+    out.close();
+    fs::rename(tmp, HASH_CACHE_FILE);
+}
+
+//* token bucket: `rate` units per second with up to `burst` saved up. Callers take what they used and sleep
+//* off any debt, so the rate holds on average over all threads (0 = unlimited)
+struct TokenBucket {
+    double rate = 0;
+    double burst = 0;
+    double tokens = 0;
+    chrono::steady_clock::time_point last = chrono::steady_clock::now();
+    mutex lock;
+
+    explicit TokenBucket(double perSec = 0) { configure(perSec); }
+
+    //* function to set the rate, a tenth of a second can be saved up
+    void configure(double perSec) {
+        lock_guard<mutex> guard(lock);
+        rate = perSec;
+        burst = perSec / 10;
+        tokens = burst;
+        last = chrono::steady_clock::now();
+    }
+
+    //* function to take `n` units, returns how long the caller has to wait; `scale` slows the rate down
+    chrono::nanoseconds take(double n, double scale = 1) {
+        if (rate <= 0) return chrono::nanoseconds(0);
+        lock_guard<mutex> guard(lock);
+        double r = rate * scale;
+        auto now = chrono::steady_clock::now();
+        tokens = min(burst, tokens + r * chrono::duration<double>(now - last).count());
+        last = now;
+        tokens -= n;
+        if (tokens >= 0) return chrono::nanoseconds(0);
+        return chrono::nanoseconds(static_cast<int64_t>(-tokens / r * 1e9));
+    }
+
+    //* function to take `n` units and wait until they are paid for (counted as throttled time)
+    void acquire(double n) {
+        auto wait = take(n);
+        if (wait.count() <= 0) return;
+        PhaseTimer timer(RunStats::Throttle);
+        this_thread::sleep_for(wait);
+    }
+};
+
+//* I/O throttling of do/pull/verify: `read-rate`, `write-rate` (MB/s) and `iops` are token buckets,
+//* `throttle: adaptive` also backs off while the system is short of I/O: when `some avg10` in
+//* /proc/pressure/io is above `throttle-pressure` percent, or when the latency of our own reads climbs
+//* well above its long-run average. Backing off adds a pause to every read and write that doubles on
+//* every check that sees pressure (up to 200 ms) and halves on every check that does not. `nice` and
+//* `ioprio` (idle or best-effort 0-7) lower the priority of the worker threads
+struct ThrottleOptions {
+    double readBytesPerSec = 0;
+    double writeBytesPerSec = 0;
+    double iops = 0;
+    bool adaptive = false;
+    double pressureLimit = 10;  // percent
+    int nice = 0;               // 0 = leave as it is, 1..19
+    int ioprioClass = 0;        // 0 = leave as it is, 2 = best effort, 3 = idle
+    int ioprioLevel = 4;
+
+    bool lowersPriority() const { return nice > 0 || ioprioClass != 0; }
+};
+
+//* function to read the throttle options from arguments, falling back to .backup/__init__
+ThrottleOptions parseThrottleOptions(const vector<string>& args, map<string, string> config) {
+    ThrottleOptions t;
+    t.readBytesPerSec = double(argNumber(args, "--read-rate", configNumber(config, "read-rate", 0))) * 1e6;
+    t.writeBytesPerSec = double(argNumber(args, "--write-rate", configNumber(config, "write-rate", 0))) * 1e6;
+    t.iops = double(argNumber(args, "--iops", configNumber(config, "iops", 0)));
+    string mode = argValue(args, "--throttle", config.count("throttle") ? config["throttle"] : "off");
+    if (mode != "off" && mode != "adaptive") throw runtime_error("Unknown --throttle (use off or adaptive): " + mode);
+    t.adaptive = mode == "adaptive";
+    t.pressureLimit = double(configNumber(config, "throttle-pressure", 10));
+    uint64_t nice = argNumber(args, "--nice", configNumber(config, "nice", 0));
+    if (nice > 19) throw runtime_error("--nice must be between 0 and 19");
+    t.nice = static_cast<int>(nice);
+    string ioprio = argValue(args, "--ioprio", config.count("ioprio") ? config["ioprio"] : "");
+    if (ioprio == "idle") {
+        t.ioprioClass = 3;
+    } else if (!ioprio.empty()) {
+        if (ioprio.size() != 1 || ioprio[0] < '0' || ioprio[0] > '7') {
+            throw runtime_error("Unknown --ioprio (use idle or a best-effort level 0-7): " + ioprio);
+        }
+        t.ioprioClass = 2;
+        t.ioprioLevel = ioprio[0] - '0';
+    }
+    return t;
+}
+
+//* function to lower the calling worker thread's CPU and I/O priority (Linux, both are per thread there)
+void applyWorkerPriority(const ThrottleOptions& t) {
+#ifdef __linux__
+    pid_t tid = static_cast<pid_t>(syscall(SYS_gettid));
+    if (t.nice > 0) setpriority(PRIO_PROCESS, static_cast<id_t>(tid), t.nice);
+    // IOPRIO_WHO_PROCESS with a thread id, the class sits above the 13 data bits
+    if (t.ioprioClass != 0) syscall(SYS_ioprio_set, 1, tid, t.ioprioClass << 13 | (t.ioprioClass == 2 ? t.ioprioLevel : 0));
+#else
+    (void)t;
+#endif
+}
+
+struct IoThrottle {
+    ThrottleOptions options;  // of the running command, for helper threads to take the same priorities
+    TokenBucket readBytes, writeBytes, ops;
+    bool adaptive = false;
+    double pressureLimit = 10;
+    atomic<int64_t> pauseUs{0};
+    atomic<int64_t> nextCheckNs{0};
+    mutex checkLock;
+    double shortLatencyUs = 0, longLatencyUs = 0;  // read latency per MiB, fast and slow moving averages
+    bool congested = false;
+
+    void configure(const ThrottleOptions& t) {
+        options = t;
+        readBytes.configure(t.readBytesPerSec);
+        writeBytes.configure(t.writeBytesPerSec);
+        ops.configure(t.iops);
+        adaptive = t.adaptive;
+        pressureLimit = t.pressureLimit;
+        pauseUs = 0;
+        nextCheckNs = 0;
+        lock_guard<mutex> guard(checkLock);
+        shortLatencyUs = longLatencyUs = 0;
+        congested = false;
+    }
+
+    //* function to read `some avg10` of /proc/pressure/io, -1 where the kernel has no PSI
+    static double ioPressure() {
+#ifdef __linux__
+        ifstream in("/proc/pressure/io");
+        string word;
+        while (in >> word) {
+            if (word.rfind("avg10=", 0) == 0) return atof(word.c_str() + 6);
+        }
+#endif
+        return -1;
+    }
+
+    //* function to re-check the pressure at most every 250 ms and move the pause
+    void adapt(uint64_t readBytes, chrono::steady_clock::duration took) {
+        unique_lock<mutex> guard(checkLock, try_to_lock);
+        if (!guard.owns_lock()) return;
+        if (readBytes >= 4096) {
+            double us = chrono::duration<double, micro>(took).count() * 1048576.0 / double(readBytes);
+            shortLatencyUs = shortLatencyUs == 0 ? us : shortLatencyUs * 0.8 + us * 0.2;
+            longLatencyUs = longLatencyUs == 0 ? us : longLatencyUs * 0.99 + us * 0.01;
+        }
+        int64_t now = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+        if (now < nextCheckNs) return;
+        nextCheckNs = now + 250000000;
+        double pressure = ioPressure();
+        // reads that got 4x slower than usual (and take more than 2 ms per MiB) mean the disk is busy
+        bool slow = longLatencyUs > 0 && shortLatencyUs > 4 * longLatencyUs && shortLatencyUs > 2000;
+        bool busy = pressure > pressureLimit || slow;
+        int64_t pause = pauseUs;
+        pause = busy ? min<int64_t>(200000, max<int64_t>(1000, pause * 2)) : (pause < 1000 ? 0 : pause / 2);
+        pauseUs = pause;
+        if (busy != congested) {
+            congested = busy;
+            ostringstream line;
+            line << "Throttle: " << (busy ? "backing off" : "pressure gone") << " (io pressure " << pressure
+                 << "%, read latency " << int64_t(shortLatencyUs) << " us/MiB)";
+            logAction(line.str());
+        }
+    }
+
+    void wait(chrono::nanoseconds a, chrono::nanoseconds b) {
+        auto wait = max(a, b) + chrono::microseconds(adaptive ? pauseUs.load(memory_order_relaxed) : 0);
+        if (wait.count() <= 0) return;
+        PhaseTimer timer(RunStats::Throttle);
+        this_thread::sleep_for(wait);
+    }
+
+    //* function to account one read call that returned `bytes` after `took`, sleeps if over budget
+    void afterRead(uint64_t bytes, chrono::steady_clock::duration took) {
+        if (adaptive) adapt(bytes, took);
+        wait(readBytes.take(double(bytes)), ops.take(1));
+    }
+
+    void afterWrite(uint64_t bytes) {
+        if (adaptive) adapt(0, chrono::steady_clock::duration());
+        wait(writeBytes.take(double(bytes)), ops.take(1));
+    }
+
+    //* function to account a copy whose read and write could not be timed apart (restore)
+    void afterCopy(uint64_t bytesRead, uint64_t bytesWritten) {
+        if (adaptive) adapt(0, chrono::steady_clock::duration());
+        wait(readBytes.take(double(bytesRead)), max(writeBytes.take(double(bytesWritten)), ops.take(2)));
+    }
+};
+
+IoThrottle& ioThrottle() {
+    static IoThrottle throttle;
+    return throttle;
+}
+
+//* throttle settings for the length of one command (the daemon runs many commands in one process)
+struct ThrottleScope {
+    explicit ThrottleScope(const ThrottleOptions& t) { ioThrottle().configure(t); }
+    ~ThrottleScope() { ioThrottle().configure(ThrottleOptions()); }
+    ThrottleScope(const ThrottleScope&) = delete;
+    ThrottleScope& operator=(const ThrottleScope&) = delete;
+};
+
+//* how do/pull move file data (--io): `threads` (default) are the worker threads with blocking calls,
+//* `sync` is the same on one thread, `uring` also reads small changed files and writes small restored
+//* files through io_uring (Linux), falling back to `threads` where the kernel does not allow it
+enum class IoBackend { Sync, Threads, Uring };
+
+IoBackend parseIoBackend(const string& value) {
+    if (value == "sync") return IoBackend::Sync;
+    if (value == "threads") return IoBackend::Threads;
+    if (value == "uring") return IoBackend::Uring;
+    throw runtime_error("Unknown --io: " + value + " (use uring, threads or sync)");
+}
+
+string ioBackendName(IoBackend io) {
+    return io == IoBackend::Sync ? "sync" : io == IoBackend::Threads ? "threads" : "uring";
+}
+
+const size_t URING_SLOTS = 128;              // files in flight per ring
+const size_t URING_SLOT_SIZE = 64 * 1024;    // registered buffer per slot, larger files take the normal path
+
+#ifdef BACKUP_URING
+//* io_uring on raw syscalls (no liburing): every file is one hard-linked chain of three requests,
+//* openat into a registered file slot, a read or write with the slot's registered buffer, and close of
+//* the slot, so a batch of files costs one io_uring_enter instead of 3+ syscalls each. Completions carry
+//* slot << 2 | step (0 open, 1 read/write, 2 close)
+struct IoRing {
+    int fd = -1;
+    unsigned sqEntries = 0;
+    unsigned *sqHead = nullptr, *sqTail = nullptr, *sqMask = nullptr, *sqArray = nullptr;
+    unsigned *cqHead = nullptr, *cqTail = nullptr, *cqMask = nullptr;
+    struct io_uring_sqe* sqes = nullptr;
+    struct io_uring_cqe* cqes = nullptr;
+    void* sqRing = MAP_FAILED;
+    void* cqRing = MAP_FAILED;
+    size_t sqRingSize = 0, cqRingSize = 0, sqesSize = 0;
+    uint8_t* buffers = static_cast<uint8_t*>(MAP_FAILED);
+    size_t slots, slotSize;
+    unsigned queued = 0;       // filled in but not published to the kernel yet
+    unsigned unsubmitted = 0;  // published but not taken by io_uring_enter yet
+
+    IoRing(size_t slotCount, size_t bytesPerSlot) : slots(slotCount), slotSize(bytesPerSlot) {
+        struct io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        fd = static_cast<int>(syscall(__NR_io_uring_setup, static_cast<unsigned>(slots * 4), &p));
+        if (fd < 0) throw runtime_error(string("io_uring_setup: ") + strerror(errno));
+        sqEntries = p.sq_entries;
+        sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+        bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) sqRingSize = cqRingSize = max(sqRingSize, cqRingSize);
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED) fail("mmap of the submission ring");
+        cqRing = single ? sqRing : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED) fail("mmap of the completion ring");
+        sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+        void* sqeMap = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sqeMap == MAP_FAILED) fail("mmap of the submission entries");
+        sqes = static_cast<struct io_uring_sqe*>(sqeMap);
+        auto* sq = static_cast<uint8_t*>(sqRing);
+        auto* cq = static_cast<uint8_t*>(cqRing);
+        sqHead = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+        sqTail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+        sqMask = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+        cqHead = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+        cqMask = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+        cqes = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+
+        void* bufferMap = mmap(nullptr, slots * slotSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (bufferMap == MAP_FAILED) fail("mmap of the buffers");
+        buffers = static_cast<uint8_t*>(bufferMap);
+        vector<struct iovec> iov(slots);
+        for (size_t i = 0; i < slots; ++i) iov[i] = {buffers + i * slotSize, slotSize};
+        if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, iov.data(), static_cast<unsigned>(slots)) != 0) {
+            fail("registering buffers");
+        }
+        vector<int> files(slots, -1);  // sparse table, openat fills the slots
+        if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_FILES, files.data(), static_cast<unsigned>(slots)) != 0) {
+            fail("registering files");
+        }
+        probe();
+    }
+
+    //* function to check that the kernel has every operation the chains use and opens into registered
+    //* slots: before 5.15 openat ignores file_index and returns a normal descriptor, and the chain's
+    //* close would then close descriptor 0
+    void probe() {
+        vector<uint8_t> memory(sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op), 0);
+        auto* ops = reinterpret_cast<struct io_uring_probe*>(memory.data());
+        if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, ops, 256) != 0) fail("probe");
+        for (uint8_t op : {uint8_t(IORING_OP_OPENAT), uint8_t(IORING_OP_READ_FIXED), uint8_t(IORING_OP_WRITE_FIXED),
+                           uint8_t(IORING_OP_CLOSE)}) {
+            if (op > ops->last_op || !(ops->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+                failWith("operation " + to_string(op) + " is not supported", EOPNOTSUPP);
+            }
+        }
+        // a test open of the working directory into slot 0: 0 means it went into the slot
+        struct io_uring_sqe* open = next(IORING_OP_OPENAT, 0, 0);
+        open->fd = AT_FDCWD;
+        open->addr = reinterpret_cast<uint64_t>(".");
+        open->open_flags = O_RDONLY | O_DIRECTORY;
+        open->file_index = 1;
+        int result = -EIO;
+        submitAndWait();
+        reap([&](size_t, unsigned, int res) { result = res; });
+        if (result > 0) {
+            ::close(result);
+            failWith("open into a registered file slot", EOPNOTSUPP);
+        }
+        if (result < 0) failWith("open into a registered file slot", -result);
+        next(IORING_OP_CLOSE, 0, 2)->file_index = 1;
+        submitAndWait();
+        reap([](size_t, unsigned, int) {});
+    }
+
+    ~IoRing() { release(); }
+    IoRing(const IoRing&) = delete;
+    IoRing& operator=(const IoRing&) = delete;
+
+    void release() {
+        if (buffers != MAP_FAILED) munmap(buffers, slots * slotSize);
+        if (sqes) munmap(sqes, sqesSize);
+        if (cqRing != MAP_FAILED && cqRing != sqRing) munmap(cqRing, cqRingSize);
+        if (sqRing != MAP_FAILED) munmap(sqRing, sqRingSize);
+        if (fd >= 0) close(fd);
+        buffers = static_cast<uint8_t*>(MAP_FAILED);
+        sqes = nullptr;
+        sqRing = cqRing = MAP_FAILED;
+        fd = -1;
+    }
+
+    [[noreturn]] void fail(const string& what) { failWith(what, errno); }
+
+    [[noreturn]] void failWith(const string& what, int err) {
+        release();
+        throw runtime_error("io_uring " + what + ": " + strerror(err));
+    }
+
+    uint8_t* buffer(size_t slot) { return buffers + slot * slotSize; }
+
+    struct io_uring_sqe* next(uint8_t opcode, size_t slot, unsigned step) {
+        unsigned index = (*sqTail + queued) & *sqMask;
+        struct io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = opcode;
+        sqe->user_data = uint64_t(slot) << 2 | step;
+        sqArray[index] = index;
+        ++queued;
+        return sqe;
+    }
+
+    //* function to queue open -> read or write -> close of one file through `slot`
+    void queueFile(size_t slot, const char* path, int flags, mode_t mode, bool write, size_t len) {
+        struct io_uring_sqe* open = next(IORING_OP_OPENAT, slot, 0);
+        open->fd = AT_FDCWD;
+        open->addr = reinterpret_cast<uint64_t>(path);
+        open->len = mode;
+        open->open_flags = static_cast<uint32_t>(flags);  // a registered slot has no close-on-exec, O_CLOEXEC is EINVAL
+        open->file_index = static_cast<uint32_t>(slot + 1);
+        open->flags = IOSQE_IO_HARDLINK;  // the rest of the chain runs (and fails) even if open fails
+        struct io_uring_sqe* io = next(write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED, slot, 1);
+        io->fd = static_cast<int>(slot);
+        io->addr = reinterpret_cast<uint64_t>(buffer(slot));
+        io->len = static_cast<uint32_t>(len);
+        io->buf_index = static_cast<uint16_t>(slot);
+        io->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+        struct io_uring_sqe* done = next(IORING_OP_CLOSE, slot, 2);
+        done->file_index = static_cast<uint32_t>(slot + 1);
+    }
+
+    //* function to submit what is queued and wait for at least one completion; entries the kernel did
+    //* not take yet stay in `unsubmitted` and go with the next call
+    void submitAndWait() {
+        __atomic_store_n(sqTail, *sqTail + queued, __ATOMIC_RELEASE);
+        unsubmitted += queued;
+        queued = 0;
+        while (true) {
+            long taken = syscall(__NR_io_uring_enter, fd, unsubmitted, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (taken < 0 && errno == EINTR) continue;
+            // the completion queue is full: the caller reaps first and submits the rest next time
+            if (taken < 0 && (errno == EBUSY || errno == EAGAIN) && completionsReady()) return;
+            if (taken < 0) throw runtime_error(string("io_uring_enter: ") + strerror(errno));
+            if (taken == 0 && unsubmitted > 0) {
+                if (completionsReady()) return;
+                throw runtime_error("io_uring_enter took none of the queued entries");
+            }
+            unsubmitted -= static_cast<unsigned>(taken);
+            // a short submit returns without waiting, so go again for the rest
+            if (unsubmitted == 0) return;
+        }
+    }
+
+    bool completionsReady() const { return *cqHead != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE); }
+
+    //* function to hand every completion to `done(slot, step, result)`
+    template <typename F>
+    void reap(F&& done) {
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            const struct io_uring_cqe& cqe = cqes[head & *cqMask];
+            done(static_cast<size_t>(cqe.user_data >> 2), static_cast<unsigned>(cqe.user_data & 3), cqe.res);
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    }
+};
+
+//* function to set up a ring for a command, nullptr (after saying why) if the kernel does not allow it
+unique_ptr<IoRing> openIoRing() {
+    try {
+        return make_unique<IoRing>(URING_SLOTS, URING_SLOT_SIZE);
+    } catch (const exception& e) {
+        cout << "io_uring is not available (" << e.what() << "), using --io=threads" << endl;
+        logAction(string("io_uring unavailable: ") + e.what());
+        return nullptr;
+    }
+}
+#endif
+
+//* function to write a blob unless one with that id is already stored, returns true if it was written
+//* `packed` appends it to the running backup's pack instead of creating a loose object file
+//* `written` receives the size that went to disk, which is smaller than len if it was compressed
+bool writeObject(const ObjectTarget& target, const string& id, const void* data, size_t len, bool packed = false,
+                 size_t* written = nullptr) {
+    if (objectExists(target, id)) return false;
+    string encoded = encodeObject(static_cast<const uint8_t*>(data), len, target.compression);
+    if (!encoded.empty()) {
+        if (uint8_t(encoded[8]) == FRAME_LZ4) {
+            runStats().add(RunStats::ChunksCompressed);
+            runStats().add(RunStats::BytesBeforeCompression, len);
+            runStats().add(RunStats::BytesAfterCompression, encoded.size());
+        }
+        data = encoded.data();
+        len = encoded.size();
+    }
+    if (written) *written = len;
+    ioThrottle().afterWrite(len);
+    if (packed && target.pack) return target.pack->add(id, data, len);
+    fs::path dest = objectPath(id);
+    fs::path tmp = objectTempPath();
+    fs::create_directories(tmp.parent_path());
+    {
+        ofstream out(tmp, ios::binary | ios::trunc);
+        if (!out) throw runtime_error("Failed to open for writing: " + tmp.string());
+        out.write(static_cast<const char*>(data), static_cast<streamsize>(len));
+        if (!out.flush()) {
+            out.close();
+            fs::remove(tmp);
+            throw runtime_error("Failed to write object: " + id);
+        }
+    }
+    fs::create_directories(dest.parent_path());
+    fs::rename(tmp, dest);
+    if (target.created) target.created->add(dest);
+    return true;
+}
+
+//* how changed data is physically written (--clone-mode)
+//*   auto                try a reflink, then copy_file_range, then a buffered write
+//*   reflink             reflink every chunk (cut at filesystem block boundaries), fail if one cannot be
+//*   hardlink-unchanged  unchanged files link to the previous snapshot's objects (as in auto), changed data
+//*                       is always written from the buffer, never cloned
+//*   copy                every file is read and copied again, nothing is taken over from the last manifest
+enum class CloneMode { Auto, Reflink, HardlinkUnchanged, Copy };
+
+CloneMode parseCloneMode(const string& value) {
+    if (value == "auto") return CloneMode::Auto;
+    if (value == "reflink") return CloneMode::Reflink;
+    if (value == "hardlink-unchanged") return CloneMode::HardlinkUnchanged;
+    if (value == "copy") return CloneMode::Copy;
+    throw runtime_error("Unknown --clone-mode: " + value + " (use auto, reflink, hardlink-unchanged or copy)");
+}
+
+string cloneModeName(CloneMode mode) {
+    switch (mode) {
+        case CloneMode::Auto: return "auto";
+        case CloneMode::Reflink: return "reflink";
+        case CloneMode::HardlinkUnchanged: return "hardlink-unchanged";
+        default: return "copy";
+    }
+}
+
+//* read-only source file; on POSIX the raw descriptor is kept so ranges can be cloned instead of copied
+struct SourceFile {
+    fs::path path;
+    uint64_t size = 0;
+    atomic<uint64_t> holesSkipped{0};  // bytes of holes handed out as zeros without reading them
+#ifdef _WIN32
+    ifstream in;
+    mutex seekLock;  // readAt from several threads
+
+    explicit SourceFile(const fs::path& p) : path(p), in(p, ios::binary) {
+        if (!in) throw runtime_error("Failed to open for reading: " + p.string());
+        size = fs::file_size(p);
+    }
+
+    size_t read(uint8_t* data, size_t len) {
+        auto start = chrono::steady_clock::now();
+        in.read(reinterpret_cast<char*>(data), static_cast<streamsize>(len));
+        if (in.bad()) throw runtime_error("Failed to read: " + path.string());
+        ioThrottle().afterRead(static_cast<uint64_t>(in.gcount()), chrono::steady_clock::now() - start);
+        return static_cast<size_t>(in.gcount());
+    }
+
+    size_t readAt(uint64_t offset, uint8_t* data, size_t len) {
+        lock_guard<mutex> guard(seekLock);
+        in.clear();
+        in.seekg(static_cast<streamoff>(offset));
+        return read(data, len);
+    }
+
+    bool unchangedSinceOpen() const { return true; }
+#else
+    int fd = -1;
+    struct stat opened {};
+    uint64_t position = 0;  // of read()
+    // fewer blocks than the size needs and the filesystem can find the holes (SEEK_DATA/SEEK_HOLE): they
+    // are handed out as zeros without reading them; decided when the file is opened, threads share it
+    bool sparse = false;
+    uint64_t blockSize = 4096;  // of the filesystem, reflinks clone whole blocks
+
+    explicit SourceFile(const fs::path& p) : path(p) {
+        fd = open(p.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0 || fstat(fd, &opened) != 0) {
+            if (fd >= 0) close(fd);
+            throw runtime_error("Failed to open for reading: " + p.string() + ": " + strerror(errno));
+        }
+        size = uint64_t(opened.st_size);
+        sparse = uint64_t(opened.st_blocks) * 512 < size && (lseek(fd, 0, SEEK_DATA) >= 0 || errno == ENXIO);
+#ifdef __linux__
+        struct statfs fsInfo;
+        if (fstatfs(fd, &fsInfo) == 0 && fsInfo.f_bsize > 0) blockSize = uint64_t(fsInfo.f_bsize);
+#endif
+    }
+
+    ~SourceFile() { close(fd); }
+    SourceFile(const SourceFile&) = delete;
+    SourceFile& operator=(const SourceFile&) = delete;
+
+    size_t read(uint8_t* data, size_t len) {
+        size_t got = readAt(position, data, len);
+        position += got;
+        return got;
+    }
+
+    //* function to read from `offset` (pread, so threads may share the file), 0 at the end of the file
+    size_t readAt(uint64_t offset, uint8_t* data, size_t len) {
+        auto start = chrono::steady_clock::now();
+        size_t total = 0, physical = 0;
+        bool holes = sparse;
+        while (total < len) {
+            size_t want = len - total;
+            if (holes) {
+                off_t dataAt = lseek(fd, static_cast<off_t>(offset), SEEK_DATA);
+                if (dataAt < 0 && errno == ENXIO) dataAt = static_cast<off_t>(max<uint64_t>(offset, size));  // hole up to EOF
+                if (dataAt < 0) {
+                    holes = false;  // the filesystem cannot tell after all, read the rest
+                } else if (uint64_t(dataAt) > offset) {
+                    if (offset >= size) break;
+                    size_t zeros = size_t(min<uint64_t>(want, uint64_t(dataAt) - offset));
+                    memset(data + total, 0, zeros);
+                    holesSkipped += zeros;
+                    runStats().add(RunStats::BytesInHoles, zeros);
+                    total += zeros;
+                    offset += zeros;
+                    continue;
+                } else {
+                    off_t holeAt = lseek(fd, static_cast<off_t>(offset), SEEK_HOLE);
+                    if (holeAt > static_cast<off_t>(offset)) want = size_t(min<uint64_t>(want, uint64_t(holeAt) - offset));
+                }
+            }
+            ssize_t got = pread(fd, data + total, want, static_cast<off_t>(offset));
+            if (got < 0 && errno == EINTR) continue;
+            if (got < 0) throw runtime_error("Failed to read: " + path.string() + ": " + strerror(errno));
+            if (got == 0) break;
+            total += size_t(got);
+            physical += size_t(got);
+            offset += uint64_t(got);
+        }
+        ioThrottle().afterRead(physical, chrono::steady_clock::now() - start);
+        return total;
+    }
+
+    //* a clone copies whatever is in the file now, so it is only trusted if the file did not change meanwhile
+    bool unchangedSinceOpen() const {
+        struct stat now;
+        return fstat(fd, &now) == 0 && now.st_size == opened.st_size &&
+               now.st_mtim.tv_sec == opened.st_mtim.tv_sec && now.st_mtim.tv_nsec == opened.st_mtim.tv_nsec &&
+               now.st_ctim.tv_sec == opened.st_ctim.tv_sec && now.st_ctim.tv_nsec == opened.st_ctim.tv_nsec;
+    }
+#endif
+};
+
+#ifdef __linux__
+//* function to fill outFd with a range of the source without moving the bytes through user space,
+//* returns 'r' for a reflink, 'c' for copy_file_range or 0 if neither worked
+char cloneRange(int srcFd, uint64_t offset, size_t len, bool toEof, uint64_t blockSize, int outFd, CloneMode mode) {
+    // reflinks work on whole filesystem blocks, only the range that ends at EOF may have a partial block
+    if (offset % blockSize == 0 && (len % blockSize == 0 || toEof)) {
+        struct file_clone_range range;
+        range.src_fd = srcFd;
+        range.src_offset = offset;
+        range.src_length = len;
+        range.dest_offset = 0;
+        if (ioctl(outFd, FICLONERANGE, &range) == 0) return 'r';
+    }
+    if (mode == CloneMode::Auto) {
+        loff_t in = static_cast<loff_t>(offset), out = 0;
+        size_t left = len;
+        while (left > 0) {
+            ssize_t n = copy_file_range(srcFd, &in, outFd, &out, left, 0);
+            if (n <= 0) break;
+            left -= size_t(n);
+        }
+        if (left == 0) return 'c';
+        if (ftruncate(outFd, 0) != 0) return 0;
+    }
+    return 0;
+}
+#endif
+
+//* result of putting one file into the object store
+struct StoredFile {
+    string id;                  // BLAKE3 of the whole file
+    string chunks = "-";        // id of the chunk list object, "-" if the file is a single blob
+    size_t chunkCount = 0;
+    size_t newChunks = 0;
+    uint64_t bytesNew = 0;      // size of the chunks the store did not have yet
+    uint64_t bytesWritten = 0;  // bytes that were physically written (reflinks write none)
+    size_t reflinked = 0;       // new chunks per write strategy
+    size_t rangeCopied = 0;
+    size_t buffered = 0;
+    size_t compressed = 0;      // buffered chunks that were stored compressed
+};
+
+//* function to store one new chunk, cloned from the source file where the clone mode allows it;
+//* data/len is the chunk as it was read and hashed, offset is where it sits in the source file
+//* (src is nullptr for data that was read some other way, it is written from the buffer)
+bool storeChunk(const string& id, const uint8_t* data, size_t len, SourceFile* src, uint64_t offset,
+                CloneMode mode, const ObjectTarget& target, bool packed, StoredFile& result) {
+    fs::path dest = objectPath(id);
+    if (objectExists(target, id)) return false;
+#ifdef __linux__
+    // objects inside a pack, data that compresses and data that looks like an object frame are always
+    // written from the buffer
+    bool cloneable = src && !packed && !isFramedObject(data, len) &&
+                     (target.compression == Compression::Off || !looksCompressible(data, len));
+    if (cloneable && (mode == CloneMode::Auto || mode == CloneMode::Reflink)) {
+        fs::path tmp = objectTempPath();
+        fs::create_directories(tmp.parent_path());
+        int out = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (out < 0) throw runtime_error("Failed to open for writing: " + tmp.string() + ": " + strerror(errno));
+        char how = cloneRange(src->fd, offset, len, offset + len == src->size, src->blockSize, out, mode);
+        close(out);
+        if (how && src->unchangedSinceOpen()) {
+            fs::create_directories(dest.parent_path());
+            fs::rename(tmp, dest);
+            if (target.created) target.created->add(dest);
+            if (how == 'r') {
+                ++result.reflinked;
+            } else {
+                ++result.rangeCopied;
+                result.bytesWritten += len;
+                ioThrottle().afterWrite(len);
+            }
+            result.bytesNew += len;
+            return true;
+        }
+        fs::remove(tmp);
+        if (!how && mode == CloneMode::Reflink) {
+            throw runtime_error("Reflink failed for " + src->path.string() + " at offset " + to_string(offset) +
+                                " (filesystem without reflink support? use --clone-mode=auto)");
+        }
+    }
+#else
+    (void)src;
+    (void)offset;
+    (void)mode;
+#endif
+    size_t written = len;
+    if (!writeObject(target, id, data, len, packed, &written)) return false;
+    ++result.buffered;
+    if (written < len) ++result.compressed;
+    result.bytesWritten += written;
+    result.bytesNew += len;
+    return true;
+}
+
+//* large files are chunked and hashed in ranges of this size, in parallel where threads are spare;
+//* a range is a whole BLAKE3 subtree (2^16 chunks of 1 KiB) and always starts a new chunk, so the ids do
+//* not depend on how many threads took part
+const uint64_t RANGE_SIZE = 64 << 20;
+const uint64_t RANGE_HASH_CHUNKS = RANGE_SIZE / BLAKE3_CHUNK_LEN;
+
+//* threads the workers of a backup or restore may borrow for the ranges of a large file
+atomic<unsigned> spareRangeThreads{0};
+
+//* function to borrow up to `want` of the spare range threads, returns how many it got
+unsigned borrowRangeThreads(unsigned want) {
+    unsigned spare = spareRangeThreads.load();
+    while (true) {
+        unsigned take = min(spare, want);
+        if (take == 0 || spareRangeThreads.compare_exchange_weak(spare, spare - take)) return take;
+    }
+}
+
+//* lends the spare workers of a command (jobs - 1) to the ranges of large files while it runs; with many
+//* large files at once up to twice as many threads as jobs can be busy
+struct RangeThreadsScope {
+    explicit RangeThreadsScope(unsigned jobs) { spareRangeThreads = jobs > 0 ? jobs - 1 : 0; }
+    ~RangeThreadsScope() { spareRangeThreads = 0; }
+    RangeThreadsScope(const RangeThreadsScope&) = delete;
+    RangeThreadsScope& operator=(const RangeThreadsScope&) = delete;
+};
+
+//* function to run work(buffer) on the calling thread and up to `want` borrowed ones; the first error
+//* any of them throws is thrown here once all are done
+void runWithRangeThreads(unsigned want, vector<uint8_t>& buffer, const function<void(vector<uint8_t>&)>& work) {
+    unsigned helpers = borrowRangeThreads(want);
+    exception_ptr error;
+    mutex errorLock;
+    auto guarded = [&](vector<uint8_t>& buf) {
+        try {
+            work(buf);
+        } catch (...) {
+            lock_guard<mutex> guard(errorLock);
+            if (!error) error = current_exception();
+        }
+    };
+    vector<thread> threads;
+    for (unsigned i = 0; i < helpers; ++i) {
+        threads.emplace_back([&] {
+            applyWorkerPriority(ioThrottle().options);
+            vector<uint8_t> own;
+            guarded(own);
+        });
+    }
+    guarded(buffer);
+    for (auto& t : threads) t.join();
+    spareRangeThreads += helpers;
+    if (error) rethrow_exception(error);
+}
+
+//* function to check for a chunk of zeros (holes of sparse files, preallocated space)
+bool isZeroes(const uint8_t* data, size_t len) {
+    return len == 0 || (data[0] == 0 && memcmp(data, data + 1, len - 1) == 0);
+}
+
+//* ids of chunks that are all zeros, by length; holes chunk into a few lengths, so a handful is enough
+struct ZeroChunks {
+    static constexpr size_t LIMIT = 64;
+    mutex lock;
+    map<size_t, string> byLength;
+    set<string> ids;
+
+    void remember(size_t len, const string& id) {
+        if (byLength.size() < LIMIT && byLength.emplace(len, id).second) ids.insert(id);
+    }
+};
+
+ZeroChunks& zeroChunks() {
+    static ZeroChunks zeros;
+    return zeros;
+}
+
+//* function to get the id of `len` zero bytes, remembered so holes are not hashed chunk by chunk
+string zeroChunkId(size_t len) {
+    ZeroChunks& zeros = zeroChunks();
+    {
+        lock_guard<mutex> guard(zeros.lock);
+        auto it = zeros.byLength.find(len);
+        if (it != zeros.byLength.end()) return it->second;
+    }
+    vector<uint8_t> buffer(len, 0);
+    string id = hashBytes(buffer.data(), buffer.size());
+    lock_guard<mutex> guard(zeros.lock);
+    zeros.remember(len, id);
+    return id;
+}
+
+//* function to check whether a chunk id is one of the remembered runs of zeros
+bool isZeroChunk(const string& id) {
+    ZeroChunks& zeros = zeroChunks();
+    lock_guard<mutex> guard(zeros.lock);
+    return zeros.ids.count(id) > 0;
+}
+
+//* function to remember a chunk that turned out to be zeros
+void rememberZeroChunk(size_t len, const string& id) {
+    ZeroChunks& zeros = zeroChunks();
+    lock_guard<mutex> guard(zeros.lock);
+    zeros.remember(len, id);
+}
+
+//* chunks of one range of a file: what was stored, the chunk list lines and the BLAKE3 state of its bytes
+struct StoredRange {
+    StoredFile stored;
+    string chunkList;
+    string firstChunk;
+    Blake3Hasher hasher;
+};
+
+//* function to cut the next chunk from `data` (`available` bytes, with `history` bytes of the same range in
+//* front of it for the rolling hash), hash it into the range and store it; returns the chunk's length.
+//* `atEnd`: nothing follows the available bytes in this range. `src`/`offset` is where the chunk sits in
+//* its file (nullptr if the bytes were read some other way); in strict reflink mode chunks end on blocks
+size_t storeNextChunk(const CdcChunker& chunker, const uint8_t* data, size_t available, size_t history, bool atEnd,
+                      SourceFile* src, uint64_t offset, CloneMode mode, const ObjectTarget& target, bool packed,
+                      StoredRange& range) {
+    StoredFile& result = range.stored;
+    size_t len;
+    string chunkId;
+    {
+        PhaseTimer timer(RunStats::Hash);
+        len = chunker.cut(data, available, history);
+#ifdef __linux__
+        // strict reflink mode ends chunks on filesystem blocks (every range starts on one), so each can be cloned
+        size_t alignTo = src && mode == CloneMode::Reflink ? size_t(src->blockSize) : 1;
+        if (alignTo > 1 && !(atEnd && len == available)) len = max(len - len % alignTo, min(alignTo, available));
+#else
+        (void)atEnd;
+#endif
+        chunkId = isZeroes(data, len) ? zeroChunkId(len) : hashBytes(data, len);
+        range.hasher.update(data, len);
+    }
+    {
+        PhaseTimer timer(RunStats::Write);
+        if (storeChunk(chunkId, data, len, src, offset, mode, target, packed, result)) ++result.newChunks;
+    }
+    if (result.chunkCount == 0) range.firstChunk = chunkId;
+    range.chunkList += chunkId + " " + to_string(len) + "\n";
+    ++result.chunkCount;
+    return len;
+}
+
+//* function to chunk and store the bytes of src from `from` up to `to` (or to the end of the file if it is
+//* UINT64_MAX); a range that ends early throws, the file changed while it was read
+void storeFileRange(SourceFile& src, uint64_t from, uint64_t to, const ChunkParams& params, CloneMode mode,
+                    const ObjectTarget& target, bool packed, vector<uint8_t>& buffer, StoredRange& range) {
+    CdcChunker chunker(params);
+    size_t bufferSize = max<size_t>(size_t(params.maxSize) * 2, 8 << 20);
+    if (buffer.size() < bufferSize) buffer.resize(bufferSize);
+    size_t begin = 0, end = 0;
+    uint64_t bufferOffset = from;  // file offset of buffer[0]
+    uint64_t stop = min(to, src.size);  // where the file is expected to end
+    bool eof = false;
+    while (true) {
+        if (!eof && end - begin < params.maxSize) {
+            // keep 32 bytes in front of the chunk start for the rolling hash window
+            size_t keep = min<size_t>(begin, 32);
+            memmove(buffer.data(), buffer.data() + begin - keep, end - begin + keep);
+            bufferOffset += begin - keep;
+            end = end - begin + keep;
+            begin = keep;
+            PhaseTimer timer(RunStats::Read);
+            while (!eof && end < buffer.size()) {
+                uint64_t at = bufferOffset + end;
+                size_t room = size_t(min<uint64_t>(buffer.size() - end, to - min(to, at)));
+                size_t got = room ? src.readAt(at, buffer.data() + end, room) : 0;
+                if (got == 0) eof = true;
+                end += got;
+                runStats().add(RunStats::BytesRead, got);
+                // a file that fits the buffer needs no extra read to see its end (most files are tiny)
+                if (bufferOffset + end == stop && end < buffer.size()) eof = true;
+            }
+            if (eof && to != UINT64_MAX && bufferOffset + end != to) {
+                throw runtime_error("File changed while it was read: " + src.path.string());
+            }
+        }
+        // the range start has no history in front of it, whatever the bytes before it are
+        begin += storeNextChunk(chunker, buffer.data() + begin, end - begin, bufferOffset + begin == from ? 0 : begin,
+                                eof, &src, bufferOffset + begin, mode, target, packed, range);
+        if (begin == end && eof) break;
+    }
+}
+
+//* function to put the chunked ranges of a file together: the file id from the ranges' BLAKE3 subtrees,
+//* one chunk list for all of them (written to the store) and the summed counts
+StoredFile combineRanges(vector<StoredRange>& parts, const ObjectTarget& target, bool packed) {
+    size_t ranges = parts.size();
+    StoredFile result;
+    string chunkList;
+    Blake3Hasher whole;
+    for (size_t i = 0; i < ranges; ++i) {
+        const StoredFile& part = parts[i].stored;
+        result.chunkCount += part.chunkCount;
+        result.newChunks += part.newChunks;
+        result.bytesNew += part.bytesNew;
+        result.bytesWritten += part.bytesWritten;
+        result.reflinked += part.reflinked;
+        result.rangeCopied += part.rangeCopied;
+        result.buffered += part.buffered;
+        result.compressed += part.compressed;
+        chunkList += parts[i].chunkList;
+        if (i + 1 < ranges) {
+            uint32_t cv[8];
+            parts[i].hasher.subtree(cv);
+            whole.pushSubtree(cv, RANGE_HASH_CHUNKS);
+        }
+    }
+    if (result.chunkCount == 1) {
+        result.id = parts[0].firstChunk;
+    } else {
+        result.id = ranges == 1 ? parts[0].hasher.hexDigest() : whole.hexDigestWith(parts.back().hasher.lastNode());
+        result.chunks = hashBytes(chunkList.data(), chunkList.size());
+        PhaseTimer timer(RunStats::Write);
+        writeObject(target, result.chunks, chunkList.data(), chunkList.size(), packed);
+    }
+    return result;
+}
+
+//* function to put a file into the object store, split into content-defined chunks
+//* every chunk is hashed from memory and only written if the store does not have it yet;
+//* files that end up as one chunk are stored as a single blob whose id is the file's id
+//* `buffer` is the caller's (per-thread) read buffer and is reused between files
+//* files larger than RANGE_SIZE are split into ranges that borrowed threads chunk and hash in parallel,
+//* the file id is then put together from the ranges' BLAKE3 subtrees
+StoredFile storeFileChunked(const fs::path& path, const ChunkParams& params, CloneMode mode, const ObjectTarget& target,
+                            bool packed, vector<uint8_t>& buffer) {
+    SourceFile src(path);
+    size_t ranges = size_t(max<uint64_t>(1, (src.size + RANGE_SIZE - 1) / RANGE_SIZE));
+    vector<StoredRange> parts;
+    parts.reserve(ranges);
+    for (size_t i = 0; i < ranges; ++i) parts.push_back({StoredFile(), "", "", Blake3Hasher(i * RANGE_HASH_CHUNKS)});
+    if (ranges == 1) {
+        storeFileRange(src, 0, UINT64_MAX, params, mode, target, packed, buffer, parts[0]);
+    } else {
+        // the last range ends at the size the file had when it was opened, so every range stays one subtree
+        atomic<size_t> next{0};
+        runWithRangeThreads(unsigned(min<size_t>(ranges - 1, 1024)), buffer, [&](vector<uint8_t>& buf) {
+            for (size_t i; (i = next++) < ranges;) {
+                uint64_t to = i + 1 == ranges ? src.size : (i + 1) * RANGE_SIZE;
+                storeFileRange(src, i * RANGE_SIZE, to, params, mode, target, packed, buf, parts[i]);
+            }
+        });
+    }
+    if (src.holesSkipped > 0) {
+        runStats().add(RunStats::SparseFiles);
+        runStats().add(RunStats::BytesInSparseFiles, src.size);
+    }
+    return combineRanges(parts, target, packed);
+}
+
+//* function to put a file that was already read into memory into the object store, with the same
+//* ranges, chunks and ids as storeFileChunked; the data is always written from the buffer
+StoredFile storeBufferChunked(const string& content, const ChunkParams& params, const ObjectTarget& target, bool packed) {
+    CdcChunker chunker(params);
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(content.data());
+    size_t ranges = size_t(max<uint64_t>(1, (content.size() + RANGE_SIZE - 1) / RANGE_SIZE));
+    vector<StoredRange> parts;
+    parts.reserve(ranges);
+    for (size_t i = 0; i < ranges; ++i) {
+        parts.push_back({StoredFile(), "", "", Blake3Hasher(i * RANGE_HASH_CHUNKS)});
+        size_t from = size_t(i * RANGE_SIZE), to = size_t(min<uint64_t>(content.size(), (i + 1) * RANGE_SIZE));
+        size_t begin = from;
+        do {
+            begin += storeNextChunk(chunker, data + begin, to - begin, begin - from, true, nullptr, begin,
+                                    CloneMode::Copy, target, packed, parts[i]);
+        } while (begin < to);
+    }
+    return combineRanges(parts, target, packed);
+}
+
+//* function to read a blob from the object store into memory
+string readObject(const string& id) {
+    ifstream in(objectPath(id), ios::binary);
+    if (in) return decodeObject(string(istreambuf_iterator<char>(in), istreambuf_iterator<char>()));
+    uint64_t offset, length;
+    const PackIndex* pack = packStore().find(id, offset, length);
+    if (!pack) throw runtime_error("Missing object: " + id);
+    return decodeObject(pack->read(offset, length));
+}
+
+//* Merkle tree of a snapshot: one node object per folder that lists its entries sorted by name, in the
+//* manifest's line format with the name instead of the path. A folder's entry carries the id of its own
+//* node, so unchanged subtrees have the same id in every snapshot and a diff only opens nodes whose ids
+//* differ. The root id is written to `__tree__` in the snapshot folder and kept in the catalog.
+const string TREE_NODE_HEADER = "# .backup tree v1\n";
+
+//* nodes kept in memory: snapshots from before trees existed are built from their manifest on demand
+struct TreeStore {
+    unordered_map<string, string> built;
+
+    //* function to read the entries of a node ("" is an empty folder), paths are plain names
+    vector<ManifestEntry> node(const string& id) const {
+        vector<ManifestEntry> entries;
+        if (id.empty()) return entries;
+        auto it = built.find(id);
+        string content = it != built.end() ? it->second : readObject(id);
+        if (content.rfind(TREE_NODE_HEADER, 0) != 0) throw runtime_error("Not a tree object: " + id);
+        istringstream in(content.substr(TREE_NODE_HEADER.size()));
+        string line;
+        while (getline(in, line)) {
+            string fields[7];
+            size_t start = 0;
+            for (int i = 0; i < 7; ++i) {
+                size_t tab = i < 6 ? line.find('\t', start) : string::npos;
+                if (i < 6 && tab == string::npos) throw runtime_error("Corrupt tree object: " + id);
+                fields[i] = line.substr(start, tab == string::npos ? string::npos : tab - start);
+                start = tab + 1;
+            }
+            ManifestEntry e;
+            e.type = fields[0].empty() ? 'f' : fields[0][0];
+            e.size = stoull(fields[1]);
+            e.mtime = stoll(fields[2]);
+            e.mode = static_cast<uint32_t>(stoul(fields[3]));
+            e.id = fields[4];
+            e.chunks = fields[5];
+            e.path = unescapeManifestPath(fields[6]);
+            entries.push_back(move(e));
+        }
+        return entries;
+    }
+};
+
+//* function to build a snapshot's tree bottom-up from its entries, `store` receives every node
+//* (id, content); returns the id of the root node
+string buildSnapshotTree(const vector<ManifestEntry>& entries, const function<void(const string&, const string&)>& store) {
+    unordered_map<string, vector<const ManifestEntry*>> children;  // folder -> entries in it, "" is the root
+    children[""];
+    for (const auto& e : entries) {
+        size_t slash = e.path.rfind('/');
+        children[slash == string::npos ? "" : e.path.substr(0, slash)].push_back(&e);
+        if (e.type == 'd') children[e.path];
+    }
+    // deepest folders first, so every folder's children have their ids when it is written
+    vector<pair<size_t, string>> folders;
+    for (const auto& c : children) {
+        folders.emplace_back(c.first.empty() ? 0 : count(c.first.begin(), c.first.end(), '/') + 1, c.first);
+    }
+    sort(folders.begin(), folders.end(), greater<pair<size_t, string>>());
+    unordered_map<string, string> treeIds;
+    for (const auto& folder : folders) {
+        auto& list = children[folder.second];
+        sort(list.begin(), list.end(), [](const ManifestEntry* a, const ManifestEntry* b) { return a->path < b->path; });
+        size_t skip = folder.second.empty() ? 0 : folder.second.size() + 1;
+        string content = TREE_NODE_HEADER;
+        for (const ManifestEntry* e : list) {
+            const string& id = e->type == 'd' ? treeIds[e->path] : e->id;
+            content += e->type;
+            content += '\t' + to_string(e->size) + '\t' + to_string(e->mtime) + '\t' + to_string(e->mode) + '\t';
+            content += id + '\t' + (e->type == 'd' ? "-" : e->chunks) + '\t' + escapeManifestPath(e->path.substr(skip)) + '\n';
+        }
+        string id = hashBytes(content.data(), content.size());
+        store(id, content);
+        treeIds[folder.second] = id;
+        vector<const ManifestEntry*>().swap(list);
+    }
+    return treeIds[""];
+}
+
+//* function to get the root tree id of a snapshot; a snapshot without `__tree__` gets its tree built
+//* from the manifest into `store`
+string snapshotTreeRoot(const fs::path& backupDir, TreeStore& store) {
+    ifstream in(backupDir / TREE_NAME);
+    string root;
+    if (in >> root && root.size() == 64) return root;
+    if (!fs::exists(backupDir / MANIFEST_NAME)) throw runtime_error("No manifest in " + backupDir.string());
+    return buildSnapshotTree(readManifest(backupDir / MANIFEST_NAME),
+                             [&store](const string& id, const string& node) { store.built.emplace(id, node); });
+}
+
+//* one line of a diff: 'A' added, 'D' removed, 'M' modified; folders end in '/'
+struct DiffEntry {
+    char kind;
+    string path;
+};
+
+//* function to compare two tree nodes and everything below them; subtrees with the same id are skipped
+//* without being read, an empty id stands for a folder that does not exist on that side
+void diffTrees(const TreeStore& store, const string& a, const string& b, const string& prefix, vector<DiffEntry>& out) {
+    if (a == b) return;
+    vector<ManifestEntry> left = store.node(a), right = store.node(b);
+    size_t i = 0, j = 0;
+    auto removed = [&](const ManifestEntry& e) {
+        out.push_back({'D', prefix + e.path + (e.type == 'd' ? "/" : "")});
+        if (e.type == 'd') diffTrees(store, e.id, "", prefix + e.path + "/", out);
+    };
+    auto added = [&](const ManifestEntry& e) {
+        out.push_back({'A', prefix + e.path + (e.type == 'd' ? "/" : "")});
+        if (e.type == 'd') diffTrees(store, "", e.id, prefix + e.path + "/", out);
+    };
+    while (i < left.size() || j < right.size()) {
+        if (j == right.size() || (i < left.size() && left[i].path < right[j].path)) {
+            removed(left[i++]);
+        } else if (i == left.size() || right[j].path < left[i].path) {
+            added(right[j++]);
+        } else {
+            const ManifestEntry& l = left[i++];
+            const ManifestEntry& r = right[j++];
+            if (l.type != r.type) {
+                removed(l);
+                added(r);
+            } else if (l.type == 'd') {
+                diffTrees(store, l.id, r.id, prefix + l.path + "/", out);
+            } else if (l.id != r.id || l.mode != r.mode) {
+                out.push_back({'M', prefix + l.path});
+            }
+        }
+    }
+}
+
+//* file written by a restore; blocks of zeros are skipped so they stay holes (POSIX), and the writes
+//* are positioned so several threads can fill the ranges of one large file
+struct RestoreFile {
+    static constexpr size_t BLOCK = 4096;
+    fs::path path;
+    atomic<uint64_t> holes{0};  // bytes left unwritten
+
+    //* function to count bytes that are left unwritten because they are zeros
+    void leaveHole(uint64_t len) {
+        holes += len;
+        runStats().add(RunStats::BytesRestoredAsHoles, len);
+    }
+
+    //* function to count the file among the sparse ones of the run if it has holes
+    void countSparse(uint64_t size) {
+        if (holes == 0) return;
+        runStats().add(RunStats::SparseFiles);
+        runStats().add(RunStats::BytesInSparseFiles, size);
+    }
+#ifdef _WIN32
+    ofstream out;
+    mutex lock;
+
+    explicit RestoreFile(const fs::path& p) : path(p), out(p, ios::binary | ios::trunc) {
+        if (!out) throw runtime_error("Failed to open for writing: " + p.string());
+    }
+
+    void writeAt(uint64_t offset, const uint8_t* data, size_t len) {
+        lock_guard<mutex> guard(lock);
+        out.seekp(static_cast<streamoff>(offset));
+        out.write(reinterpret_cast<const char*>(data), static_cast<streamsize>(len));
+        if (!out) throw runtime_error("Failed to write: " + path.string());
+    }
+
+    void finish(uint64_t size) {
+        out.close();
+        if (!out) throw runtime_error("Failed to write: " + path.string());
+        fs::resize_file(path, size);
+        countSparse(size);
+    }
+#else
+    int fd = -1;
+
+    explicit RestoreFile(const fs::path& p) : path(p) {
+        fd = open(p.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) throw runtime_error("Failed to open for writing: " + p.string() + ": " + strerror(errno));
+    }
+
+    ~RestoreFile() {
+        if (fd >= 0) close(fd);
+    }
+    RestoreFile(const RestoreFile&) = delete;
+    RestoreFile& operator=(const RestoreFile&) = delete;
+
+    void writeAt(uint64_t offset, const uint8_t* data, size_t len) {
+        size_t done = 0;
+        while (done < len) {
+            // whole file blocks of zeros are left out, everything between them goes in one write
+            size_t blockEnd = min<size_t>(len, done + BLOCK - (offset + done) % BLOCK);
+            if (blockEnd - done == BLOCK && isZeroes(data + done, BLOCK)) {
+                leaveHole(BLOCK);
+                done = blockEnd;
+                continue;
+            }
+            size_t runEnd = blockEnd;
+            while (runEnd < len && !(len - runEnd >= BLOCK && isZeroes(data + runEnd, BLOCK))) {
+                runEnd = min(len, runEnd + BLOCK);
+            }
+            for (size_t at = done; at < runEnd;) {
+                ssize_t n = pwrite(fd, data + at, runEnd - at, static_cast<off_t>(offset + at));
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) throw runtime_error("Failed to write: " + path.string() + ": " + strerror(errno));
+                at += size_t(n);
+            }
+            done = runEnd;
+        }
+    }
+
+    //* function to set the final size, which also makes a hole at the end part of the file
+    void finish(uint64_t size) {
+        int result = ftruncate(fd, static_cast<off_t>(size));
+        if (close(fd) != 0 || result != 0) {
+            fd = -1;
+            throw runtime_error("Failed to write: " + path.string() + ": " + strerror(errno));
+        }
+        fd = -1;
+        countSparse(size);
+    }
+#endif
+};
+
+//* function to rebuild one manifest entry's file from the object store
+//* chunked files larger than RANGE_SIZE are written in ranges by borrowed threads
+void restoreObject(const ManifestEntry& e, const fs::path& dest) {
+    if (!e.source.empty() || e.chunks == "-") {
+        uint64_t offset, length;
+        const PackIndex* pack = e.source.empty() ? packStore().find(e.id, offset, length) : nullptr;
+        fs::path src = e.source.empty() ? objectPath(e.id) : fs::path(".backup") / e.source / e.path;
+        bool framed = false;  // a compressed loose object cannot be cloned or copied as it is
+        if (!pack) {
+            if (!fs::exists(src)) throw runtime_error("Missing backup data for " + e.path + " (" + e.id + ")");
+            if (e.source.empty()) {
+                char magic[8];
+                ifstream head(src, ios::binary);
+                framed = head.read(magic, 8) && isFramedObject(magic, 8);
+            }
+        }
+        if (pack || framed) {
+            string data = pack ? decodeObject(pack->read(offset, length)) : readObject(e.id);
+            RestoreFile out(dest);
+            out.writeAt(0, reinterpret_cast<const uint8_t*>(data.data()), data.size());
+            out.finish(data.size());
+            return;
+        }
+#ifdef __linux__
+        // a reflink restores the file without copying its data where the filesystem supports it
+        int in = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+        int out = in < 0 ? -1 : open(dest.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        bool cloned = out >= 0 && ioctl(out, FICLONE, in) == 0;
+        if (out >= 0) close(out);
+        if (in >= 0) close(in);
+        if (cloned) return;
+#endif
+        fs::copy_file(src, dest, fs::copy_options::overwrite_existing);
+        return;
+    }
+    struct Chunk { string id; uint64_t offset, length; };
+    vector<Chunk> chunks;
+    {
+        istringstream list(readObject(e.chunks));
+        string chunkId;
+        uint64_t chunkLen = 0, size = 0;
+        while (list >> chunkId >> chunkLen) {
+            chunks.push_back({chunkId, size, chunkLen});
+            size += chunkLen;
+        }
+    }
+    // ranges of whole chunks, about RANGE_SIZE each
+    vector<size_t> rangeStarts = {0};
+    for (size_t i = 1; i < chunks.size(); ++i) {
+        if (chunks[i].offset / RANGE_SIZE != chunks[rangeStarts.back()].offset / RANGE_SIZE) rangeStarts.push_back(i);
+    }
+    rangeStarts.push_back(chunks.size());
+    RestoreFile out(dest);
+    atomic<size_t> next{0};
+    vector<uint8_t> unused;
+    runWithRangeThreads(unsigned(min<size_t>(rangeStarts.size() - 2, 1024)), unused, [&](vector<uint8_t>&) {
+        for (size_t r; (r = next++) + 1 < rangeStarts.size();) {
+            for (size_t i = rangeStarts[r]; i < rangeStarts[r + 1]; ++i) {
+                if (isZeroChunk(chunks[i].id)) {
+                    // a hole of the original (or zeros) seen before, nothing to read or write
+                    out.leaveHole(chunks[i].length);
+                    continue;
+                }
+                string data = readObject(chunks[i].id);
+                if (data.size() != chunks[i].length) throw runtime_error("Corrupt chunk " + chunks[i].id + " in " + e.path);
+                if (isZeroes(reinterpret_cast<const uint8_t*>(data.data()), data.size())) {
+                    rememberZeroChunk(data.size(), chunks[i].id);
+                }
+                out.writeAt(chunks[i].offset, reinterpret_cast<const uint8_t*>(data.data()), data.size());
+            }
+        }
+    });
+    out.finish(chunks.empty() ? 0 : chunks.back().offset + chunks.back().length);
+}
+
+//* function to get the default number of worker threads
+unsigned defaultJobs() {
+    return max(1u, thread::hardware_concurrency());
+}
+
+//* options for createBackup (from the command line)
+struct BackupOptions {
+    unsigned jobs = defaultJobs();
+    CloneMode cloneMode = CloneMode::Auto;
+    bool packed = false;  // --store=pack: new objects of a backup go into one pack file
+    uint64_t smallFileSize = 4096;  // files up to this size are packed even in the loose store (0 = off)
+    Compression compression = Compression::Fast;
+    bool hashCache = true;                     // `hash-cache: off` in .backup/__init__ turns it off
+    int64_t hashCacheGranuleNs = 2000000000;   // `hash-cache-granule-ms`: files changed this recently are not cached
+    vector<string> ignore;                     // --ignore PATTERN: extra .backupignore lines for this backup
+    ThrottleOptions throttle;
+    IoBackend io = IoBackend::Threads;
+};
+
+//* function to read the backup options from `backup do ...` arguments
+BackupOptions parseBackupOptions(const vector<string>& args) {
+    BackupOptions options;
+    uint64_t jobs = argNumber(args, "--jobs", options.jobs);
+    if (jobs < 1 || jobs > 1024) throw runtime_error("--jobs must be between 1 and 1024");
+    options.jobs = static_cast<unsigned>(jobs);
+    options.cloneMode = parseCloneMode(argValue(args, "--clone-mode", "auto"));
+    map<string, string> config = readBackupConfig();
+    string store = argValue(args, "--store", config.count("store") ? config["store"] : "loose");
+    if (store != "loose" && store != "pack") throw runtime_error("Unknown --store (use loose or pack): " + store);
+    options.packed = store == "pack";
+    options.smallFileSize = argNumber(args, "--small-file-size", configNumber(config, "small-file-size", options.smallFileSize));
+    options.compression = parseCompression(argValue(args, "--compress", config.count("compression") ? config["compression"] : "fast"));
+    options.hashCache = !(config.count("hash-cache") && config["hash-cache"] == "off");
+    options.hashCacheGranuleNs = int64_t(configNumber(config, "hash-cache-granule-ms", 2000)) * 1000000;
+    for (size_t i = 0; i + 1 < args.size(); ++i) {
+        if (args[i] == "--ignore") options.ignore.push_back(args[++i]);
+    }
+    options.throttle = parseThrottleOptions(args, config);
+    options.io = parseIoBackend(argValue(args, "--io", config.count("io") ? config["io"] : "threads"));
+    if (options.io == IoBackend::Sync) options.jobs = 1;
+    // strict reflink mode shares the source's blocks, there is nothing to compress
+    if (options.cloneMode == CloneMode::Reflink) options.compression = Compression::Off;
+    if (options.packed && options.cloneMode == CloneMode::Reflink) {
+        throw runtime_error("--clone-mode=reflink needs loose objects, packs are always written from the buffer");
+    }
+    return options;
+}
+
+//* bounded blocking queue between the backup pipeline stages, push blocks while the queue is full
+template <typename T>
+struct BoundedQueue {
+    size_t capacity;
+    deque<T> items;
+    bool closed = false;
+    mutex lock;
+    condition_variable notEmpty;
+    condition_variable notFull;
+
+    explicit BoundedQueue(size_t cap) : capacity(cap) {}
+
+    bool push(T item) {
+        unique_lock<mutex> guard(lock);
+        notFull.wait(guard, [&] { return items.size() < capacity || closed; });
+        if (closed) return false;
+        items.push_back(move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+
+    //* returns false once the queue is closed and empty
+    bool pop(T& item) {
+        unique_lock<mutex> guard(lock);
+        notEmpty.wait(guard, [&] { return !items.empty() || closed; });
+        if (items.empty()) return false;
+        item = move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    //* returns false if nothing is queued right now
+    bool tryPop(T& item) {
+        lock_guard<mutex> guard(lock);
+        if (items.empty()) return false;
+        item = move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        lock_guard<mutex> guard(lock);
+        closed = true;
+        notEmpty.notify_all();
+        notFull.notify_all();
+    }
+};
+
+//* counting semaphore, limits how many entries can be between the producer and the committer
+struct Semaphore {
+    size_t count;
+    mutex lock;
+    condition_variable available;
+
+    explicit Semaphore(size_t n) : count(n) {}
+
+    void acquire() {
+        unique_lock<mutex> guard(lock);
+        available.wait(guard, [&] { return count > 0; });
+        --count;
+    }
+
+    void release() {
+        {
+            lock_guard<mutex> guard(lock);
+            ++count;
+        }
+        available.notify_one();
+    }
+};
+
+//* one scanned file or folder; fixed size, the path lives in the scan's path arena
+struct ScanRecord {
+    uint64_t pathOffset = 0;
+    uint32_t pathLength = 0;
+    uint32_t mode = 0;          // permission bits
+    uint64_t size = 0;
+    int64_t mtime = 0;          // unix nanoseconds
+    int64_t ctime = 0;          // unix nanoseconds, 0 where the platform has no change time
+    uint64_t device = 0;
+    uint64_t inode = 0;
+    char type = 'f';            // 'f' = file, 'd' = folder, 'l' = symbolic link to a folder
+};
+
+//* flat result of a tree scan: records sorted in walk order plus one arena holding all paths
+struct ScanList {
+    vector<ScanRecord> records;
+    vector<char> arena;
+    vector<string> skipped;  // "path: reason" of entries that could not be read and are left out
+
+    string_view path(const ScanRecord& r) const { return string_view(arena.data() + r.pathOffset, r.pathLength); }
+};
+
+//* decides per entry (relative path, is folder) whether the scan leaves it out; skipped folders are never opened
+using ScanFilter = function<bool(const string&, bool)>;
+
+//* function to compare paths in walk order: a folder's contents come right after the folder itself
+bool treeOrderLess(string_view a, string_view b) {
+    size_t n = min(a.size(), b.size());
+    for (size_t i = 0; i < n; ++i) {
+        unsigned char ca = a[i] == '/' ? 0 : static_cast<unsigned char>(a[i]);
+        unsigned char cb = b[i] == '/' ? 0 : static_cast<unsigned char>(b[i]);
+        if (ca != cb) return ca < cb;
+    }
+    return a.size() < b.size();
+}
+
+//* per-thread state of the scanner: a deque of folders to list (owner works at the back, thieves take
+//* from the front) and the thread's own records and path arena so results are collected without locking
+struct ScanWorker {
+    mutex lock;
+    deque<string> folders;
+    vector<ScanRecord> records;
+    vector<char> arena;
+    vector<char> direntBuffer;
+    vector<string> skipped;
+
+    void add(const string& rel, ScanRecord r) {
+        r.pathOffset = arena.size();
+        r.pathLength = static_cast<uint32_t>(rel.size());
+        arena.insert(arena.end(), rel.begin(), rel.end());
+        records.push_back(r);
+    }
+};
+
+struct TreeScanner {
+    fs::path root;
+    const ScanFilter& skip;
+    vector<unique_ptr<ScanWorker>> workers;
+    atomic<size_t> pending{0};
+    atomic<bool> failed{false};
+    mutex errorLock;
+    string error;
+
+    TreeScanner(const fs::path& r, unsigned jobs, const ScanFilter& filter) : root(r), skip(filter) {
+        for (unsigned i = 0; i < jobs; ++i) workers.push_back(make_unique<ScanWorker>());
+    }
+
+    void fail(const string& message) {
+        lock_guard<mutex> guard(errorLock);
+        if (error.empty()) error = message;
+        failed = true;
+    }
+
+    void pushFolder(ScanWorker& w, string rel) {
+        ++pending;
+        lock_guard<mutex> guard(w.lock);
+        w.folders.push_back(move(rel));
+    }
+
+    bool popOwn(ScanWorker& w, string& rel) {
+        lock_guard<mutex> guard(w.lock);
+        if (w.folders.empty()) return false;
+        rel = move(w.folders.back());
+        w.folders.pop_back();
+        return true;
+    }
+
+    bool steal(size_t self, string& rel) {
+        for (size_t k = 1; k < workers.size(); ++k) {
+            ScanWorker& victim = *workers[(self + k) % workers.size()];
+            lock_guard<mutex> guard(victim.lock);
+            if (victim.folders.empty()) continue;
+            rel = move(victim.folders.front());
+            victim.folders.pop_front();
+            return true;
+        }
+        return false;
+    }
+
+    void run(size_t self) {
+        ScanWorker& w = *workers[self];
+        string rel;
+        while (true) {
+            if (popOwn(w, rel) || steal(self, rel)) {
+                if (!failed) {
+                    try {
+                        listFolder(w, rel);
+                    } catch (const exception& e) {
+                        fail(e.what());
+                    }
+                }
+                --pending;
+            } else if (pending == 0) {
+                return;
+            } else {
+                this_thread::yield();
+            }
+        }
+    }
+
+#ifdef __linux__
+    //* function to note an entry that could not be read: it is left out and the scan goes on; one that
+    //* vanished in the meantime is not worth a note
+    static void skipUnreadable(ScanWorker& w, const string& rel, int err) {
+        if (err != ENOENT && err != ENOTDIR) w.skipped.push_back((rel.empty() ? "." : rel) + ": " + strerror(err));
+    }
+
+    //* function to stat an entry of dirFd for the scan: a symlink is recorded as what it points to, a link
+    //* to a folder as the link itself ('l', never descended into); returns 0 or the errno
+    static int statScanEntry(int dirFd, const char* name, ScanRecord& r) {
+        bool isLink = false;
+        int err = statEntry(dirFd, name, true, r, isLink);
+        if (err != 0 || !isLink) return err;
+        ScanRecord target;
+        err = statEntry(dirFd, name, false, target, isLink);
+        if (err != 0) return err;
+        if (target.type == 'd') r.type = 'l';
+        else r = target;
+        return 0;
+    }
+
+    //* stats one path below the root and records it, a folder is queued for listing
+    void addPath(ScanWorker& w, const string& rel) {
+        string full = (root / rel).string();
+        ScanRecord r;
+        if (int err = statScanEntry(AT_FDCWD, full.c_str(), r)) return skipUnreadable(w, rel, err);
+        if (r.type == 0 || skip(rel, r.type != 'f')) return;
+        w.add(rel, r);
+        if (r.type == 'd') pushFolder(w, rel);
+    }
+
+    //* lists one folder with getdents64 and stats every entry with statx relative to the folder's fd;
+    //* a folder that cannot be opened or listed is noted and what is below it left out
+    void listFolder(ScanWorker& w, const string& rel) {
+        string dirPath = rel.empty() ? root.string() : (root / rel).string();
+        struct Folder {
+            int fd;
+            ~Folder() {
+                if (fd >= 0) close(fd);
+            }
+        } folder{open(dirPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)};
+        if (folder.fd < 0) return skipUnreadable(w, rel, errno);
+        if (w.direntBuffer.empty()) w.direntBuffer.resize(64 * 1024);
+        while (true) {
+            long got = syscall(SYS_getdents64, folder.fd, w.direntBuffer.data(), w.direntBuffer.size());
+            if (got < 0) return skipUnreadable(w, rel, errno);
+            if (got == 0) break;
+            for (long pos = 0; pos < got;) {
+                // struct linux_dirent64: ino, off, reclen, type, name
+                const char* d = w.direntBuffer.data() + pos;
+                unsigned short reclen;
+                memcpy(&reclen, d + 16, sizeof(reclen));
+                const char* name = d + 19;
+                pos += reclen;
+                if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) continue;
+                string childRel = rel.empty() ? string(name) : rel + "/" + name;
+                ScanRecord r;
+                if (int err = statScanEntry(folder.fd, name, r)) {
+                    skipUnreadable(w, childRel, err);
+                    continue;
+                }
+                if (r.type == 0) continue;
+                if (skip(childRel, r.type != 'f')) continue;
+                w.add(childRel, r);
+                if (r.type == 'd') pushFolder(w, childRel);
+            }
+        }
+    }
+
+    //* returns 0 or the errno of the stat; r.type is 0 for anything that is not a file or folder
+    static int statEntry(int dirFd, const char* name, bool noFollow, ScanRecord& r, bool& isLink) {
+#ifdef STATX_BASIC_STATS
+        struct statx st;
+        if (statx(dirFd, name, noFollow ? AT_SYMLINK_NOFOLLOW : 0, STATX_BASIC_STATS, &st) != 0) return errno;
+        mode_t mode = st.stx_mode;
+        r.size = st.stx_size;
+        r.mtime = int64_t(st.stx_mtime.tv_sec) * 1000000000 + st.stx_mtime.tv_nsec;
+        r.ctime = int64_t(st.stx_ctime.tv_sec) * 1000000000 + st.stx_ctime.tv_nsec;
+        r.device = (uint64_t(st.stx_dev_major) << 32) | st.stx_dev_minor;
+        r.inode = st.stx_ino;
+#else
+        struct stat st;
+        if (fstatat(dirFd, name, &st, noFollow ? AT_SYMLINK_NOFOLLOW : 0) != 0) return errno;
+        mode_t mode = st.st_mode;
+        r.size = uint64_t(st.st_size);
+        r.mtime = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+        r.ctime = int64_t(st.st_ctim.tv_sec) * 1000000000 + st.st_ctim.tv_nsec;
+        r.device = uint64_t(st.st_dev);
+        r.inode = uint64_t(st.st_ino);
+#endif
+        r.mode = mode & 07777;
+        if (noFollow && S_ISLNK(mode)) isLink = true;
+        r.type = S_ISREG(mode) ? 'f' : S_ISDIR(mode) ? 'd' : 0;
+        if (r.type == 'd') r.size = 0;
+        return 0;
+    }
+#else
+    //* stats one path below the root and records it, a folder is queued for listing
+    void addPath(ScanWorker& w, const string& rel) {
+        error_code ec;
+        fs::path full = root / rel;
+        fs::file_status st = fs::status(full, ec);
+        if (ec) return;
+        ScanRecord r;
+        if (fs::is_directory(st)) r.type = fs::is_symlink(full) ? 'l' : 'd';
+        else if (fs::is_regular_file(st)) r.type = 'f';
+        else return;
+        if (skip(rel, r.type != 'f')) return;
+        r.mode = static_cast<uint32_t>(st.permissions());
+        if (r.type == 'f') {
+            r.size = fs::file_size(full);
+            r.mtime = fileTimeToUnixNs(fs::last_write_time(full));
+        }
+        w.add(rel, r);
+        if (r.type == 'd') pushFolder(w, rel);
+    }
+
+    //* portable version: std::filesystem listing (no inode or change time); a folder that cannot be listed
+    //* is noted and what is below it left out
+    void listFolder(ScanWorker& w, const string& rel) {
+        error_code ec;
+        fs::directory_iterator it(rel.empty() ? root : root / rel, ec), end;
+        for (; !ec && it != end; it.increment(ec)) {
+            const fs::directory_entry& entry = *it;
+            string name = entry.path().filename().string();
+            string childRel = rel.empty() ? name : rel + "/" + name;
+            ScanRecord r;
+            error_code entryError;
+            fs::file_status st = entry.status(entryError);
+            if (entryError) continue;
+            if (fs::is_directory(st)) r.type = entry.is_symlink() ? 'l' : 'd';
+            else if (fs::is_regular_file(st)) r.type = 'f';
+            else continue;
+            if (skip(childRel, r.type != 'f')) continue;
+            r.mode = static_cast<uint32_t>(st.permissions());
+            if (r.type == 'f') {
+                r.size = entry.file_size();
+                r.mtime = fileTimeToUnixNs(entry.last_write_time());
+            }
+            w.add(childRel, r);
+            if (r.type == 'd') pushFolder(w, childRel);
+        }
+        if (ec) w.skipped.push_back((rel.empty() ? "." : rel) + ": " + ec.message());
+    }
+#endif
+};
+
+//* function to scan a tree in parallel (work-stealing across `jobs` threads) into a flat, sorted list;
+//* with `paths` only those entries (and everything below the folders among them) are scanned
+ScanList scanTree(const fs::path& root, unsigned jobs, const ScanFilter& skip, const vector<string>& paths = {}) {
+    TreeScanner scanner(root, max(1u, jobs), skip);
+    if (paths.empty()) {
+        scanner.pushFolder(*scanner.workers[0], "");
+    } else {
+        for (const string& rel : paths) scanner.addPath(*scanner.workers[0], rel);
+    }
+    vector<thread> threads;
+    for (size_t i = 1; i < scanner.workers.size(); ++i) threads.emplace_back([&scanner, i] { scanner.run(i); });
+    scanner.run(0);
+    for (auto& t : threads) t.join();
+    if (scanner.failed) throw runtime_error(scanner.error);
+
+    // merge the per-thread results into one arena and sort them into walk order
+    ScanList list;
+    size_t total = 0, arenaSize = 0;
+    for (auto& w : scanner.workers) {
+        total += w->records.size();
+        arenaSize += w->arena.size();
+    }
+    list.records.reserve(total);
+    list.arena.reserve(arenaSize);
+    for (auto& w : scanner.workers) {
+        uint64_t base = list.arena.size();
+        list.arena.insert(list.arena.end(), w->arena.begin(), w->arena.end());
+        for (ScanRecord r : w->records) {
+            r.pathOffset += base;
+            list.records.push_back(r);
+        }
+        vector<ScanRecord>().swap(w->records);
+        vector<char>().swap(w->arena);
+        list.skipped.insert(list.skipped.end(), w->skipped.begin(), w->skipped.end());
+    }
+    sort(list.records.begin(), list.records.end(), [&list](const ScanRecord& a, const ScanRecord& b) {
+        return treeOrderLess(list.path(a), list.path(b));
+    });
+    return list;
+}
+
+//* function to build the scan of a snapshot that only looks at changed paths: entries of the previous
+//* manifest outside the dirty set are taken over as they are, dirty paths are scanned again (a dirty
+//* folder with everything below it), so the work is proportional to what changed
+ScanList rescanDirty(const vector<ManifestEntry>& previous, const set<string>& dirty, unsigned jobs, const ScanFilter& skip) {
+    // true if the path or one of its folders is in the dirty set
+    auto covered = [&dirty](const string& path, bool strictly) {
+        size_t end = path.size();
+        if (strictly) end = path.rfind('/');
+        while (end != string::npos && end > 0) {
+            if (dirty.count(path.substr(0, end))) return true;
+            end = path.rfind('/', end - 1);
+        }
+        return false;
+    };
+
+    vector<string> roots;
+    for (const string& path : dirty) {
+        if (covered(path, true)) continue;
+        // a path below an ignored folder stays out, same as in a full scan
+        bool ignored = false;
+        for (size_t slash = path.find('/'); slash != string::npos && !ignored; slash = path.find('/', slash + 1)) {
+            ignored = skip(path.substr(0, slash), true);
+        }
+        if (!ignored) roots.push_back(path);
+    }
+    ScanList list = roots.empty() ? ScanList() : scanTree(".", jobs, skip, roots);
+
+    for (const ManifestEntry& e : previous) {
+        if (covered(e.path, false)) continue;
+        ScanRecord r;
+        r.type = e.type;
+        r.mode = e.mode;
+        r.size = e.size;
+        r.mtime = e.mtime;
+        r.pathOffset = list.arena.size();
+        r.pathLength = static_cast<uint32_t>(e.path.size());
+        list.arena.insert(list.arena.end(), e.path.begin(), e.path.end());
+        list.records.push_back(r);
+    }
+    sort(list.records.begin(), list.records.end(), [&list](const ScanRecord& a, const ScanRecord& b) {
+        return treeOrderLess(list.path(a), list.path(b));
+    });
+    return list;
+}
+
+//* one entry moving through the backup pipeline
+struct BackupItem {
+    uint64_t seq = 0;
+    ManifestEntry entry;
+    bool store = false;         // file has to be read and stored by a worker
+    string previousId;          // content id in the previous manifest, if the path was there
+    uint64_t device = 0;        // identity and change time from the scan, for the hash cache
+    uint64_t inode = 0;         // (0 for entries taken over from the last manifest)
+    int64_t ctime = 0;
+    bool preloaded = false;     // `data` holds the whole file, read through io_uring
+    string data;
+    StoredFile stored;
+    string error;
+};
+
+#ifdef BACKUP_URING
+//* function to read the small changed files from `in` through io_uring and pass them on to the workers
+//* with their content; a file that is not exactly its scanned size any more goes on without data and is
+//* read by its worker as usual. Keeps up to URING_SLOTS files in flight
+void uringReadFiles(IoRing& ring, BoundedQueue<BackupItem>& in, BoundedQueue<BackupItem>& out) {
+    RunStats& stats = runStats();
+    vector<BackupItem> items(ring.slots);
+    vector<int> results(ring.slots, 0);
+    vector<unsigned> steps(ring.slots, 0);
+    vector<size_t> free;
+    for (size_t slot = ring.slots; slot-- > 0;) free.push_back(slot);
+    size_t inFlight = 0;
+    while (true) {
+        while (!free.empty()) {
+            BackupItem item;
+            if (inFlight == 0 && ring.queued == 0) {
+                if (!in.pop(item)) break;
+            } else if (!in.tryPop(item)) {
+                break;
+            }
+            size_t slot = free.back();
+            free.pop_back();
+            items[slot] = move(item);
+            // one byte more than expected shows a file that grew since the scan
+            size_t want = min<size_t>(ring.slotSize, items[slot].entry.size + 1);
+            ring.queueFile(slot, items[slot].entry.path.c_str(), O_RDONLY, 0, false, want);
+        }
+        if (inFlight == 0 && ring.queued == 0) break;
+        inFlight += ring.queued / 3;
+        try {
+            PhaseTimer timer(RunStats::Read);
+            ring.submitAndWait();
+        } catch (...) {
+            // no item may get lost: the ones in the ring go on without data
+            vector<bool> idle(ring.slots, false);
+            for (size_t slot : free) idle[slot] = true;
+            for (size_t slot = 0; slot < ring.slots; ++slot) {
+                if (!idle[slot]) out.push(move(items[slot]));
+            }
+            throw;
+        }
+        ring.reap([&](size_t slot, unsigned step, int res) {
+            if (step == 1) results[slot] = res;
+            if (++steps[slot] < 3) return;
+            steps[slot] = 0;
+            BackupItem& item = items[slot];
+            if (results[slot] >= 0 && uint64_t(results[slot]) == item.entry.size) {
+                item.data.assign(reinterpret_cast<const char*>(ring.buffer(slot)), item.entry.size);
+                item.preloaded = true;
+                stats.add(RunStats::BytesRead, item.entry.size);
+                ioThrottle().afterRead(item.entry.size, chrono::steady_clock::duration());
+            }
+            out.push(move(item));
+            free.push_back(slot);
+            --inFlight;
+        });
+    }
+}
+#endif
+
+//* function to create a backup safely (with .backupignore support)
+//* file data goes into the deduplicating object store, the snapshot folder only holds the manifest;
+//* files whose size, mtime and mode match the previous manifest are not read again
+//* runs as a pipeline: this thread feeds the scanned tree, `jobs` workers read/chunk/hash/write changed files
+//* with their own buffers, and one committer writes the manifest in walk order; the queues and the
+//* in-flight window are bounded so memory stays flat no matter how many files the tree has
+//* with `dirty` only those paths are scanned again and the rest is taken over from the last manifest
+void createBackup(const BackupOptions& options, const set<string>* dirty = nullptr) {
+    string backupDir;
+    RunStats& stats = runStats();
+    stats.reset("do");
+    auto runStart = chrono::steady_clock::now();
+    try {
+        StoreLock storeLock(false);  // prune waits until the snapshot is committed
+        refreshPackStore();
+        ThrottleScope throttle(options.throttle);
+        RangeThreadsScope rangeThreads(options.jobs);
+        IgnoreMatcher ignore = readBackupIgnore();
+        for (const string& pattern : options.ignore) ignore.add(pattern);
+        ChunkParams chunkParams = loadChunkParams(readBackupConfig());
+        int64_t createdAt = chrono::duration_cast<chrono::seconds>(chrono::system_clock::now().time_since_epoch()).count();
+
+        unordered_map<string, ManifestEntry> previous;
+        vector<ManifestEntry> previousList;
+        fs::path lastManifest = latestSnapshot();
+        if (!lastManifest.empty()) lastManifest /= MANIFEST_NAME;
+        if (!lastManifest.empty() && !fs::exists(lastManifest)) lastManifest = findLastManifest();
+        if (!lastManifest.empty()) {
+            previousList = readManifest(lastManifest);
+            for (auto& e : previousList) previous.emplace(e.path, e);
+        }
+        if (!dirty) vector<ManifestEntry>().swap(previousList);
+
+        // two backups in the same second get -1, -2, ...; create_directory claims a name atomically, so
+        // concurrent backups (scheduler, daemon and CLI) never share a folder. After latestSnapshot, whose
+        // ensureCatalog must not take the empty folder for an old snapshot
+        string stamp = formatLocalTime(createdAt);
+        string backupName = "Backup_" + stamp;
+        for (int n = 1; !fs::create_directory(".backup/" + backupName); ++n) backupName = "Backup_" + stamp + "-" + to_string(n);
+        backupDir = ".backup/" + backupName;
+        logAction("Created backup directory: " + backupDir);
+
+        // The backup is created inside the .backup directory, which is in the current working directory.
+        // Files and folders from the current directory (except those in .backupignore and .backup itself) are recorded.
+        ScanFilter skip = [&](const string& rel, bool isDir) {
+            if (rel == ".backup") return true;
+            bool ignored;
+            {
+                PhaseTimer timer(RunStats::Ignore);
+                ignored = rel != ".backupignore" && ignore.ignored(rel, isDir);  // Always include .backupignore in backup
+            }
+            if (!ignored) return false;
+            stats.add(RunStats::EntriesIgnored);
+            logAction("Ignored by .backupignore: " + rel, LOG_FILES);
+            return true;
+        };
+        HashCache cache(options.hashCache && options.cloneMode != CloneMode::Copy);
+        vector<HashCacheEntry> cacheEntries;
+        int64_t scanStartNs = chrono::duration_cast<chrono::nanoseconds>(chrono::system_clock::now().time_since_epoch()).count();
+        ScanList scan;
+        {
+            PhaseTimer timer(RunStats::Scan);
+            scan = dirty && !lastManifest.empty() ? rescanDirty(previousList, *dirty, options.jobs, skip)
+                                                  : scanTree(".", options.jobs, skip);
+        }
+        vector<ManifestEntry>().swap(previousList);
+        for (const string& what : scan.skipped) {
+            cerr << "Warning: could not read " << what << " (left out of this backup)" << endl;
+            logAction("WARNING: could not read " + what + " (left out of this backup)");
+        }
+        for (const ScanRecord& r : scan.records) {
+            stats.add(r.type == 'd' ? RunStats::FoldersScanned : RunStats::FilesScanned);
+            stats.add(RunStats::BytesScanned, r.size);
+        }
+
+        ManifestWriter manifest(fs::path(backupDir) / MANIFEST_NAME);
+        vector<ManifestEntry> indexEntries;
+        unique_ptr<PackWriter> pack;
+        if (options.packed || options.smallFileSize > 0) pack = make_unique<PackWriter>(backupName);
+        NewObjects newObjects;
+        ObjectTarget target{pack.get(), options.compression, &newObjects};
+
+        const size_t window = max<size_t>(1024, size_t(options.jobs) * 64);
+        BoundedQueue<BackupItem> work(size_t(options.jobs) * 4);
+        BoundedQueue<BackupItem> results(window);
+        Semaphore inFlight(window);
+        atomic<bool> failed{false};
+
+        // with --io=uring small changed files take a detour through the ring reader before the workers
+        // (strict reflink mode has to clone every file from its descriptor)
+        BoundedQueue<BackupItem> ringWork(URING_SLOTS * 2);
+        thread ringReader;
+#ifdef BACKUP_URING
+        unique_ptr<IoRing> ring;
+        if (options.io == IoBackend::Uring && options.cloneMode != CloneMode::Reflink) ring = openIoRing();
+        if (ring) {
+            ringReader = thread([&] {
+                applyWorkerPriority(options.throttle);
+                try {
+                    uringReadFiles(*ring, ringWork, work);
+                } catch (const exception& e) {
+                    // what is left is read by the workers
+                    logAction(string("ERROR: io_uring reader: ") + e.what());
+                    for (BackupItem item; ringWork.pop(item);) work.push(move(item));
+                }
+            });
+        }
+#else
+        if (options.io == IoBackend::Uring) cout << "io_uring is not available on this system, using --io=threads" << endl;
+#endif
+
+        vector<thread> workers;
+        for (unsigned i = 0; i < options.jobs; ++i) {
+            workers.emplace_back([&] {
+                applyWorkerPriority(options.throttle);
+                vector<uint8_t> buffer;
+                BackupItem item;
+                while (work.pop(item)) {
+                    if (!failed) {
+                        try {
+                            auto start = chrono::steady_clock::now();
+                            // strict reflink mode keeps every file loose so it can be cloned
+                            bool packed = options.packed || (options.cloneMode != CloneMode::Reflink &&
+                                                             item.entry.size <= options.smallFileSize);
+                            item.stored = item.preloaded ? storeBufferChunked(item.data, chunkParams, target, packed)
+                                                         : storeFileChunked(item.entry.path, chunkParams, options.cloneMode,
+                                                                            target, packed, buffer);
+                            string().swap(item.data);
+                            stats.recordFile(item.entry.size, chrono::steady_clock::now() - start);
+                        } catch (const exception& e) {
+                            item.error = e.what();
+                            failed = true;
+                        }
+                    }
+                    results.push(move(item));
+                }
+            });
+        }
+
+        size_t changed = 0, unchanged = 0, deduped = 0, linked = 0;
+        uint64_t bytesStored = 0;
+        StoredFile written;  // totals per write strategy
+        string firstError;
+        thread committer([&] {
+            map<uint64_t, BackupItem> pending;
+            uint64_t next = 0;
+            BackupItem item;
+            while (results.pop(item)) {
+                pending.emplace(item.seq, move(item));
+                for (auto it = pending.begin(); it != pending.end() && it->first == next; it = pending.erase(it), ++next) {
+                    BackupItem& done = it->second;
+                    inFlight.release();
+                    if (!done.error.empty() && firstError.empty()) firstError = done.error;
+                    if (!firstError.empty()) continue;
+                    ManifestEntry& e = done.entry;
+                    if (done.store) {
+                        e.id = done.stored.id;
+                        e.chunks = done.stored.chunks;
+                        written.reflinked += done.stored.reflinked;
+                        written.rangeCopied += done.stored.rangeCopied;
+                        written.buffered += done.stored.buffered;
+                        written.compressed += done.stored.compressed;
+                        written.bytesWritten += done.stored.bytesWritten;
+                        if (done.stored.newChunks > 0) {
+                            ++changed;
+                            bytesStored += done.stored.bytesNew;
+                            logAction("Saved file to backup: " + e.path + " -> " + e.id + " (" +
+                                      to_string(done.stored.newChunks) + "/" + to_string(done.stored.chunkCount) + " chunks new)",
+                                      LOG_FILES);
+                        } else if (done.previousId == e.id) {
+                            ++unchanged;  // only the timestamp changed
+                        } else {
+                            ++deduped;
+                            logAction("Deduplicated file: " + e.path + " -> " + e.id, LOG_FILES);
+                        }
+                    } else if (e.type == 'f') {
+                        ++unchanged;
+                        ++linked;
+                    }
+                    if (e.type == 'f' && done.inode != 0 && max(e.mtime, done.ctime) + options.hashCacheGranuleNs <= scanStartNs) {
+                        cacheEntries.push_back(makeHashCacheEntry(done.device, done.inode, e, done.ctime));
+                    }
+                    try {
+                        PhaseTimer timer(RunStats::Manifest);
+                        manifest.add(e);
+                        indexEntries.push_back(e);
+                    } catch (const exception& ex) {
+                        firstError = ex.what();
+                    }
+                    if (!firstError.empty()) failed = true;
+                }
+            }
+        });
+
+        // feed the scanned entries into the pipeline; unchanged files go straight to the committer
+        uint64_t seq = 0;
+        for (const ScanRecord& r : scan.records) {
+            if (failed) break;
+            BackupItem item;
+            ManifestEntry& e = item.entry;
+            e.path = string(scan.path(r));
+            e.type = r.type;
+            e.mode = r.mode;
+            if (r.type == 'f') {
+                e.size = r.size;
+                e.mtime = r.mtime;
+                item.device = r.device;
+                item.inode = r.inode;
+                item.ctime = r.ctime;
+                auto prev = previous.find(e.path);
+                if (prev != previous.end()) item.previousId = prev->second.id;
+                if (options.cloneMode == CloneMode::Copy) {
+                    item.store = true;
+                } else if (r.inode != 0 && cache.loaded()) {
+                    // with a cache, identity and stamps decide (this also catches renamed files);
+                    // racily clean files are not in it and get read again
+                    if (cache.find(r.device, r.inode, r.size, r.mtime, r.ctime, e.id, e.chunks)) {
+                        stats.add(RunStats::HashCacheHits);
+                    } else {
+                        stats.add(RunStats::HashCacheMisses);
+                        item.store = true;
+                    }
+                } else if (prev != previous.end() && prev->second.type == 'f' && prev->second.source.empty() &&
+                           prev->second.size == e.size && prev->second.mtime == e.mtime && prev->second.mode == e.mode) {
+                    e.id = prev->second.id;
+                    e.chunks = prev->second.chunks;
+                } else {
+                    item.store = true;
+                }
+            } else if (r.type == 'l') {
+                // a link to a folder is kept as its target, stored like a tiny file
+                error_code ec;
+                string link = fs::read_symlink(e.path, ec).string();
+                if (ec) continue;  // gone again
+                e.size = link.size();
+                e.mtime = r.mtime;
+                e.id = hashBytes(link.data(), link.size());
+                writeObject(target, e.id, link.data(), link.size(), true);
+            }
+            item.seq = seq++;
+            inFlight.acquire();
+            if (!item.store) results.push(move(item));
+            else if (ringReader.joinable() && e.size < URING_SLOT_SIZE) ringWork.push(move(item));
+            else work.push(move(item));
+        }
+
+        ringWork.close();
+        if (ringReader.joinable()) ringReader.join();
+        work.close();
+        for (auto& t : workers) t.join();
+        results.close();
+        committer.join();
+        string treeId;
+        if (firstError.empty()) {
+            PhaseTimer timer(RunStats::Manifest);
+            // tree nodes go into this backup's pack next to the small files; unchanged folders already exist
+            treeId = buildSnapshotTree(indexEntries, [&target](const string& id, const string& node) {
+                writeObject(target, id, node.data(), node.size(), true);
+            });
+        }
+        if (!firstError.empty()) throw runtime_error(firstError);
+        string cloneReport = "clone-mode " + cloneModeName(options.cloneMode) + ": " + to_string(written.reflinked) +
+                             " reflinked, " + to_string(written.rangeCopied) + " copy_file_range, " +
+                             to_string(written.buffered) + " buffered (" + to_string(written.compressed) + " compressed, " +
+                             compressionName(options.compression) + "), " + to_string(linked) + " unchanged linked, " +
+                             to_string(written.bytesWritten) + " bytes physically written";
+        {
+            PhaseTimer timer(RunStats::Manifest);
+            // objects first, then the index, the manifest last: a snapshot never points at missing data
+            newObjects.sync();
+            if (pack) pack->commit();
+            writeSnapshotIndex(fs::path(backupDir) / SNAPSHOT_INDEX_NAME, indexEntries);
+            fs::path treeFile = fs::path(backupDir) / TREE_NAME;
+            {
+                ofstream tree(treeFile, ios::trunc);
+                tree << treeId << "\n";
+                if (!tree.flush()) throw runtime_error("Failed to write " + treeFile.string());
+            }
+            syncFile(treeFile);
+            manifest.comment(cloneReport);
+            manifest.commit();
+            syncFile(backupDir);  // the renames of the index and the manifest
+            syncFile(".backup");  // the snapshot folder itself
+        }
+        uint64_t snapshotId = appendToCatalog(makeCatalogRecord(backupName, createdAt, indexEntries, bytesStored));
+        if (options.hashCache) {
+            try {
+                // a watch snapshot only saw the changed paths, the other entries stay; a full scan
+                // rewrites the cache (dropping deleted files) unless every file was a hit
+                if (dirty && cache.loaded()) {
+                    set<pair<uint64_t, uint64_t>> seen;
+                    for (const auto& c : cacheEntries) seen.emplace(c.device, c.inode);
+                    for (uint64_t i = 0; i < cache.slots; ++i) {
+                        HashCacheEntry c = cache.slot(i);
+                        if ((c.flags & HASH_CACHE_USED) && !seen.count({c.device, c.inode})) cacheEntries.push_back(c);
+                    }
+                }
+                sortHashCacheEntries(cacheEntries);
+                bool unchanged = cache.loaded() && !dirty && stats.counters[RunStats::HashCacheMisses] == 0 &&
+                                 cacheEntries.size() == cache.entries;
+                cache = HashCache(false);  // unmap before the file is replaced
+                if (!unchanged) writeHashCache(cacheEntries);
+            } catch (const exception& ex) {
+                cerr << "Warning: could not update the hash cache: " << ex.what() << endl;
+                logAction(string("ERROR: hash cache: ") + ex.what());
+            }
+        }
+        stats.add(RunStats::FilesChanged, changed);
+        stats.add(RunStats::FilesUnchanged, unchanged);
+        stats.add(RunStats::FilesDeduped, deduped);
+        stats.add(RunStats::ChunksNew, written.reflinked + written.rangeCopied + written.buffered);
+        stats.add(RunStats::BytesNew, bytesStored);
+        stats.add(RunStats::BytesWritten, written.bytesWritten);
+
+        cout << "Backup #" << snapshotId << " saved to: " << backupDir << " (" << changed << " changed, " << unchanged
+             << " unchanged, " << deduped << " deduplicated, " << bytesStored << " bytes stored, "
+             << options.jobs << " jobs)" << endl;
+        cout << "  " << cloneReport << endl;
+        if (uint64_t holes = stats.counters[RunStats::BytesInHoles]) {
+            uint64_t logical = stats.counters[RunStats::BytesInSparseFiles];
+            cout << "  sparse files: " << stats.counters[RunStats::SparseFiles] << " with " << logical << " bytes logical, "
+                 << logical - min(logical, holes) << " bytes physically read, " << holes << " bytes of holes skipped" << endl;
+        }
+        if (uint64_t throttledNs = stats.phaseNs[RunStats::Throttle]) {
+            cout << "  throttled " << fixed << setprecision(2) << throttledNs / 1e9 << defaultfloat
+                 << " s (summed over worker threads)" << endl;
+        }
+        logAction("Backup completed: " + backupDir + " (" + to_string(changed) + " changed, " +
+                  to_string(unchanged) + " unchanged, " + cloneReport + ")");
+        stats.addTime(RunStats::Total, chrono::steady_clock::now() - runStart);
+        saveRunStats(true);
+    } catch (const exception& e) {
+        cerr << "Error creating backup: " << e.what() << endl;
+        logAction(string("ERROR: ") + e.what());
+        // an incomplete snapshot must not be picked up by `backup pull --last`
+        error_code ec;
+        if (!backupDir.empty()) fs::remove_all(backupDir, ec);
+        stats.addTime(RunStats::Total, chrono::steady_clock::now() - runStart);
+        saveRunStats(false);
+    }
+}
+
+//* function for automatic backups
+void autoBackup(int minutes, const BackupOptions& options) {
+    while (true) {
+        createBackup(options);
+        cout << "Waiting " << minutes << " minutes for the next backup..." << endl;
+        this_thread::sleep_for(chrono::minutes(minutes));
+    }
+}
+
+#ifdef __linux__
+static volatile sig_atomic_t watchStopRequested = 0;
+
+//* inotify watches on every folder of the tree, collecting the paths that changed since the last snapshot
+struct TreeWatcher {
+    static constexpr uint32_t EVENTS = IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                                       IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+    int fd = -1;
+    unsigned jobs;
+    IgnoreMatcher ignore = readBackupIgnore();
+    unordered_map<int, string> folders;  // watch descriptor -> relative folder, "" is the root
+    set<string> dirty;
+    bool rescan = false;                  // events were lost or the ignore rules changed: compare the whole tree
+
+    explicit TreeWatcher(unsigned threads) : jobs(threads) {
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd < 0) throw runtime_error(string("Failed to start inotify: ") + strerror(errno));
+        watchTree("");
+    }
+
+    ~TreeWatcher() { close(fd); }
+    TreeWatcher(const TreeWatcher&) = delete;
+    TreeWatcher& operator=(const TreeWatcher&) = delete;
+
+    bool skipped(const string& rel, bool isDir) const {
+        return rel == ".backup" || (rel != ".backupignore" && ignore.ignored(rel, isDir));
+    }
+
+    void watchFolder(const string& rel) {
+        int wd = inotify_add_watch(fd, rel.empty() ? "." : rel.c_str(), EVENTS);
+        if (wd < 0) {
+            if (errno == ENOSPC) throw runtime_error("Too many folders to watch, raise fs.inotify.max_user_watches");
+            return;  // folder is already gone again
+        }
+        folders[wd] = rel;
+    }
+
+    //* function to watch a folder and every folder below it (a moved folder keeps its watch descriptors)
+    void watchTree(const string& rel) {
+        watchFolder(rel);
+        string prefix = rel.empty() ? "" : rel + "/";
+        ScanList list = scanTree(rel.empty() ? fs::path(".") : fs::path(rel), jobs,
+                                 [&](const string& child, bool isDir) { return skipped(prefix + child, isDir); });
+        for (const ScanRecord& r : list.records) {
+            if (r.type == 'd') watchFolder(prefix + string(list.path(r)));
+        }
+    }
+
+    //* function to read all queued events into the dirty set, returns false if there were none
+    bool drain() {
+        alignas(struct inotify_event) char buffer[64 * 1024];
+        bool any = false;
+        while (true) {
+            ssize_t got = read(fd, buffer, sizeof(buffer));
+            if (got < 0 && errno == EINTR) continue;
+            if (got < 0 && errno == EAGAIN) break;
+            if (got < 0) throw runtime_error(string("Failed to read inotify events: ") + strerror(errno));
+            if (got == 0) break;
+            for (ssize_t pos = 0; pos < got;) {
+                const auto* ev = reinterpret_cast<const struct inotify_event*>(buffer + pos);
+                pos += sizeof(struct inotify_event) + ev->len;
+                any = true;
+                if (ev->mask & IN_Q_OVERFLOW) {
+                    rescan = true;
+                    continue;
+                }
+                auto it = folders.find(ev->wd);
+                if (it == folders.end()) continue;
+                if (ev->mask & IN_IGNORED) {
+                    folders.erase(it);
+                    continue;
+                }
+                string folder = it->second;
+                if (ev->len == 0 || ev->name[0] == 0) {
+                    // the watched folder itself was removed or moved
+                    if (folder.empty()) rescan = true;
+                    else dirty.insert(folder);
+                    continue;
+                }
+                string rel = folder.empty() ? string(ev->name) : folder + "/" + ev->name;
+                bool isDir = ev->mask & IN_ISDIR;
+                if (skipped(rel, isDir)) continue;
+                if (rel == ".backupignore") rescan = true;
+                if (isDir && (ev->mask & (IN_CREATE | IN_MOVED_TO))) watchTree(rel);
+                dirty.insert(rel);
+            }
+        }
+        return any;
+    }
+
+    bool pending() const { return rescan || !dirty.empty(); }
+};
+
+//* function to back up continuously: inotify collects changed paths, bursts are coalesced until the tree
+//* has been quiet for `debounceMs` (at most 10x that while changes keep coming), then only the changed
+//* paths are snapshotted; a lost event queue falls back to comparing the whole tree with the manifest
+void watchBackups(const BackupOptions& options, int debounceMs) {
+    auto onSignal = [](int) { watchStopRequested = 1; };
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    // watches go up before the first snapshot so nothing that changes during it is missed
+    auto watcher = make_unique<TreeWatcher>(options.jobs);
+    cout << "Watching " << watcher->folders.size() << " folders, debounce " << debounceMs << " ms (Ctrl+C to stop)" << endl;
+    logAction("Watch started on " + to_string(watcher->folders.size()) + " folders");
+    createBackup(options);
+
+    const auto debounce = chrono::milliseconds(debounceMs);
+    auto firstChange = chrono::steady_clock::now(), lastChange = firstChange;
+    chrono::steady_clock::time_point retryAt;  // after a failed snapshot the next try waits ten debounces
+    while (true) {
+        bool stopping = watchStopRequested != 0;
+        if (!stopping) {
+            int timeout = -1;
+            if (watcher->pending()) {
+                auto now = chrono::steady_clock::now();
+                auto due = max(min(lastChange + debounce, firstChange + debounce * 10), retryAt);
+                timeout = static_cast<int>(max<int64_t>(0, chrono::duration_cast<chrono::milliseconds>(due - now).count()));
+            }
+            struct pollfd p = {watcher->fd, POLLIN, 0};
+            int ready = poll(&p, 1, timeout);
+            if (ready < 0 && errno != EINTR) throw runtime_error(string("Failed to wait for changes: ") + strerror(errno));
+            if (ready > 0) {
+                bool wasPending = watcher->pending();
+                if (watcher->drain()) {
+                    lastChange = chrono::steady_clock::now();
+                    if (!wasPending) firstChange = lastChange;
+                }
+                continue;
+            }
+            if (ready < 0) continue;
+        }
+        if (watcher->pending()) {
+            uint64_t before = lastCatalogSeq();
+            bool full = watcher->rescan;
+            set<string> changed;
+            if (full) {
+                cout << "Change events were lost or .backupignore changed, comparing the whole tree" << endl;
+                logAction("Watch: full rescan");
+                watcher = make_unique<TreeWatcher>(options.jobs);
+                createBackup(options);
+            } else {
+                changed.swap(watcher->dirty);
+                cout << "Snapshot of " << changed.size() << " changed path(s)" << endl;
+                createBackup(options, &changed);
+            }
+            if (lastCatalogSeq() == before) {
+                // a failed snapshot keeps its changes for the next try, otherwise that one would take the
+                // paths over unread from the last manifest (a full one is tried again as a full one)
+                if (full) watcher->rescan = true;
+                else watcher->dirty.insert(changed.begin(), changed.end());
+                retryAt = chrono::steady_clock::now() + debounce * 10;
+            }
+        }
+        if (stopping) break;
+    }
+    cout << "Watch stopped." << endl;
+    logAction("Watch stopped");
+}
+#else
+void watchBackups(const BackupOptions&, int) {
+    throw runtime_error("backup watch needs inotify (Linux), use `backup auto --min X` instead");
+}
+#endif
+
+//* function to remove all backups
+void removeAllBackups() {
+    try {
+        fs::remove_all(".backup");
+        cout << "All backups removed." << endl;
+        logAction("All backups removed from .backup/");
+    } catch (const exception& e) {
+        cerr << "Error removing backups: " << e.what() << endl;
+        logAction(string("ERROR: ") + e.what());
+    }
+}
+
+//* options for `backup pull` (from the command line)
+struct RestoreOptions {
+    unsigned jobs = defaultJobs();
+    bool checksum = false;        // --checksum: hash files even when size and mtime match
+    IgnoreMatcher filter;         // paths after `--`, gitignore syntax relative to the project root
+    bool filtered = false;
+    ThrottleOptions throttle;
+    IoBackend io = IoBackend::Threads;
+};
+
+//* function to read the restore options: `[--jobs N] [--checksum] [--io=uring|threads|sync] [-- PATH|PATTERN ...]`
+RestoreOptions parseRestoreOptions(const vector<string>& args) {
+    RestoreOptions options;
+    auto separator = find(args.begin(), args.end(), "--");
+    vector<string> flags(args.begin(), separator);
+    uint64_t jobs = argNumber(flags, "--jobs", options.jobs);
+    if (jobs < 1 || jobs > 1024) throw runtime_error("--jobs must be between 1 and 1024");
+    options.jobs = static_cast<unsigned>(jobs);
+    options.checksum = hasArg(flags, "--checksum");
+    map<string, string> config = readBackupConfig();
+    options.throttle = parseThrottleOptions(flags, config);
+    options.io = parseIoBackend(argValue(flags, "--io", config.count("io") ? config["io"] : "threads"));
+    if (options.io == IoBackend::Sync) options.jobs = 1;
+    for (auto it = separator == args.end() ? separator : separator + 1; it != args.end(); ++it) {
+        string pattern = *it;
+        // filters name paths from the project root, not names at any depth like .backupignore lines
+        bool negate = pattern[0] == '!';
+        if (negate) pattern.erase(0, 1);
+        if (pattern.rfind("./", 0) == 0) pattern.erase(0, 2);
+        if (pattern.empty()) continue;
+        if (pattern[0] != '/' && pattern.rfind("**/", 0) != 0) pattern = "/" + pattern;
+        options.filter.add((negate ? "!" : "") + pattern);
+        options.filtered = true;
+    }
+    return options;
+}
+
+//* function to check whether a snapshot path is selected by the restore filters:
+//* the deepest of the path and its parent folders that a filter decides on counts
+bool restoreSelected(const RestoreOptions& options, const string& path, bool isDir) {
+    if (!options.filtered) return true;
+    string_view p = path;
+    while (true) {
+        long rule = options.filter.decidingRule(p, isDir);
+        if (rule >= 0) return !options.filter.rules[rule].negate;
+        size_t slash = p.rfind('/');
+        if (slash == string_view::npos) return false;
+        p = p.substr(0, slash);
+        isDir = true;
+    }
+}
+
+//* function to get size, mtime (unix ns) and permission bits of a regular file, false if it is not one
+bool statRegularFile(const fs::path& path, uint64_t& size, int64_t& mtime, uint32_t& mode) {
+#ifdef _WIN32
+    error_code ec;
+    fs::file_status st = fs::symlink_status(path, ec);
+    if (ec || !fs::is_regular_file(st)) return false;
+    size = fs::file_size(path, ec);
+    auto time = fs::last_write_time(path, ec);
+    if (ec) return false;
+    mtime = fileTimeToUnixNs(time);
+    mode = static_cast<uint32_t>(st.permissions());
+    return true;
+#else
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) return false;
+    size = uint64_t(st.st_size);
+    mtime = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    mode = st.st_mode & 07777;
+    return true;
+#endif
+}
+
+//* function to compute the content id of a file on disk (BLAKE3 of the whole file)
+//* files larger than RANGE_SIZE are hashed in ranges by borrowed threads
+string hashFileContent(const fs::path& path, vector<uint8_t>& buffer) {
+    SourceFile src(path);
+    if (buffer.size() < (1 << 20)) buffer.resize(1 << 20);
+    if (src.size <= RANGE_SIZE) {
+        Blake3Hasher hasher;
+        while (size_t got = src.read(buffer.data(), buffer.size())) hasher.update(buffer.data(), got);
+        return hasher.hexDigest();
+    }
+    size_t ranges = size_t((src.size + RANGE_SIZE - 1) / RANGE_SIZE);
+    vector<Blake3Hasher> parts;
+    parts.reserve(ranges);
+    for (size_t i = 0; i < ranges; ++i) parts.emplace_back(i * RANGE_HASH_CHUNKS);
+    atomic<size_t> next{0};
+    runWithRangeThreads(unsigned(min<size_t>(ranges - 1, 1024)), buffer, [&](vector<uint8_t>& buf) {
+        if (buf.size() < (1 << 20)) buf.resize(1 << 20);
+        for (size_t i; (i = next++) < ranges;) {
+            uint64_t at = i * RANGE_SIZE, to = min(src.size, at + RANGE_SIZE);
+            while (at < to) {
+                size_t got = src.readAt(at, buf.data(), size_t(min<uint64_t>(buf.size(), to - at)));
+                if (got == 0) throw runtime_error("File changed while it was read: " + path.string());
+                parts[i].update(buf.data(), got);
+                at += got;
+            }
+        }
+    });
+    Blake3Hasher whole;
+    for (size_t i = 0; i + 1 < ranges; ++i) {
+        uint32_t cv[8];
+        parts[i].subtree(cv);
+        whole.pushSubtree(cv, RANGE_HASH_CHUNKS);
+    }
+    return whole.hexDigestWith(parts.back().lastNode());
+}
+
+//* function to create a folder below the current one without following symlinks on the way: a link that
+//* took the place of one of its folders is removed (not what it points to) and a real folder made instead,
+//* so a restore never writes outside the tree. `checked` holds the folders already known to be real
+void createRealFolders(const string& rel, unordered_set<string>& checked) {
+    string at;
+    for (const auto& part : fs::path(rel)) {
+        at += (at.empty() ? "" : "/") + part.string();
+        if (!checked.insert(at).second) continue;
+        fs::path path = fs::path(".") / at;
+        fs::file_status st = fs::symlink_status(path);
+        if (fs::is_symlink(st)) {
+            fs::remove(path);
+            st = fs::file_status(fs::file_type::not_found);
+        }
+        if (!fs::is_directory(st)) fs::create_directory(path);
+    }
+}
+
+//* function to restore from a backup directory
+//* backups with a manifest are rebuilt from the object store by `jobs` workers, older backups are plain
+//* copies; files that already match the snapshot (same size and mtime, or same content hash) are not
+//* written again, so a restore after a small mistake only touches the damaged files
+void restoreBackup(const fs::path& backupDir, const RestoreOptions& options = RestoreOptions()) {
+    RunStats& stats = runStats();
+    stats.reset("pull");
+    auto runStart = chrono::steady_clock::now();
+    try {
+        StoreLock storeLock(false);
+        refreshPackStore();
+        ThrottleScope throttle(options.throttle);
+        RangeThreadsScope rangeThreads(options.jobs);
+        fs::path manifest = backupDir / MANIFEST_NAME;
+        atomic<size_t> restored{0}, current{0}, failures{0};
+        if (fs::exists(manifest)) {
+            // folders first, then files that sit in a pack in pack order (one sequential read per pack
+            // for all the small files), then the rest
+            vector<ManifestEntry> entries = readManifest(manifest);
+            struct Placed { const PackIndex* pack; uint64_t offset, length; size_t entry; };
+            vector<Placed> order;
+            order.reserve(entries.size());
+            set<string> folders;
+            vector<size_t> links;
+            for (size_t i = 0; i < entries.size(); ++i) {
+                const ManifestEntry& e = entries[i];
+                if (!restoreSelected(options, e.path, e.type == 'd')) continue;
+                if (e.type == 'd') {
+                    folders.insert(e.path);
+                    continue;
+                }
+                string parent = fs::path(e.path).parent_path().generic_string();
+                if (!parent.empty()) folders.insert(parent);
+                if (e.type == 'l') {
+                    links.push_back(i);
+                    continue;
+                }
+                Placed p = {nullptr, 0, 0, i};
+                if (e.source.empty() && e.chunks == "-") p.pack = packStore().find(e.id, p.offset, p.length);
+                order.push_back(p);
+            }
+            unordered_set<string> checked;
+            for (const auto& folder : folders) createRealFolders(folder, checked);
+            stable_sort(order.begin(), order.end(), [](const Placed& a, const Placed& b) {
+                if (a.pack != b.pack) return a.pack != nullptr && (b.pack == nullptr || a.pack < b.pack);
+                return a.offset < b.offset;
+            });
+
+            // true (after fixing the metadata) if the file on disk already has the snapshot's content
+            auto upToDate = [&](const ManifestEntry& e, const fs::path& dest, vector<uint8_t>& buffer) {
+                uint64_t size;
+                int64_t mtime;
+                uint32_t mode;
+                bool same = false;
+                if (!statRegularFile(dest, size, mtime, mode)) {
+                    // never write through a symlink that took the file's place
+                    if (fs::is_symlink(fs::symlink_status(dest))) fs::remove(dest);
+                } else if (size == e.size) {
+                    if (mtime == e.mtime && !options.checksum) same = true;
+                    else if (e.source.empty()) same = hashFileContent(dest, buffer) == e.id;
+                }
+                if (!same) return false;
+                // content is right, only the metadata may need fixing
+                if (mtime != e.mtime) fs::last_write_time(dest, unixNsToFileTime(e.mtime));
+                if (mode != e.mode) fs::permissions(dest, static_cast<fs::perms>(e.mode));
+                ++current;
+                return true;
+            };
+            auto countRestored = [&](const ManifestEntry& e, chrono::steady_clock::time_point start) {
+                auto took = chrono::steady_clock::now() - start;
+                stats.addTime(RunStats::Restore, took);
+                stats.recordFile(e.size, took);
+                stats.add(RunStats::FilesRestored);
+                stats.add(RunStats::BytesRestored, e.size);
+                ++restored;
+                logAction("Restored file: " + e.path + " from " + backupDir.string(), LOG_FILES);
+            };
+            auto failed = [&](const ManifestEntry& e, const string& what) {
+                ++failures;
+                // one write per line, the workers print at the same time
+                cerr << ("Error restoring " + e.path + ": " + what + "\n") << flush;
+                logAction("ERROR: restoring " + e.path + ": " + what);
+            };
+            // a link to a folder replaces a file or an empty folder in its place, never a folder with content
+            auto restoreLink = [&](const ManifestEntry& e) {
+                fs::path dest = fs::path(".") / e.path;
+                auto start = chrono::steady_clock::now();
+                try {
+                    string target = readObject(e.id);
+                    error_code ec;
+                    fs::file_status st = fs::symlink_status(dest, ec);
+                    if (fs::is_symlink(st) && fs::read_symlink(dest, ec).string() == target) {
+                        ++current;
+                        return;
+                    }
+                    if (fs::is_directory(st) && !fs::is_empty(dest)) throw runtime_error("a folder with content is in its place");
+                    if (fs::exists(st)) fs::remove(dest);
+                    fs::create_directory_symlink(target, dest);
+                } catch (const exception& ex) {
+                    failed(e, ex.what());
+                    return;
+                }
+                countRestored(e, start);
+            };
+            auto restoreOne = [&](const Placed& p, vector<uint8_t>& buffer) {
+                const ManifestEntry& e = entries[p.entry];
+                fs::path dest = fs::path(".") / e.path;
+                auto start = chrono::steady_clock::now();
+                try {
+                    if (upToDate(e, dest, buffer)) return;
+                    restoreObject(e, dest);
+                    ioThrottle().afterCopy(e.size, e.size);
+                    fs::last_write_time(dest, unixNsToFileTime(e.mtime));
+                    fs::permissions(dest, static_cast<fs::perms>(e.mode));
+                } catch (const exception& ex) {
+                    failed(e, ex.what());
+                    return;
+                }
+                countRestored(e, start);
+            };
+
+#ifdef BACKUP_URING
+            // with --io=uring the small packed files are written by one more thread through the ring
+            vector<Placed> ringOrder;
+            unique_ptr<IoRing> ring;
+            if (options.io == IoBackend::Uring) {
+                auto small = stable_partition(order.begin(), order.end(), [&](const Placed& p) {
+                    return p.pack && entries[p.entry].size <= URING_SLOT_SIZE;
+                });
+                if (small != order.begin() && (ring = openIoRing())) {
+                    ringOrder.assign(order.begin(), small);
+                    order.erase(order.begin(), small);
+                }
+            }
+            auto restoreThroughRing = [&] {
+                applyWorkerPriority(options.throttle);
+                vector<uint8_t> buffer;
+                vector<size_t> slotPlace(ring->slots);
+                vector<string> paths(ring->slots);  // openat reads the path when it runs
+                vector<chrono::steady_clock::time_point> starts(ring->slots);
+                vector<int> errors(ring->slots, 0);
+                vector<unsigned> steps(ring->slots, 0);
+                vector<size_t> free;
+                for (size_t slot = ring->slots; slot-- > 0;) free.push_back(slot);
+                size_t pos = 0, inFlight = 0;
+                while (true) {
+                    while (!free.empty() && pos < ringOrder.size()) {
+                        size_t index = pos++;
+                        const ManifestEntry& e = entries[ringOrder[index].entry];
+                        fs::path dest = fs::path(".") / e.path;
+                        auto start = chrono::steady_clock::now();
+                        try {
+                            if (upToDate(e, dest, buffer)) continue;
+                            const Placed& p = ringOrder[index];
+                            string data = decodeObject(p.pack->read(p.offset, p.length));
+                            if (data.size() != e.size) throw runtime_error("Corrupt object " + e.id);
+                            size_t slot = free.back();
+                            free.pop_back();
+                            memcpy(ring->buffer(slot), data.data(), data.size());
+                            slotPlace[slot] = index;
+                            paths[slot] = dest.string();
+                            starts[slot] = start;
+                            ring->queueFile(slot, paths[slot].c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0644,
+                                            true, data.size());
+                        } catch (const exception& ex) {
+                            failed(e, ex.what());
+                        }
+                    }
+                    if (inFlight == 0 && ring->queued == 0) break;
+                    inFlight += ring->queued / 3;
+                    try {
+                        ring->submitAndWait();
+                    } catch (const exception& ex) {
+                        // the ring broke: what is in it and what is left takes the normal path
+                        cerr << "io_uring failed (" << ex.what() << "), restoring the rest with --io=threads" << endl;
+                        logAction(string("ERROR: io_uring: ") + ex.what());
+                        vector<bool> idle(ring->slots, false);
+                        for (size_t slot : free) idle[slot] = true;
+                        for (size_t slot = 0; slot < ring->slots; ++slot) {
+                            if (!idle[slot]) restoreOne(ringOrder[slotPlace[slot]], buffer);
+                        }
+                        while (pos < ringOrder.size()) restoreOne(ringOrder[pos++], buffer);
+                        return;
+                    }
+                    ring->reap([&](size_t slot, unsigned step, int res) {
+                        const ManifestEntry& e = entries[ringOrder[slotPlace[slot]].entry];
+                        // the first failure of the chain counts, a short write is one too
+                        if (errors[slot] == 0 && res < 0) errors[slot] = res;
+                        if (errors[slot] == 0 && step == 1 && uint64_t(res) != e.size) errors[slot] = -EIO;
+                        if (++steps[slot] < 3) return;
+                        int error = errors[slot];
+                        steps[slot] = 0;
+                        errors[slot] = 0;
+                        free.push_back(slot);
+                        --inFlight;
+                        if (error < 0) {
+                            failed(e, strerror(-error));
+                            return;
+                        }
+                        try {
+                            ioThrottle().afterCopy(e.size, e.size);
+                            fs::path dest = paths[slot];
+                            fs::last_write_time(dest, unixNsToFileTime(e.mtime));
+                            fs::permissions(dest, static_cast<fs::perms>(e.mode));
+                        } catch (const exception& ex) {
+                            failed(e, ex.what());
+                            return;
+                        }
+                        countRestored(e, starts[slot]);
+                    });
+                }
+            };
+            thread ringWriter;
+            if (!ringOrder.empty()) ringWriter = thread(restoreThroughRing);
+#endif
+
+            atomic<size_t> next{0};
+            auto restoreFiles = [&] {
+                applyWorkerPriority(options.throttle);
+                vector<uint8_t> buffer;
+                for (size_t i; (i = next++) < order.size();) restoreOne(order[i], buffer);
+            };
+            vector<thread> workers;
+            unsigned jobs = unsigned(min<size_t>(options.jobs, max<size_t>(1, order.size())));
+            // lowered priorities stick to a thread, so the calling thread only helps when there are none
+            bool lowered = options.throttle.lowersPriority();
+            for (unsigned t = lowered ? 0 : 1; t < jobs; ++t) workers.emplace_back(restoreFiles);
+            if (!lowered) restoreFiles();
+            for (auto& t : workers) t.join();
+#ifdef BACKUP_URING
+            if (ringWriter.joinable()) ringWriter.join();
+#else
+            if (options.io == IoBackend::Uring) cout << "io_uring is not available on this system, using --io=threads" << endl;
+#endif
+            for (size_t i : links) restoreLink(entries[i]);
+            stats.add(RunStats::FilesCurrent, current);
+        } else {
+            // snapshots from before the manifest are plain copies of the tree
+            for (const auto& file : fs::directory_iterator(backupDir)) {
+                string name = file.path().filename().string();
+                if (!restoreSelected(options, name, file.is_directory())) continue;
+                fs::copy(file.path(), "./" + name, fs::copy_options::overwrite_existing | fs::copy_options::recursive);
+                ++restored;
+                logAction("Restored file: " + name + " from " + backupDir.string(), LOG_FILES);
+            }
+        }
+        cout << "Restored from backup: " << backupDir.string() << " (" << restored << " restored, " << current
+             << " already up to date" << (failures ? ", " + to_string(failures) + " FAILED" : "") << ", "
+             << options.jobs << " jobs)" << endl;
+        if (uint64_t holes = stats.counters[RunStats::BytesRestoredAsHoles]) {
+            uint64_t logical = stats.counters[RunStats::BytesInSparseFiles];
+            cout << "  sparse files: " << stats.counters[RunStats::SparseFiles] << " with " << logical << " bytes logical, "
+                 << logical - min(logical, holes) << " bytes physically written, " << holes << " bytes left as holes" << endl;
+        }
+        logAction("Restored from backup: " + backupDir.string() + " (" + to_string(restored) + " restored, " +
+                  to_string(current) + " already up to date, " + to_string(failures) + " failed)");
+        stats.addTime(RunStats::Total, chrono::steady_clock::now() - runStart);
+        saveRunStats(failures == 0);
+    } catch (const exception& e) {
+        cerr << "Error restoring backup: " << e.what() << endl;
+        logAction(string("ERROR: ") + e.what());
+        stats.addTime(RunStats::Total, chrono::steady_clock::now() - runStart);
+        saveRunStats(false);
+    }
+}
+
+//* function to pick the snapshot for `backup pull`: --last, --id N or --at TIME (catalog lookups)
+fs::path selectSnapshot(const vector<string>& args) {
+    ensureCatalog();
+    Catalog catalog;
+    CatalogRecord found;
+    if (hasArg(args, "--id")) {
+        uint64_t seq = argNumber(args, "--id", 0);
+        if (!catalog.findSeq(seq, found)) throw runtime_error("No backup with id " + to_string(seq) + " (see `backup list`)");
+        return fs::path(".backup") / catalogName(found);
+    }
+    if (hasArg(args, "--at")) {
+        string at = argValue(args, "--at", "");
+        if (!catalog.findAt(parseLocalTime(at), found)) throw runtime_error("No backup at or before " + at);
+        return fs::path(".backup") / catalogName(found);
+    }
+    if (!hasArg(args, "--last")) throw runtime_error("Usage: backup pull --last | --id N | --at TIME");
+    return latestSnapshot();
+}
+
+//* function to pull a backup (the last one unless --id or --at picks another)
+void pullBackup(const vector<string>& args) {
+    try {
+        // options and snapshot selection come before `--`, path filters after it
+        auto separator = find(args.begin(), args.end(), "--");
+        vector<string> flags(args.begin(), separator);
+        RestoreOptions options = parseRestoreOptions(args);
+        fs::path backup = selectSnapshot(flags);
+        if (!backup.empty()) {
+            restoreBackup(backup, options);
+        } else {
+            cout << "No backups found." << endl;
+        }
+    } catch (const exception& e) {
+        cerr << "Error pulling backup: " << e.what() << endl;
+        logAction(string("ERROR: ") + e.what());
+    }
+}
+
+//* function to list all snapshots from the catalog, oldest first
+void listSnapshots(bool json) {
+    ensureCatalog();
+    Catalog catalog;
+    if (json) {
+        cout << "[";
+        for (size_t i = 0; i < catalog.count; ++i) {
+            CatalogRecord r = catalog.at(i);
+            cout << (i ? "," : "") << "{\"id\":" << r.seq << ",\"name\":\"" << catalogName(r) << "\",\"time\":" << r.time
+                 << ",\"files\":" << r.files << ",\"folders\":" << r.folders << ",\"bytes\":" << r.bytes
+                 << ",\"bytes_new\":" << r.bytesNew << ",\"root\":\"" << bytesToId(r.root) << "\"}";
+        }
+        cout << "]" << endl;
+        return;
+    }
+    if (catalog.empty()) {
+        cout << "No backups found." << endl;
+        return;
+    }
+    cout << right << setw(6) << "id" << "  " << left << setw(30) << "backup" << right << setw(10) << "files" << setw(16)
+         << "bytes" << setw(16) << "new bytes" << endl;
+    for (size_t i = 0; i < catalog.count; ++i) {
+        CatalogRecord r = catalog.at(i);
+        cout << setw(6) << r.seq << "  " << left << setw(30) << catalogName(r) << right << setw(10) << r.files << setw(16)
+             << r.bytes << setw(16) << r.bytesNew << "\n";
+    }
+    cout << flush;
+}
+
+//* function to describe where an object's bytes are stored
+string objectLocation(const string& id) {
+    uint64_t offset, length;
+    if (const PackIndex* pack = packStore().find(id, offset, length)) {
+        return pack->dataPath.string() + " @ " + to_string(offset) + " (" + to_string(length) + " bytes)";
+    }
+    fs::path loose = objectPath(id);
+    return fs::exists(loose) ? loose.string() : "MISSING";
+}
+
+//* function to show one path of a snapshot (the last one by default) and where its data is stored;
+//* uses the snapshot index when there is one, older snapshots fall back to reading the manifest
+void locateInBackup(const vector<string>& args) {
+    if (args.size() < 3 || args[2].rfind("--", 0) == 0) throw runtime_error("Usage: backup locate <path> [--in Backup_NAME]");
+    string path = fs::path(args[2]).lexically_normal().generic_string();
+    string name = argValue(args, "--in", "");
+    fs::path backupDir;
+    if (name.empty()) {
+        backupDir = latestSnapshot();
+        if (backupDir.empty()) throw runtime_error("No backups found.");
+    } else {
+        backupDir = fs::path(".backup") / name;
+        if (!fs::exists(backupDir / MANIFEST_NAME)) throw runtime_error("No such backup: " + name);
+    }
+
+    ManifestEntry e;
+    bool found = false;
+    fs::path index = backupDir / SNAPSHOT_INDEX_NAME;
+    if (fs::exists(index)) {
+        found = findInSnapshotIndex(index, path, e);
+    } else if (fs::exists(backupDir / MANIFEST_NAME)) {
+        for (auto& entry : readManifest(backupDir / MANIFEST_NAME)) {
+            if (entry.path == path) {
+                e = move(entry);
+                found = true;
+                break;
+            }
+        }
+    }
+    if (!found) {
+        cout << path << ": not in " << backupDir.filename().string() << endl;
+        return;
+    }
+    cout << path << " in " << backupDir.filename().string() << ":" << endl;
+    if (e.type == 'd') {
+        cout << "  folder, mode " << oct << e.mode << dec << endl;
+        return;
+    }
+    cout << "  size " << e.size << ", mtime " << e.mtime << ", mode " << oct << e.mode << dec << endl;
+    if (e.type == 'l') {
+        cout << "  link to " << readObject(e.id) << endl;
+        return;
+    }
+    if (!e.source.empty()) {
+        cout << "  copy: " << (fs::path(".backup") / e.source / e.path).string() << endl;
+        return;
+    }
+    cout << "  id " << e.id << endl;
+    if (e.chunks == "-") {
+        cout << "  data: " << objectLocation(e.id) << endl;
+        return;
+    }
+    cout << "  chunk list: " << objectLocation(e.chunks) << endl;
+    istringstream list(readObject(e.chunks));
+    string chunk;
+    uint64_t len;
+    while (list >> chunk >> len) cout << "    " << chunk.substr(0, 16) << " " << len << " -> " << objectLocation(chunk) << endl;
+}
+
+//* the objects one or more snapshots use, for verify and prune
+struct SnapshotObjects {
+    unordered_set<string> ids;    // file blobs, chunk lists, chunks and tree nodes
+    set<string> sourceFolders;    // snapshot folders whose plain copies old (v1) manifests point into
+    size_t plainCopies = 0;       // files without an object (old plain-copy snapshots), nothing to check
+};
+
+//* function to add the objects of one snapshot folder; chunk lists and tree nodes are read to find the
+//* objects below them, ids in `known` (or already collected) are not followed again. With `strict` a chunk
+//* list or tree node that cannot be read is an error (prune must not lose what hangs below it), otherwise
+//* it is skipped and reported by its own check
+void collectSnapshotObjects(const fs::path& dir, SnapshotObjects& into, bool strict,
+                            const unordered_set<string>* known = nullptr) {
+    auto seen = [&](const string& id) { return (known && known->count(id)) || !into.ids.insert(id).second; };
+    if (!fs::exists(dir / MANIFEST_NAME)) {
+        ++into.plainCopies;
+        return;
+    }
+    for (const auto& e : readManifest(dir / MANIFEST_NAME)) {
+        if (e.type == 'd') continue;
+        if (!e.source.empty()) {
+            ++into.plainCopies;
+            into.sourceFolders.insert(e.source);
+            continue;
+        }
+        if (e.chunks == "-") {
+            seen(e.id);
+            continue;
+        }
+        if (seen(e.chunks)) continue;
+        try {
+            istringstream list(readObject(e.chunks));
+            string chunk;
+            uint64_t len;
+            while (list >> chunk >> len) seen(chunk);
+        } catch (const exception&) {
+            if (strict) throw;
+        }
+    }
+    TreeStore trees;
+    ifstream treeFile(dir / TREE_NAME);
+    string root;
+    vector<string> pending;
+    if (treeFile >> root && root.size() == 64) pending.push_back(root);
+    while (!pending.empty()) {
+        string node = pending.back();
+        pending.pop_back();
+        if (seen(node)) continue;  // shared subtree, already walked
+        try {
+            for (const auto& e : trees.node(node)) {
+                if (e.type == 'd') pending.push_back(e.id);
+            }
+        } catch (const exception&) {
+            if (strict) throw;
+        }
+    }
+}
+
+//* function to find a snapshot folder by catalog id (`backup list`) or folder name
+fs::path resolveSnapshot(const string& ref) {
+    if (!ref.empty() && all_of(ref.begin(), ref.end(), [](char c) { return isdigit(static_cast<unsigned char>(c)); })) {
+        ensureCatalog();
+        CatalogRecord found;
+        if (!Catalog().findSeq(stoull(ref), found)) throw runtime_error("No backup with id " + ref + " (see `backup list`)");
+        return fs::path(".backup") / catalogName(found);
+    }
+    fs::path dir = fs::path(".backup") / ref;
+    if (ref.rfind("Backup_", 0) != 0 || !fs::exists(dir / MANIFEST_NAME)) throw runtime_error("No such backup: " + ref);
+    return dir;
+}
+
+//* function to compare the working tree with a snapshot: new and missing paths by name, files by size,
+//* then mtime and mode, and only files whose stamps moved are hashed (or found in the hash cache)
+vector<DiffEntry> diffWorktree(const fs::path& backupDir, unsigned jobs) {
+    vector<ManifestEntry> snapshot = readManifest(backupDir / MANIFEST_NAME);
+    unordered_map<string, const ManifestEntry*> byPath;
+    for (const auto& e : snapshot) byPath.emplace(e.path, &e);
+    IgnoreMatcher ignore = readBackupIgnore();
+    ScanList scan = scanTree(".", jobs, [&ignore](const string& rel, bool isDir) {
+        return rel == ".backup" || (rel != ".backupignore" && ignore.ignored(rel, isDir));
+    });
+    HashCache cache;
+    vector<uint8_t> buffer;
+    vector<DiffEntry> out;
+    for (const ScanRecord& r : scan.records) {
+        string path(scan.path(r));
+        auto it = byPath.find(path);
+        if (it == byPath.end()) {
+            out.push_back({'A', path + (r.type == 'd' ? "/" : "")});
+            continue;
+        }
+        const ManifestEntry& e = *it->second;
+        byPath.erase(it);
+        if (e.type != r.type) {
+            out.push_back({'D', path + (e.type == 'd' ? "/" : "")});
+            out.push_back({'A', path + (r.type == 'd' ? "/" : "")});
+            continue;
+        }
+        if (r.type == 'd' || (r.size == e.size && r.mtime == e.mtime && r.mode == e.mode)) continue;
+        bool modified = r.size != e.size || r.mode != e.mode;
+        if (r.type == 'l') {
+            string target = fs::read_symlink(path).string();
+            modified = hashBytes(target.data(), target.size()) != e.id;
+        } else if (!modified) {
+            string id, chunks;
+            if (!cache.find(r.device, r.inode, r.size, r.mtime, r.ctime, id, chunks)) id = hashFileContent(path, buffer);
+            modified = id != e.id;
+        }
+        if (modified) out.push_back({'M', path});
+    }
+    for (const auto& left : byPath) out.push_back({'D', left.first + (left.second->type == 'd' ? "/" : "")});
+    sort(out.begin(), out.end(), [](const DiffEntry& a, const DiffEntry& b) { return treeOrderLess(a.path, b.path); });
+    return out;
+}
+
+//* function to list added, removed and modified paths between two snapshots (`backup diff A B`) or
+//* between a snapshot (the last one by default) and the working tree (`backup diff --worktree [A]`)
+void diffSnapshots(const vector<string>& args) {
+    vector<string> refs;
+    for (size_t i = 2; i < args.size(); ++i) {
+        if (args[i] == "--jobs") ++i;
+        else if (args[i].rfind("--", 0) != 0) refs.push_back(args[i]);
+    }
+    bool worktree = hasArg(args, "--worktree");
+    if (worktree ? refs.size() > 1 : refs.size() != 2) {
+        throw runtime_error("Usage: backup diff <A> <B> | backup diff --worktree [A]  (A, B: id or Backup_NAME)");
+    }
+    auto start = chrono::steady_clock::now();
+    vector<DiffEntry> changes;
+    if (worktree) {
+        fs::path base = refs.empty() ? latestSnapshot() : resolveSnapshot(refs[0]);
+        if (base.empty()) throw runtime_error("No backups found.");
+        unsigned jobs = static_cast<unsigned>(argNumber(args, "--jobs", defaultJobs()));
+        changes = diffWorktree(base, max(1u, jobs));
+    } else {
+        TreeStore store;
+        string a = snapshotTreeRoot(resolveSnapshot(refs[0]), store);
+        string b = snapshotTreeRoot(resolveSnapshot(refs[1]), store);
+        diffTrees(store, a, b, "", changes);
+    }
+    size_t counts[3] = {0, 0, 0};
+    for (const auto& c : changes) {
+        cout << c.kind << ' ' << c.path << '\n';
+        ++counts[c.kind == 'A' ? 0 : c.kind == 'D' ? 1 : 2];
+    }
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    cout << counts[0] << " added, " << counts[1] << " removed, " << counts[2] << " modified (" << fixed
+         << setprecision(1) << ms << " ms)" << endl;
+}
+
+//* function to re-hash one stored object and compare it with its id, returns "" if it is intact;
+//* loose objects that are not compressed are streamed, so a large one never has to fit in memory
+string verifyObject(const string& id, const PackIndex* pack, uint64_t offset, uint64_t length, TokenBucket& limiter,
+                    vector<uint8_t>& buffer) {
+    RunStats& stats = runStats();
+    string actual;
+    try {
+        if (pack) {
+            limiter.acquire(length);
+            string stored;
+            auto start = chrono::steady_clock::now();
+            {
+                PhaseTimer timer(RunStats::Read);
+                stored = pack->read(offset, length);
+            }
+            ioThrottle().afterRead(stored.size(), chrono::steady_clock::now() - start);
+            stats.add(RunStats::BytesRead, stored.size());
+            PhaseTimer timer(RunStats::Hash);
+            string raw = decodeObject(move(stored));
+            actual = hashBytes(raw.data(), raw.size());
+        } else {
+            fs::path path = objectPath(id);
+            if (!fs::exists(path)) return "missing";
+            SourceFile src(path);
+            if (buffer.size() < (1 << 20)) buffer.resize(1 << 20);
+            Blake3Hasher hasher;
+            string framed;  // a compressed object is read whole and decoded
+            bool first = true, compressed = false;
+            for (uint64_t left = src.size;; left -= min<uint64_t>(left, buffer.size())) {
+                limiter.acquire(min<uint64_t>(left, buffer.size()));
+                size_t got;
+                {
+                    PhaseTimer timer(RunStats::Read);
+                    got = src.read(buffer.data(), buffer.size());
+                }
+                if (got == 0) break;
+                stats.add(RunStats::BytesRead, got);
+                compressed = compressed || (first && isFramedObject(buffer.data(), got));
+                first = false;
+                PhaseTimer timer(RunStats::Hash);
+                if (compressed) framed.append(reinterpret_cast<const char*>(buffer.data()), got);
+                else hasher.update(buffer.data(), got);
+            }
+            PhaseTimer timer(RunStats::Hash);
+            if (compressed) {
+                string raw = decodeObject(move(framed));
+                actual = hashBytes(raw.data(), raw.size());
+            } else {
+                actual = hasher.hexDigest();
+            }
+        }
+    } catch (const exception& e) {
+        return e.what();
+    }
+    return actual == id ? "" : "content hash " + actual.substr(0, 16) + "... does not match";
+}
+
+//* function to check stored data against its content ids: `backup verify [--all|--last] [--jobs N] [--rate MB]`
+//* every object the selected snapshots use (file blobs, chunk lists, chunks, tree nodes) is read back once,
+//* in pack order, hashed by `jobs` threads (BLAKE3 on the vector unit) and compared with its id; corrupt
+//* or missing objects are listed with the snapshots and paths they break
+void verifyBackups(const vector<string>& args) {
+    RunStats& stats = runStats();
+    stats.reset("verify");
+    auto runStart = chrono::steady_clock::now();
+    bool clean = false;
+    try {
+        unsigned jobs = max(1u, static_cast<unsigned>(argNumber(args, "--jobs", defaultJobs())));
+        map<string, string> config = readBackupConfig();
+        double rateMb = double(argNumber(args, "--rate", configNumber(config, "verify-rate", 0)));
+        ThrottleOptions throttleOptions = parseThrottleOptions(args, config);
+        StoreLock storeLock(false);
+        refreshPackStore();
+        ThrottleScope throttle(throttleOptions);
+        ensureCatalog();
+        Catalog catalog;
+        vector<CatalogRecord> snapshots;
+        for (size_t i = hasArg(args, "--last") && catalog.count > 0 ? catalog.count - 1 : 0; i < catalog.count; ++i) {
+            snapshots.push_back(catalog.at(i));
+        }
+        if (snapshots.empty()) throw runtime_error("No backups found.");
+
+        // every object once (one that cannot be read is reported by its own check)
+        SnapshotObjects used;
+        for (const auto& snapshot : snapshots) collectSnapshotObjects(fs::path(".backup") / catalogName(snapshot), used, false);
+        unordered_set<string>& ids = used.ids;
+        map<string, string> corrupt;  // id -> what is wrong
+        TreeStore trees;
+
+        // read in storage order: one sequential pass per pack, then the loose objects
+        struct Job { const PackIndex* pack; uint64_t offset, length; string id; };
+        vector<Job> work;
+        work.reserve(ids.size());
+        for (const string& id : ids) {
+            Job job{nullptr, 0, 0, id};
+            job.pack = packStore().find(id, job.offset, job.length);
+            work.push_back(move(job));
+        }
+        unordered_set<string>().swap(ids);
+        sort(work.begin(), work.end(), [](const Job& a, const Job& b) {
+            if (a.pack != b.pack) return (a.pack == nullptr) < (b.pack == nullptr) || (a.pack && b.pack && a.pack->dataPath < b.pack->dataPath);
+            return a.pack ? a.offset < b.offset : a.id < b.id;
+        });
+        cout << "Verifying " << work.size() << " objects of " << snapshots.size() << " snapshot(s) with " << jobs
+             << " threads, BLAKE3 " << hashPathName(hashPath());
+        if (rateMb > 0) cout << ", at most " << rateMb << " MB/s";
+        cout << " ..." << endl;
+
+        TokenBucket limiter(rateMb * 1e6);
+        mutex resultLock;
+        atomic<size_t> next{0};
+        vector<thread> workers;
+        for (unsigned t = 0; t < jobs; ++t) {
+            workers.emplace_back([&] {
+                applyWorkerPriority(throttleOptions);
+                vector<uint8_t> buffer;
+                for (size_t i = next++; i < work.size(); i = next++) {
+                    const Job& job = work[i];
+                    string problem = verifyObject(job.id, job.pack, job.offset, job.length, limiter, buffer);
+                    stats.add(RunStats::ObjectsVerified);
+                    if (problem.empty()) continue;
+                    stats.add(RunStats::ObjectsCorrupt);
+                    lock_guard<mutex> guard(resultLock);
+                    corrupt.emplace(job.id, problem);
+                }
+            });
+        }
+        for (auto& t : workers) t.join();
+
+        for (const auto& c : corrupt) {
+            cout << "CORRUPT " << c.first << " (" << objectLocation(c.first) << "): " << c.second << endl;
+            logAction("Corrupt object " + c.first + ": " + c.second, LOG_ERRORS);
+        }
+        // second pass only when something is broken: which snapshots and paths use the bad objects
+        if (!corrupt.empty()) {
+            cout << "Affected snapshots:" << endl;
+            for (const auto& snapshot : snapshots) {
+                fs::path dir = fs::path(".backup") / catalogName(snapshot);
+                if (!fs::exists(dir / MANIFEST_NAME)) continue;
+                vector<string> broken;
+                for (const auto& e : readManifest(dir / MANIFEST_NAME)) {
+                    if (e.type == 'd' || !e.source.empty()) continue;
+                    bool bad = corrupt.count(e.chunks == "-" ? e.id : e.chunks) > 0;
+                    if (!bad && e.chunks != "-") {
+                        istringstream list(readObject(e.chunks));
+                        string chunk;
+                        uint64_t len;
+                        while (!bad && list >> chunk >> len) bad = corrupt.count(chunk) > 0;
+                    }
+                    if (bad) broken.push_back(e.path);
+                }
+                bool treeBad = false;
+                ifstream treeFile(dir / TREE_NAME);
+                string root;
+                vector<string> pending;
+                if (treeFile >> root && root.size() == 64) pending.push_back(root);
+                while (!pending.empty() && !treeBad) {
+                    string node = pending.back();
+                    pending.pop_back();
+                    treeBad = corrupt.count(node) > 0;
+                    if (!treeBad) {
+                        for (const auto& e : trees.node(node)) {
+                            if (e.type == 'd') pending.push_back(e.id);
+                        }
+                    }
+                }
+                if (broken.empty() && !treeBad) continue;
+                cout << "  #" << snapshot.seq << " " << catalogName(snapshot) << ":";
+                if (!broken.empty()) {
+                    cout << " " << broken.size() << " file(s)";
+                    for (size_t i = 0; i < broken.size() && i < 5; ++i) cout << (i ? ", " : " (") << broken[i];
+                    cout << (broken.size() > 5 ? ", ...)" : ")");
+                }
+                if (treeBad) cout << (broken.empty() ? "" : ",") << " folder tree (backup diff)";
+                cout << endl;
+            }
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - runStart).count();
+        cout << "Verified " << work.size() << " objects, " << fixed << setprecision(1)
+             << stats.counters[RunStats::BytesRead] / 1e6 << " MB in " << seconds << " s: "
+             << (corrupt.empty() ? "all intact" : to_string(corrupt.size()) + " CORRUPT") << endl;
+        if (used.plainCopies) cout << "  " << used.plainCopies << " file(s) of old plain-copy snapshots have no checksum and were not checked" << endl;
+        logAction("Verified " + to_string(work.size()) + " objects of " + to_string(snapshots.size()) + " snapshot(s): " +
+                  to_string(corrupt.size()) + " corrupt");
+        clean = corrupt.empty();
+    } catch (const exception& e) {
+        cerr << "Error verifying: " << e.what() << endl;
+        logAction(string("ERROR: ") + e.what());
+    }
+    stats.addTime(RunStats::Total, chrono::steady_clock::now() - runStart);
+    saveRunStats(clean);
+}
+
+//* retention policy for `backup prune` (flags, or keep-* / max-size in .backup/__init__)
+struct RetentionPolicy {
+    uint64_t keepLast = 0;
+    uint64_t keepHourly = 0;   // newest backup of each of the last N hours that have one
+    uint64_t keepDaily = 0;
+    uint64_t keepWeekly = 0;
+    uint64_t maxSize = 0;      // bytes of stored data the kept backups may use together (0 = no limit)
+
+    bool any() const { return keepLast || keepHourly || keepDaily || keepWeekly || maxSize; }
+};
+
+//* function to parse a size like 500M, 20G or 1048576 (bytes)
+uint64_t parseSize(const string& text) {
+    size_t end = 0;
+    double value = 0;
+    try {
+        value = stod(text, &end);
+    } catch (const exception&) {
+        throw runtime_error("Invalid size: " + text);
+    }
+    string unit = text.substr(end);
+    transform(unit.begin(), unit.end(), unit.begin(), [](unsigned char c) { return char(toupper(c)); });
+    if (!unit.empty() && unit.back() == 'B') unit.pop_back();
+    static const map<string, double> units = {{"", 1}, {"K", 1024.0}, {"M", 1048576.0}, {"G", 1073741824.0}, {"T", 1099511627776.0}};
+    auto it = units.find(unit);
+    if (!(value >= 0) || !isfinite(value) || it == units.end()) throw runtime_error("Invalid size: " + text);
+    return uint64_t(value * it->second);
+}
+
+RetentionPolicy parseRetention(const vector<string>& args, map<string, string> config) {
+    RetentionPolicy p;
+    p.keepLast = argNumber(args, "--keep-last", configNumber(config, "keep-last", 0));
+    p.keepHourly = argNumber(args, "--keep-hourly", configNumber(config, "keep-hourly", 0));
+    p.keepDaily = argNumber(args, "--keep-daily", configNumber(config, "keep-daily", 0));
+    p.keepWeekly = argNumber(args, "--keep-weekly", configNumber(config, "keep-weekly", 0));
+    string maxSize = argValue(args, "--max-size", config.count("max-size") ? config["max-size"] : "");
+    if (!maxSize.empty()) p.maxSize = parseSize(maxSize);
+    return p;
+}
+
+//* function to mark the catalog records a policy keeps; the newest backup is always kept
+vector<bool> applyRetention(const vector<CatalogRecord>& records, const RetentionPolicy& p) {
+    vector<bool> keep(records.size(), false);
+    if (records.empty()) return keep;
+    keep.back() = true;
+    for (size_t n = 0; n < p.keepLast && n < records.size(); ++n) keep[records.size() - 1 - n] = true;
+    // one backup (the newest) per hour / day / ISO week, for the newest N periods that have backups
+    auto keepPeriods = [&](uint64_t count, const char* format) {
+        set<string> periods;
+        for (size_t i = records.size(); i-- > 0 && count > 0;) {
+            time_t t = static_cast<time_t>(records[i].time);
+            tm local;
+#ifdef _WIN32
+            localtime_s(&local, &t);
+#else
+            localtime_r(&t, &local);
+#endif
+            char key[32];
+            strftime(key, sizeof(key), format, &local);
+            if (periods.size() < count && periods.insert(key).second) keep[i] = true;
+        }
+    };
+    keepPeriods(p.keepHourly, "%Y-%m-%d %H");
+    keepPeriods(p.keepDaily, "%Y-%m-%d");
+    keepPeriods(p.keepWeekly, "%G-W%V");
+    return keep;
+}
+
+//* function to get the size an object takes in the store (0 if it is missing)
+uint64_t storedObjectSize(const string& id) {
+    uint64_t offset, length;
+    if (packStore().find(id, offset, length)) return length;
+    error_code ec;
+    uint64_t size = fs::file_size(objectPath(id), ec);
+    return ec ? 0 : size;
+}
+
+//* a pack that still holds dead objects is rewritten once at least this share of its bytes is dead
+const double PRUNE_REPACK_DEAD_SHARE = 0.5;
+//* packs smaller than this are merged with their neighbours, new packs from a merge hold up to PRUNE_MERGE_SIZE
+const uint64_t PRUNE_SMALL_PACK = 16ull << 20;
+const uint64_t PRUNE_MERGE_SIZE = 256ull << 20;
+//* loose objects deleted per exclusive-lock step
+const size_t PRUNE_BATCH = 2000;
+
+//* function to delete a pack: the index goes first, because a .pack without its index is invisible (and
+//* swept by sweepPackLeftovers if prune stops in between) while an index without its .pack breaks lookups
+void removePack(const fs::path& idx) {
+    fs::remove(idx);
+    fs::remove(fs::path(idx).replace_extension(".pack"));
+}
+
+//* function to delete what interrupted runs left in the packs folder: .pack files without an index (a prune
+//* that stopped between the two deletions) and temp files (a backup or prune that crashed); only called with
+//* the exclusive store lock, so no backup is writing one. Returns the bytes freed
+uint64_t sweepPackLeftovers() {
+    vector<fs::path> leftovers;
+    error_code ec;
+    for (fs::directory_iterator it(PACKS_DIR, ec), end; !ec && it != end; it.increment(ec)) {
+        const fs::path& path = it->path();
+        bool orphan = path.extension() == ".pack" && !fs::exists(fs::path(path).replace_extension(".idx"));
+        if (orphan || path.extension() == ".tmp") leftovers.push_back(path);
+    }
+    uint64_t freed = 0;
+    for (const auto& path : leftovers) {
+        uint64_t size = fs::file_size(path, ec);
+        if (fs::remove(path, ec)) freed += ec ? 0 : size;
+    }
+    return freed;
+}
+
+//* function to apply the retention policy: `backup prune [--keep-last N] [--keep-hourly N] [--keep-daily N]
+//* [--keep-weekly N] [--max-size SIZE] [--dry-run]`
+//* 1. pick the backups to keep from the catalog; with --max-size the kept backups are walked newest first and
+//*    the older ones that would take the unique data past the limit are dropped as well
+//* 2. mark: collect every object the kept backups use (no lock, backups keep running)
+//* 3. under the exclusive lock: drop the other backups from the catalog, move their folders to the trash and
+//*    remove the hash cache (its hits are not checked against the store)
+//* 4. sweep in short exclusive steps: loose objects in batches, then pack by pack (deleted when all of it is
+//*    dead); packs that are mostly dead or small are then merged in groups, their live objects copied into one
+//*    new pack per group; before every step the backups that were committed in the meantime are marked too,
+//*    so nothing a new backup deduplicated against is lost
+void pruneBackups(const vector<string>& args) {
+    RunStats& stats = runStats();
+    stats.reset("prune");
+    auto runStart = chrono::steady_clock::now();
+    bool ok = false;
+    try {
+        RetentionPolicy policy = parseRetention(args, readBackupConfig());
+        if (!policy.any()) {
+            throw runtime_error("No retention policy: use --keep-last, --keep-hourly, --keep-daily, --keep-weekly or --max-size "
+                                "(or set them in .backup/__init__)");
+        }
+        bool dryRun = hasArg(args, "--dry-run");
+        vector<CatalogRecord> records;
+        {
+            StoreLock storeLock(false);
+            ensureCatalog();
+            Catalog catalog;
+            for (size_t i = 0; i < catalog.count; ++i) records.push_back(catalog.at(i));
+        }
+        if (records.empty()) throw runtime_error("No backups found.");
+        vector<bool> keep = applyRetention(records, policy);
+
+        // mark, newest first so --max-size can stop at the first backup that does not fit
+        SnapshotObjects live;
+        uint64_t liveBytes = 0;
+        bool full = false;
+        for (size_t i = records.size(); i-- > 0;) {
+            if (!keep[i]) continue;
+            if (full) {
+                keep[i] = false;
+                continue;
+            }
+            SnapshotObjects mine;
+            collectSnapshotObjects(fs::path(".backup") / catalogName(records[i]), mine, true, &live.ids);
+            uint64_t added = 0;
+            if (policy.maxSize) {
+                for (const string& id : mine.ids) added += storedObjectSize(id);
+            }
+            if (policy.maxSize && i + 1 < records.size() && liveBytes + added > policy.maxSize) {
+                keep[i] = false;
+                full = true;
+                continue;
+            }
+            liveBytes += added;
+            live.ids.insert(mine.ids.begin(), mine.ids.end());
+            live.sourceFolders.insert(mine.sourceFolders.begin(), mine.sourceFolders.end());
+        }
+        // old plain-copy backups that a kept one still points into stay as well
+        for (size_t i = 0; i < records.size(); ++i) {
+            if (!keep[i] && live.sourceFolders.count(catalogName(records[i]))) keep[i] = true;
+        }
+        uint64_t markedSeq = records.back().seq;
+        vector<CatalogRecord> dropped;
+        for (size_t i = 0; i < records.size(); ++i) {
+            if (!keep[i]) dropped.push_back(records[i]);
+        }
+        cout << "Keeping " << records.size() - dropped.size() << " of " << records.size() << " backups";
+        if (policy.maxSize) cout << " (" << fixed << setprecision(1) << liveBytes / 1e6 << " MB of stored data)";
+        cout << endl;
+        for (const auto& r : dropped) cout << "  remove #" << r.seq << " " << catalogName(r) << endl;
+        if (dryRun) {
+            cout << "Dry run, nothing removed." << endl;
+            ok = true;
+            stats.addTime(RunStats::Total, chrono::steady_clock::now() - runStart);
+            saveRunStats(ok);
+            return;
+        }
+
+        // the backups committed since the mark, walked at the start of every exclusive step
+        auto markNewer = [&]() {
+            Catalog catalog;
+            for (size_t i = catalog.count; i-- > 0;) {
+                CatalogRecord r = catalog.at(i);
+                if (r.seq <= markedSeq) break;
+                collectSnapshotObjects(fs::path(".backup") / catalogName(r), live, true);
+            }
+            if (catalog.count > 0) markedSeq = max(markedSeq, catalog.last().seq);
+        };
+
+        fs::path trash = fs::path(".backup") / "__trash__";
+        {
+            StoreLock storeLock(true);
+            markNewer();
+            set<uint64_t> droppedSeqs;
+            for (const auto& r : dropped) droppedSeqs.insert(r.seq);
+            vector<CatalogRecord> remaining;
+            set<string> cataloged;
+            {
+                Catalog catalog;
+                for (size_t i = 0; i < catalog.count; ++i) {
+                    CatalogRecord r = catalog.at(i);
+                    if (droppedSeqs.count(r.seq)) continue;
+                    remaining.push_back(r);
+                    cataloged.insert(catalogName(r));
+                }
+            }
+            writeCatalog(remaining);
+            // dropped folders, and folders that never made it into the catalog (a backup that crashed, or a
+            // prune that stopped after the catalog step) - no backup is running while the lock is held
+            fs::create_directories(trash);
+            for (const auto& folder : listBackups()) {
+                if (cataloged.count(folder.filename().string())) continue;
+                fs::rename(folder, trash / folder.filename());
+                stats.add(RunStats::SnapshotsPruned);
+            }
+            error_code ec;
+            fs::remove(HASH_CACHE_FILE, ec);
+        }
+        fs::remove_all(trash);
+        logAction("Pruned " + to_string(stats.counters[RunStats::SnapshotsPruned].load()) + " backups");
+
+        // sweep loose objects
+        vector<fs::path> deadLoose;
+        if (fs::exists(OBJECTS_DIR)) {
+            for (const auto& prefix : fs::directory_iterator(OBJECTS_DIR)) {
+                if (!prefix.is_directory() || prefix.path().filename() == "tmp") continue;
+                for (const auto& object : fs::directory_iterator(prefix.path())) {
+                    string id = prefix.path().filename().string() + object.path().filename().string();
+                    if (!live.ids.count(id)) deadLoose.push_back(object.path());
+                }
+            }
+        }
+        for (size_t start = 0; start < deadLoose.size(); start += PRUNE_BATCH) {
+            StoreLock storeLock(true);
+            markNewer();
+            for (size_t i = start; i < min(deadLoose.size(), start + PRUNE_BATCH); ++i) {
+                const fs::path& object = deadLoose[i];
+                if (live.ids.count(object.parent_path().filename().string() + object.filename().string())) continue;
+                error_code ec;
+                uint64_t size = fs::file_size(object, ec);
+                if (fs::remove(object, ec)) {
+                    stats.add(RunStats::ObjectsDeleted);
+                    stats.add(RunStats::BytesFreed, size);
+                }
+            }
+        }
+
+        // sweep packs: dead ones are deleted; mostly dead ones and small ones (one per backup that only packed its
+        // small files) are merged, their live objects copied into new packs of up to PRUNE_MERGE_SIZE
+        vector<fs::path> packIndexes;
+        if (fs::exists(PACKS_DIR)) {
+            for (const auto& entry : fs::directory_iterator(PACKS_DIR)) {
+                if (entry.path().extension() == ".idx") packIndexes.push_back(entry.path());
+            }
+        }
+        sort(packIndexes.begin(), packIndexes.end());
+        size_t packsDeleted = 0, packsRewritten = 0, packsWritten = 0;
+        struct MergeCandidate {
+            fs::path idx;
+            uint64_t liveSize;
+            bool mostlyDead;
+        };
+        vector<MergeCandidate> candidates;
+        for (const auto& idx : packIndexes) {
+            StoreLock storeLock(true);
+            markNewer();
+            uint64_t liveSize = 0, deadSize = 0, deadCount = 0;
+            fs::path dataPath;
+            {
+                PackIndex pack(idx);
+                dataPath = pack.dataPath;
+                for (uint64_t i = 0; i < pack.count; ++i) {
+                    uint64_t offset, length;
+                    string id = pack.entry(i, offset, length);
+                    if (live.ids.count(id)) {
+                        liveSize += length;
+                    } else {
+                        deadSize += length;
+                        ++deadCount;
+                    }
+                }
+            }
+            bool mostlyDead = deadCount > 0 && deadSize >= PRUNE_REPACK_DEAD_SHARE * (liveSize + deadSize);
+            if (liveSize > 0) {
+                if (mostlyDead || liveSize + deadSize < PRUNE_SMALL_PACK) candidates.push_back({idx, liveSize, mostlyDead});
+                continue;
+            }
+            packStore().reset();  // unmap it everywhere before it is deleted
+            removePack(idx);
+            ++packsDeleted;
+            stats.add(RunStats::ObjectsDeleted, deadCount);
+            stats.add(RunStats::BytesFreed, deadSize);
+        }
+        for (size_t start = 0; start < candidates.size();) {
+            size_t end = start;
+            uint64_t groupSize = 0;
+            bool worthIt = false;
+            while (end < candidates.size() && (end == start || groupSize + candidates[end].liveSize <= PRUNE_MERGE_SIZE)) {
+                groupSize += candidates[end].liveSize;
+                worthIt = worthIt || candidates[end].mostlyDead;
+                ++end;
+            }
+            worthIt = worthIt || end - start > 1;  // a single small pack with nothing dead stays as it is
+            if (worthIt) {
+                // the merged pack is published before the old ones go, so the live objects are always reachable;
+                // what is live is decided again under this lock, a backup may have deduplicated against them
+                StoreLock storeLock(true);
+                markNewer();
+                vector<unique_ptr<PackIndex>> group;
+                PackWriter merged(candidates[start].idx.stem().string());
+                uint64_t deadSize = 0, deadCount = 0;
+                for (size_t i = start; i < end; ++i) {
+                    group.push_back(make_unique<PackIndex>(candidates[i].idx));
+                    const PackIndex& pack = *group.back();
+                    for (uint64_t k = 0; k < pack.count; ++k) {
+                        uint64_t offset, length;
+                        string id = pack.entry(k, offset, length);
+                        if (live.ids.count(id)) {
+                            string data = pack.read(offset, length);
+                            merged.add(id, data.data(), data.size());
+                        } else {
+                            deadSize += length;
+                            ++deadCount;
+                        }
+                    }
+                }
+                merged.commit();
+                ++packsWritten;
+                packsRewritten += end - start;
+                packStore().reset();
+                for (auto& pack : group) {
+                    fs::path idx = fs::path(pack->dataPath).replace_extension(".idx");
+                    pack.reset();
+                    removePack(idx);
+                }
+                stats.add(RunStats::ObjectsDeleted, deadCount);
+                stats.add(RunStats::BytesFreed, deadSize);
+            }
+            start = end;
+        }
+        packStore().reset();
+        {
+            StoreLock storeLock(true);
+            stats.add(RunStats::BytesFreed, sweepPackLeftovers());
+        }
+
+        cout << "Removed " << stats.counters[RunStats::SnapshotsPruned] << " backups, deleted "
+             << stats.counters[RunStats::ObjectsDeleted] << " unused objects (" << packsDeleted << " packs deleted, "
+             << packsRewritten << " merged into " << packsWritten << "), " << fixed << setprecision(1)
+             << stats.counters[RunStats::BytesFreed] / 1e6 << " MB freed" << endl;
+        logAction("Prune freed " + to_string(stats.counters[RunStats::BytesFreed].load()) + " bytes in " +
+                  to_string(stats.counters[RunStats::ObjectsDeleted].load()) + " objects");
+        ok = true;
+    } catch (const exception& e) {
+        cerr << "Error pruning: " << e.what() << endl;
+        logAction(string("ERROR: ") + e.what());
+    }
+    stats.addTime(RunStats::Total, chrono::steady_clock::now() - runStart);
+    saveRunStats(ok);
+}
+
+//* function to fill a buffer with reproducible pseudo-random bytes (xorshift)
+void fillRandom(uint8_t* data, size_t len, uint64_t seed) {
+    uint64_t x = seed | 1;
+    for (size_t i = 0; i < len; ++i) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        data[i] = uint8_t(x >> 32);
+    }
+}
+
+//* function to cut a whole buffer into chunks, returns the chunk lengths
+vector<size_t> chunkBuffer(const CdcChunker& chunker, const vector<uint8_t>& data) {
+    vector<size_t> lengths;
+    size_t pos = 0;
+    while (pos < data.size()) {
+        size_t len = chunker.cut(data.data() + pos, data.size() - pos, pos);
+        lengths.push_back(len);
+        pos += len;
+    }
+    return lengths;
+}
+
+//* function to benchmark content-defined chunking: throughput and dedup ratio after typical edits
+void runChunkBenchmark(const vector<string>& args) {
+    ChunkParams params = loadChunkParams(readBackupConfig());
+    params.minSize = static_cast<uint32_t>(argNumber(args, "--min", params.minSize));
+    params.avgSize = static_cast<uint32_t>(argNumber(args, "--avg", params.avgSize));
+    params.maxSize = static_cast<uint32_t>(argNumber(args, "--max", params.maxSize));
+    size_t sizeMb = static_cast<size_t>(argNumber(args, "--size", 256));
+    if (params.minSize < 64 || params.minSize > params.avgSize || params.avgSize > params.maxSize) {
+        throw runtime_error("Invalid chunk sizes (need 64 <= --min <= --avg <= --max)");
+    }
+
+    vector<uint8_t> base(sizeMb << 20);
+    fillRandom(base.data(), base.size(), 42);
+    cout << "Chunking benchmark: " << sizeMb << " MiB, min " << params.minSize << " / avg " << params.avgSize
+         << " / max " << params.maxSize << endl;
+
+    vector<size_t> reference;
+    for (bool simd : {false, true}) {
+        CdcChunker chunker(params, simd);
+        if (simd && !chunker.vectorized) {
+            cout << "  avx2:   not supported on this CPU" << endl;
+            continue;
+        }
+        auto start = chrono::steady_clock::now();
+        vector<size_t> lengths = chunkBuffer(chunker, base);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << "  " << (simd ? "avx2:  " : "scalar:") << " " << fixed << setprecision(2)
+             << (base.size() / 1e9) / seconds << " GB/s, " << lengths.size() << " chunks, avg "
+             << base.size() / lengths.size() << " bytes";
+        if (simd) cout << (lengths == reference ? " (same cut points)" : " (CUT POINTS DIFFER!)");
+        cout << endl;
+        if (!simd) reference = lengths;
+    }
+
+    // hash the chunks of the original, then count how many bytes each edited version adds
+    CdcChunker chunker(params);
+    set<string> stored;
+    size_t pos = 0;
+    for (size_t len : reference) {
+        stored.insert(hashBytes(base.data() + pos, len));
+        pos += len;
+    }
+    struct Edit { string name; function<void(vector<uint8_t>&)> apply; };
+    vector<Edit> edits = {
+        {"insert 4 KiB in the middle", [](vector<uint8_t>& d) {
+            vector<uint8_t> ins(4096); fillRandom(ins.data(), ins.size(), 7);
+            d.insert(d.begin() + d.size() / 2, ins.begin(), ins.end()); }},
+        {"overwrite 16 x 512 bytes", [](vector<uint8_t>& d) {
+            for (size_t k = 1; k <= 16; ++k) fillRandom(d.data() + d.size() / 17 * k, 512, 100 + k); }},
+        {"delete 1 KiB at 1/3", [](vector<uint8_t>& d) {
+            d.erase(d.begin() + d.size() / 3, d.begin() + d.size() / 3 + 1024); }},
+        {"append 1 MiB", [](vector<uint8_t>& d) {
+            size_t old = d.size(); d.resize(old + (1 << 20)); fillRandom(d.data() + old, 1 << 20, 9); }},
+    };
+    for (const auto& edit : edits) {
+        vector<uint8_t> edited = base;
+        edit.apply(edited);
+        size_t newChunks = 0;
+        uint64_t newBytes = 0;
+        pos = 0;
+        for (size_t len : chunkBuffer(chunker, edited)) {
+            if (!stored.count(hashBytes(edited.data() + pos, len))) {
+                ++newChunks;
+                newBytes += len;
+            }
+            pos += len;
+        }
+        double ratio = double(base.size() + edited.size()) / double(base.size() + newBytes);
+        cout << "  " << left << setw(28) << edit.name << right << newChunks << " new chunks, " << newBytes
+             << " new bytes, dedup ratio " << setprecision(3) << ratio << "x" << endl;
+    }
+}
+
+//* function to create a benchmark tree of `files` small files spread over nested folders
+//* (`distinct` starts every file with its number so no two files deduplicate)
+void generateBenchTree(const fs::path& root, size_t files, size_t filesPerFolder, size_t fileSize, bool distinct = false) {
+    fs::create_directories(root);
+    vector<char> content(fileSize, 'x');
+    for (size_t i = 0; i < files; ++i) {
+        size_t folder = i / filesPerFolder;
+        fs::path dir = root / ("d" + to_string(folder / 100)) / ("s" + to_string(folder % 100));
+        if (i % filesPerFolder == 0) fs::create_directories(dir);
+        if (distinct) {
+            string number = to_string(i) + "\n";
+            copy_n(number.begin(), min(number.size(), content.size()), content.begin());
+        }
+        ofstream out(dir / ("f" + to_string(i) + ".txt"), ios::binary);
+        out.write(content.data(), static_cast<streamsize>(content.size()));
+    }
+}
+
+//* function to benchmark the tree scanner against a plain std::filesystem walk
+void runScanBenchmark(const vector<string>& args) {
+    size_t files = static_cast<size_t>(argNumber(args, "--files", 200000));
+    unsigned jobs = static_cast<unsigned>(argNumber(args, "--jobs", defaultJobs()));
+    fs::path root = argValue(args, "--dir", (fs::temp_directory_path() / "backup-bench-scan").string());
+    bool generated = !fs::exists(root);
+    if (generated) {
+        cout << "Generating " << files << " files in " << root.string() << " ..." << endl;
+        generateBenchTree(root, files, 50, 64);
+    }
+
+    auto report = [](const string& name, size_t entries, double seconds) {
+        cout << "  " << left << setw(26) << name << right << setw(10) << entries << " entries, "
+             << fixed << setprecision(0) << setw(10) << entries / seconds << " entries/sec" << endl;
+    };
+    cout << "Scan benchmark on " << root.string() << " (warm cache)" << endl;
+
+    auto start = chrono::steady_clock::now();
+    size_t count = 0;
+    uint64_t bytes = 0;
+    for (const auto& entry : fs::recursive_directory_iterator(root)) {
+        fs::file_status st = entry.status();
+        if (fs::is_regular_file(st)) {
+            bytes += entry.file_size();
+            (void)entry.last_write_time();
+        }
+        ++count;
+    }
+    report("std::filesystem walk", count, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+
+    ScanFilter none = [](const string&, bool) { return false; };
+    for (unsigned j : {1u, jobs}) {
+        start = chrono::steady_clock::now();
+        ScanList list = scanTree(root, j, none);
+        report("scanner, " + to_string(j) + " thread(s)", list.records.size(),
+               chrono::duration<double>(chrono::steady_clock::now() - start).count());
+        if (j == jobs) break;
+    }
+    if (generated && !hasArg(args, "--keep")) fs::remove_all(root);
+}
+
+//* function to benchmark the .backupignore matcher: millions of paths against a few hundred patterns
+void runIgnoreBenchmark(const vector<string>& args) {
+    size_t pathCount = static_cast<size_t>(argNumber(args, "--paths", 2000000));
+    size_t patternCount = static_cast<size_t>(argNumber(args, "--patterns", 300));
+
+    // a mix like real ignore files: plain names, extensions, folders, anchored paths and globs
+    uint64_t x = 0x9E3779B97F4A7C15ULL;
+    auto next = [&x]() {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        return x;
+    };
+    IgnoreMatcher matcher;
+    for (size_t i = 0; i < patternCount; ++i) {
+        string n = to_string(i);
+        switch (i % 6) {
+            case 0: matcher.add("name" + n); break;
+            case 1: matcher.add("*.ext" + n); break;
+            case 2: matcher.add("folder" + n + "/"); break;
+            case 3: matcher.add("/top" + n + "/sub/*.tmp"); break;
+            case 4: matcher.add("**/cache" + n + "/**"); break;
+            default: matcher.add((i % 12 == 5 ? "!" : "") + string("file") + n + "-[0-9]?.dat"); break;
+        }
+    }
+    vector<string> paths;
+    paths.reserve(pathCount);
+    for (size_t i = 0; i < pathCount; ++i) {
+        string p;
+        size_t depth = 1 + next() % 6;
+        for (size_t d = 0; d < depth; ++d) {
+            uint64_t r = next();
+            size_t n = r % (patternCount * 4);
+            switch ((r >> 32) % 5) {
+                case 0: p += "name" + to_string(n); break;
+                case 1: p += "src" + to_string(n % 50); break;
+                case 2: p += "top" + to_string(n); break;
+                case 3: p += "cache" + to_string(n); break;
+                default: p += "folder" + to_string(n); break;
+            }
+            p += '/';
+        }
+        uint64_t r = next();
+        switch (r % 4) {
+            case 0: p += "file" + to_string(r % (patternCount * 2)) + "-" + to_string(r % 10) + "x.dat"; break;
+            case 1: p += "main.ext" + to_string(r % (patternCount * 2)); break;
+            case 2: p += "x.tmp"; break;
+            default: p += "name" + to_string(r % (patternCount * 2)); break;
+        }
+        paths.push_back(move(p));
+    }
+    cout << "Ignore benchmark: " << paths.size() << " paths, " << matcher.rules.size() << " patterns ("
+         << matcher.byName.size() << " names, " << matcher.bySuffix.size() << " suffixes, "
+         << matcher.byFirstSegment.size() + matcher.bySegment.size() + matcher.byPrefix.size() << " indexed globs, "
+         << matcher.globs.size() << " other globs)" << endl;
+
+    // reference: every rule tried in order on every path, like a list of patterns without compilation
+    auto naive = [&matcher](const string& path, bool isDir) {
+        size_t slash = path.rfind('/');
+        string_view name = slash == string::npos ? string_view(path) : string_view(path).substr(slash + 1);
+        vector<string_view> parts;
+        string_view rest = path;
+        while (true) {
+            size_t s = rest.find('/');
+            parts.push_back(rest.substr(0, s));
+            if (s == string_view::npos) break;
+            rest.remove_prefix(s + 1);
+        }
+        bool result = false;
+        for (const IgnoreRule& rule : matcher.rules) {
+            if (rule.dirOnly && !isDir) continue;
+            bool hit = rule.anchored ? matchIgnoreSegments(rule, parts) : matchIgnoreSegment(rule, rule.segments[0].tokens, name);
+            if (hit) result = !rule.negate;
+        }
+        return result;
+    };
+
+    size_t ignored[2] = {0, 0};
+    double seconds[2] = {0, 0};
+    size_t mismatches = 0;
+    for (int pass = 0; pass < 2; ++pass) {
+        auto start = chrono::steady_clock::now();
+        for (size_t i = 0; i < paths.size(); ++i) {
+            bool isDir = i % 8 == 0;
+            bool hit = pass == 0 ? matcher.ignored(paths[i], isDir) : naive(paths[i], isDir);
+            ignored[pass] += hit;
+        }
+        seconds[pass] = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+    for (size_t i = 0; i < paths.size() && i < 200000; ++i) {
+        if (matcher.ignored(paths[i], i % 8 == 0) != naive(paths[i], i % 8 == 0)) ++mismatches;
+    }
+    const char* names[2] = {"compiled matcher", "pattern-by-pattern"};
+    for (int pass = 0; pass < 2; ++pass) {
+        cout << "  " << left << setw(20) << names[pass] << right << fixed << setprecision(0) << setw(12)
+             << paths.size() / seconds[pass] << " paths/sec, " << ignored[pass] << " ignored" << endl;
+    }
+    cout << "  " << (mismatches == 0 ? "results agree" : to_string(mismatches) + " RESULTS DIFFER!") << endl;
+}
+
+//* function to benchmark object compression: text-like and random data cut into chunks, compressed by
+//* `--jobs` threads like the backup workers do, then decompressed and compared
+void runCompressBenchmark(const vector<string>& args) {
+    size_t sizeMb = static_cast<size_t>(argNumber(args, "--size", 64));
+    unsigned jobs = static_cast<unsigned>(argNumber(args, "--jobs", defaultJobs()));
+    const size_t chunkSize = 256 << 10;
+
+    // source-code-like text: words from a small vocabulary, indentation and line breaks
+    static const char* words[] = {"int", "return", "const", "string", "if", "for", "while", "auto", "size_t", "vector",
+                                  "result", "data", "len", "offset", "path", "=", "+", "(", ")", "{", "}", ";", "0", "1"};
+    string text;
+    text.reserve(sizeMb << 20);
+    uint64_t x = 12345;
+    while (text.size() < (sizeMb << 20)) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        text += words[x % 24];
+        text += (x >> 40) % 9 == 0 ? "\n    " : " ";
+    }
+    text.resize(sizeMb << 20);
+    vector<uint8_t> noise(sizeMb << 20);
+    fillRandom(noise.data(), noise.size(), 99);
+
+    cout << "Compression benchmark: " << sizeMb << " MiB per input, " << (chunkSize >> 10) << " KiB chunks, "
+         << jobs << " threads" << endl;
+    struct Input { string name; const uint8_t* data; };
+    vector<Input> inputs = {{"text", reinterpret_cast<const uint8_t*>(text.data())}, {"random", noise.data()}};
+    size_t total = sizeMb << 20, chunks = (total + chunkSize - 1) / chunkSize;
+    for (const auto& input : inputs) {
+        for (Compression level : {Compression::Fast, Compression::High}) {
+            vector<string> encoded(chunks);
+            atomic<size_t> nextChunk{0};
+            auto start = chrono::steady_clock::now();
+            vector<thread> pool;
+            for (unsigned t = 0; t < jobs; ++t) {
+                pool.emplace_back([&] {
+                    for (size_t c; (c = nextChunk++) < chunks;) {
+                        size_t len = min(chunkSize, total - c * chunkSize);
+                        encoded[c] = encodeObject(input.data + c * chunkSize, len, level);
+                    }
+                });
+            }
+            for (auto& t : pool) t.join();
+            double compressSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+            uint64_t stored = 0, decoded = 0;
+            size_t raw = 0, mismatches = 0;
+            start = chrono::steady_clock::now();
+            for (size_t c = 0; c < chunks; ++c) {
+                size_t len = min(chunkSize, total - c * chunkSize);
+                if (encoded[c].empty()) {
+                    ++raw;  // skipped by the entropy probe or did not shrink
+                    stored += len;
+                    continue;
+                }
+                stored += encoded[c].size();
+                decoded += len;
+                string back = decodeObject(move(encoded[c]));
+                if (back.size() != len || memcmp(back.data(), input.data + c * chunkSize, len) != 0) ++mismatches;
+            }
+            double decompressSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            cout << "  " << left << setw(7) << input.name << setw(5) << compressionName(level) << right << fixed
+                 << setprecision(0) << setw(7) << total / compressSeconds / 1e6 << " MB/s compress, " << setw(6)
+                 << decoded / decompressSeconds / 1e6 << " MB/s decompress, ratio " << setprecision(2)
+                 << double(total) / double(stored) << "x, " << raw << "/" << chunks << " chunks stored raw"
+                 << (mismatches ? ", " + to_string(mismatches) + " ROUND TRIPS FAILED!" : "") << endl;
+        }
+    }
+}
+
+//* function to benchmark BLAKE3 on every code path the CPU has; the vector paths must give the same
+//* ids as the scalar one, which is checked on the benchmark buffer and on lengths around chunk borders
+void runHashBenchmark(const vector<string>& args) {
+    size_t sizeMb = static_cast<size_t>(argNumber(args, "--size", 256));
+    vector<uint8_t> data(sizeMb << 20);
+    fillRandom(data.data(), data.size(), 42);
+    HashPath best = hashPath();
+    vector<HashPath> paths = {HashPath::Scalar};
+    if (cpuFeatures().sse41) paths.push_back(HashPath::Sse41);
+    if (cpuFeatures().avx2) paths.push_back(HashPath::Avx2);
+    cout << "Hash benchmark: BLAKE3 over " << sizeMb << " MB (default path: " << hashPathName(best) << ")" << endl;
+    string reference;
+    vector<string> referenceShort;
+    for (HashPath path : paths) {
+        hashPath() = path;
+        auto start = chrono::steady_clock::now();
+        string id = hashBytes(data.data(), data.size());
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        size_t mismatches = 0;
+        vector<string> shortIds;
+        for (size_t chunks = 0; chunks <= 20; ++chunks) {
+            for (long delta : {-1L, 0L, 1L, 65L}) {
+                long len = long(chunks * BLAKE3_CHUNK_LEN) + delta;
+                if (len >= 0) shortIds.push_back(hashBytes(data.data(), size_t(len)));
+            }
+        }
+        if (path == HashPath::Scalar) {
+            reference = id;
+            referenceShort = shortIds;
+        } else {
+            mismatches = (id != reference) + (shortIds != referenceShort);
+        }
+        cout << "  " << left << setw(8) << hashPathName(path) << right << fixed << setprecision(0) << setw(7)
+             << data.size() / seconds / 1e6 << " MB/s" << (mismatches ? "  IDS DIFFER FROM SCALAR!" : "") << endl;
+    }
+    hashPath() = best;
+}
+
+//* function to benchmark snapshot diffs: trees of two synthetic snapshots (`--files` files in folders of
+//* 50, `--changes` files edited in between) are built in memory, then diffed through the tree and, for
+//* comparison, by a full walk over both sorted entry lists
+void runDiffBenchmark(const vector<string>& args) {
+    size_t files = static_cast<size_t>(argNumber(args, "--files", 1000000));
+    size_t changes = static_cast<size_t>(argNumber(args, "--changes", 10));
+    vector<ManifestEntry> before;
+    before.reserve(files + files / 50 + 200);
+    set<string> folders;
+    for (size_t i = 0; i < files; ++i) {
+        size_t folder = i / 50;
+        string dir = "d" + to_string(folder / 100) + "/s" + to_string(folder % 100);
+        if (folders.insert(dir).second) {
+            if (folder % 100 == 0) before.push_back({'d', 0, 0, 0755, "-", "-", "", "d" + to_string(folder / 100)});
+            before.push_back({'d', 0, 0, 0755, "-", "-", "", dir});
+        }
+        before.push_back({'f', 64, 1700000000000000000LL, 0644, hashBytes(&i, sizeof(i)), "-", "", dir + "/f" + to_string(i)});
+    }
+    vector<ManifestEntry> after = before;
+    uint64_t x = 88172645463325252ULL;
+    for (size_t c = 0; c < changes; ++c) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        ManifestEntry& e = after[x % after.size()];
+        if (e.type == 'f') e.id = hashBytes(&x, sizeof(x));
+    }
+    cout << "Diff benchmark: " << files << " files, " << folders.size() << " folders, up to " << changes << " changed" << endl;
+
+    TreeStore store;
+    auto keep = [&store](const string& id, const string& node) { store.built.emplace(id, node); };
+    auto start = chrono::steady_clock::now();
+    string a = buildSnapshotTree(before, keep);
+    double buildMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    string b = buildSnapshotTree(after, keep);
+    cout << fixed << setprecision(2) << "  build tree (" << store.built.size() << " nodes for both): " << buildMs << " ms per snapshot" << endl;
+
+    start = chrono::steady_clock::now();
+    vector<DiffEntry> out;
+    diffTrees(store, a, b, "", out);
+    double treeMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    cout << "  tree diff:   " << setw(10) << treeMs << " ms, " << out.size() << " modified" << endl;
+
+    start = chrono::steady_clock::now();
+    size_t walked = 0;
+    for (size_t i = 0; i < before.size(); ++i) walked += before[i].path != after[i].path || before[i].id != after[i].id;
+    double walkMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    cout << "  full walk:   " << setw(10) << walkMs << " ms, " << walked << " modified (entries already in memory)" << endl;
+}
+
+//* function to count the files in a folder tree (store files of the small-file benchmark)
+size_t countFiles(const fs::path& root) {
+    size_t count = 0;
+    if (!fs::exists(root)) return 0;
+    for (const auto& entry : fs::recursive_directory_iterator(root)) count += entry.is_regular_file();
+    return count;
+}
+
+//* function to create the folder of a benchmark that backs up, deletes and restores its own tree: it is
+//* always generated fresh, an existing --dir with anything in it (a real project, its .backup) is refused
+fs::path createBenchDir(const vector<string>& args, const string& name) {
+    fs::path root = fs::absolute(argValue(args, "--dir", (fs::temp_directory_path() / name).string()));
+    error_code ec;
+    if (fs::exists(root) && !fs::is_empty(root, ec)) {
+        throw runtime_error("--dir " + root.string() + " is not empty; this benchmark deletes its tree, pick a new or empty folder");
+    }
+    fs::create_directories(root);
+    return root;
+}
+
+//* function to benchmark small-file packing: backup and restore of a tree of tiny files with every file
+//* as its own loose object versus the small files packed into one segment per backup
+void runSmallFileBenchmark(const vector<string>& args) {
+    size_t files = static_cast<size_t>(argNumber(args, "--files", 500000));
+    size_t fileSize = static_cast<size_t>(argNumber(args, "--size", 1024));
+    BackupOptions options;
+    options.jobs = static_cast<unsigned>(argNumber(args, "--jobs", options.jobs));
+    uint64_t threshold = argNumber(args, "--small-file-size", max<uint64_t>(options.smallFileSize, fileSize));
+    fs::path root = createBenchDir(args, "backup-bench-small");
+    cout << "Generating " << files << " files of " << fileSize << " bytes in " << root.string() << " ..." << endl;
+    generateBenchTree(root, files, 50, fileSize, true);
+
+    fs::path previous = fs::current_path();
+    fs::current_path(root);
+    try {
+        cout << "Small-file benchmark on " << root.string() << " (" << options.jobs << " jobs)" << endl;
+        vector<string> report;
+        for (uint64_t limit : {uint64_t(0), threshold}) {
+            // a fresh store per run; per-file log lines would dominate the timing, so only errors are logged
+            fs::remove_all(".backup");
+            fs::create_directories(".backup");
+            ofstream(".backup/__init__") << "init: True\nlog-level: errors\n";
+            options.smallFileSize = limit;
+
+            auto start = chrono::steady_clock::now();
+            createBackup(options);
+            double backupSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            fs::path backup = latestSnapshot();
+            if (backup.empty()) throw runtime_error("Benchmark backup failed");
+            size_t storeFiles = countFiles(OBJECTS_DIR) + countFiles(PACKS_DIR);
+            // restore into an empty tree, like a fresh checkout
+            for (const auto& entry : fs::directory_iterator(".")) {
+                if (entry.path().filename() != ".backup") fs::remove_all(entry.path());
+            }
+            start = chrono::steady_clock::now();
+            restoreBackup(backup);
+            double restoreSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+            ostringstream line;
+            line << "  " << left << setw(24) << (limit ? "packed (<= " + to_string(limit) + " B)" : "loose objects") << right
+                 << fixed << setprecision(0) << setw(10) << files / backupSeconds << " files/sec backup, " << setw(10)
+                 << files / restoreSeconds << " files/sec restore, " << storeFiles << " files in the store";
+            report.push_back(line.str());
+        }
+        fs::remove_all(".backup");
+        for (const auto& line : report) cout << line << endl;
+    } catch (...) {
+        fs::current_path(previous);
+        throw;
+    }
+    fs::current_path(previous);
+    if (!hasArg(args, "--keep")) fs::remove_all(root);
+}
+
+//* function to benchmark the I/O backends: backup and restore of a tree of small files (packed store)
+//* with --io=sync, threads and uring
+void runIoBenchmark(const vector<string>& args) {
+    size_t files = static_cast<size_t>(argNumber(args, "--files", 100000));
+    size_t fileSize = static_cast<size_t>(argNumber(args, "--size", 4096));
+    unsigned jobs = static_cast<unsigned>(argNumber(args, "--jobs", defaultJobs()));
+    fs::path root = createBenchDir(args, "backup-bench-io");
+    cout << "Generating " << files << " files of " << fileSize << " bytes in " << root.string() << " ..." << endl;
+    generateBenchTree(root, files, 50, fileSize, true);
+
+    fs::path previous = fs::current_path();
+    fs::current_path(root);
+    try {
+        cout << "I/O backend benchmark on " << root.string() << " (" << jobs << " jobs)" << endl;
+        vector<string> report;
+        for (IoBackend io : {IoBackend::Sync, IoBackend::Threads, IoBackend::Uring}) {
+            // a fresh store per run; per-file log lines would dominate the timing, so only errors are logged
+            fs::remove_all(".backup");
+            fs::create_directories(".backup");
+            ofstream(".backup/__init__") << "init: True\nlog-level: errors\n";
+            BackupOptions options;
+            options.jobs = io == IoBackend::Sync ? 1 : jobs;
+            options.packed = true;
+            options.io = io;
+            RestoreOptions restore;
+            restore.jobs = options.jobs;
+            restore.io = io;
+
+            auto start = chrono::steady_clock::now();
+            createBackup(options);
+            double backupSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            fs::path backup = latestSnapshot();
+            if (backup.empty()) throw runtime_error("Benchmark backup failed");
+            // restore into an empty tree, like a fresh checkout
+            for (const auto& entry : fs::directory_iterator(".")) {
+                if (entry.path().filename() != ".backup") fs::remove_all(entry.path());
+            }
+            start = chrono::steady_clock::now();
+            restoreBackup(backup, restore);
+            double restoreSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+            ostringstream line;
+            line << "  " << left << setw(10) << ioBackendName(io) << right << fixed << setprecision(0) << setw(10)
+                 << files / backupSeconds << " files/sec backup, " << setw(10) << files / restoreSeconds
+                 << " files/sec restore";
+            report.push_back(line.str());
+        }
+        fs::remove_all(".backup");
+        for (const auto& line : report) cout << line << endl;
+    } catch (...) {
+        fs::current_path(previous);
+        throw;
+    }
+    fs::current_path(previous);
+    if (!hasArg(args, "--keep")) fs::remove_all(root);
+}
+
+//* function to show help menu
+void showHelp() {
+    cout << ".backup Commands:\n";
+    cout << "  backup init              -> Initialize backup system\n";
+    cout << "  backup do [--jobs N]     -> Create a new backup (N worker threads)\n";
+    cout << "      [--clone-mode=M]     -> auto | reflink | hardlink-unchanged | copy\n";
+    cout << "      [--store=S]          -> loose (one file per object) | pack (one pack file per backup)\n";
+    cout << "      [--small-file-size B] -> Pack files up to B bytes even in the loose store (0 = off)\n";
+    cout << "      [--compress=C]       -> off | fast (default) | high\n";
+    cout << "      [--stats [--json]]   -> Print counters and timings after the backup\n";
+    cout << "      [--ignore PATTERN]   -> Also ignore PATTERN (.backupignore syntax) in this backup\n";
+    cout << "      [--read-rate MB] [--write-rate MB] [--iops N] -> Cap I/O (also pull/verify)\n";
+    cout << "      [--throttle=adaptive] [--nice N] [--ioprio idle|0-7] -> Back off under I/O pressure, lower priority\n";
+    cout << "      [--io=B]             -> threads (default) | uring (io_uring for small files, Linux) | sync (also pull)\n";
+    cout << "  backup auto --min X      -> Auto backup every X minutes (in the daemon, --off to stop)\n";
+    cout << "  backup daemon            -> Run the backup daemon; do, pull, status, ... then go through it\n";
+    cout << "  backup daemon --stop     -> Stop the running daemon\n";
+    cout << "  backup status            -> Show the daemon's schedule, watched changes and the last backup\n";
+    cout << "  backup watch             -> Back up changed files as they change (--debounce MS)\n";
+    cout << "  backup schedule add      -> Schedule this folder (--every MIN [--priority N] [--ignore PATTERN]...)\n";
+    cout << "  backup schedule remove   -> Remove this folder from the schedule (list to show all, --dir D)\n";
+    cout << "  backup schedule run      -> Run the scheduler for all projects (--max-parallel N --jitter PCT)\n";
+    cout << "  backup schedule status   -> Show queue depth, lateness and durations of the scheduler (--json)\n";
+    cout << "  backup remove --all      -> Delete all backups\n";
+    cout << "  backup pull --last       -> Restore from the last backup (--stats to print stats)\n";
+    cout << "      [--jobs N] [--checksum] [-- PATHS]  -> N threads, hash unchanged-looking files, only PATHS\n";
+    cout << "  backup pull --id N       -> Restore backup N (see backup list)\n";
+    cout << "  backup pull --at TIME    -> Restore the last backup at or before TIME (YYYY-MM-DD[_HH-MM-SS])\n";
+    cout << "  backup list [--json]     -> List all backups with id, size and file count\n";
+    cout << "  backup locate PATH       -> Show a file of the last backup and where its data is (--in Backup_NAME)\n";
+    cout << "  backup diff A B          -> List added, removed and modified paths between backups (id or name)\n";
+    cout << "  backup diff --worktree   -> List changes of the working tree since the last backup (or A)\n";
+    cout << "  backup verify [--last]   -> Re-hash stored data of all (or the last) backups, report corruption\n";
+    cout << "      [--jobs N] [--rate MB] -> N threads, read at most MB per second\n";
+    cout << "  backup prune             -> Delete backups outside the retention policy and their unused data\n";
+    cout << "      [--keep-last N] [--keep-hourly N] [--keep-daily N] [--keep-weekly N] [--max-size SIZE] [--dry-run]\n";
+    cout << "  backup meta              -> Show backup meta information\n";
+    cout << "  backup stats [--json]    -> Show counters and timings of the last do/pull\n";
+    cout << "  backup logs              -> Show backup logs\n";
+    cout << "  backup logs --copy       -> Copy logs to current directory\n";
+    cout << "  backup bench chunk       -> Benchmark chunking (--size MB --min --avg --max)\n";
+    cout << "  backup bench scan        -> Benchmark the tree scanner (--files N --jobs N --dir D)\n";
+    cout << "  backup bench ignore      -> Benchmark .backupignore matching (--paths N --patterns N)\n";
+    cout << "  backup bench compress    -> Benchmark compression speed and ratio (--size MB --jobs N)\n";
+    cout << "  backup bench small       -> Benchmark small-file packing (--files N --size B --small-file-size B)\n";
+    cout << "  backup bench hash        -> Benchmark BLAKE3 on the scalar, SSE4.1 and AVX2 paths (--size MB)\n";
+    cout << "  backup bench diff        -> Benchmark snapshot diffs through the tree (--files N --changes N)\n";
+    cout << "  backup bench io          -> Benchmark --io=sync, threads and uring on small files (--files N --size B)\n";
+    cout << "  backup --version | --v   -> Show version\n";
+    cout << "  backup help              -> Show available commands\n";
+}
+
+void showBackupMeta() {
+    try {
+        ifstream metaFile(".backup/__init__");
+        if (!metaFile) {
+            cout << "No backup metadata found. Is the backup system initialized?" << endl;
+            return;
+        }
+        cout << "Backup Metadata:" << endl;
+        string line;
+        while (getline(metaFile, line)) {
+            cout << "  " << line << endl;
+        }
+    } catch (const exception& e) {
+        cerr << "Error reading backup metadata: " << e.what() << endl;
+    }
+}
+
+//* function to get the path of the running executable
+string getExecutablePath() {
+#ifdef _WIN32
+    char path[MAX_PATH];
+    GetModuleFileNameA(NULL, path, MAX_PATH);
+    return string(path);
+#else
+    char result[1024];
+    ssize_t count = readlink("/proc/self/exe", result, 1024);
+    return count != -1 ? string(result, count) : "";
+#endif
+}
+
+//* function to get the path to the running executable
+string getExecutableDir() {
+    string exePath = getExecutablePath();
+#ifdef _WIN32
+    size_t pos = exePath.find_last_of("/\\");
+#else
+    size_t pos = exePath.find_last_of("/");
+#endif
+    return (pos != string::npos) ? exePath.substr(0, pos) : "";
+}
+
+//* function to set the working directory to the executable's directory
+void setWorkingDirToExe() {
+    try {
+        string exeDir = getExecutableDir();
+        if (!exeDir.empty()) {
+            fs::current_path(exeDir);
+        }
+    } catch (const exception& e) {
+        cerr << "Error setting working directory: " << e.what() << endl;
+    }
+}
+
+//* asynchronous logger: callers push lines into a lock-free multi-producer ring (slot sequence numbers,
+//* no lock on the hot path), one background thread drains it every `log-flush-ms`, formats the
+//* timestamps (cached per second) and appends the batch to the log file it keeps open
+struct AsyncLogger {
+    struct Slot {
+        atomic<size_t> sequence{0};
+        time_t time = 0;
+        string text;
+    };
+    static constexpr size_t CAPACITY = 4096;  // power of two
+
+    unique_ptr<Slot[]> slots{new Slot[CAPACITY]};
+    atomic<size_t> head{0};   // next slot a producer claims
+    atomic<size_t> tail{0};   // next slot the flush thread reads, only written by it
+    atomic<bool> stopping{false};
+    atomic<size_t> flushTarget{0};
+    mutex wakeLock;
+    condition_variable wake, drained;
+    FILE* file = nullptr;
+    int level = LOG_FILES;
+    chrono::milliseconds interval{200};
+    time_t cachedSecond = -1;
+    char cachedStamp[32] = {0};
+    string batch;
+    thread flusher;
+
+    AsyncLogger() {
+        for (size_t i = 0; i < CAPACITY; ++i) slots[i].sequence.store(i, memory_order_relaxed);
+        try {
+            map<string, string> config = readBackupConfig();
+            string name = config.count("log-level") ? config["log-level"] : "files";
+            level = name == "errors" ? LOG_ERRORS : name == "info" ? LOG_INFO : LOG_FILES;
+            interval = chrono::milliseconds(max<uint64_t>(1, configNumber(config, "log-flush-ms", 200)));
+            string logDir = getLogDir();
+            fs::create_directories(logDir);
+            file = fopen((logDir + "/.backup-logs").c_str(), "a");
+        } catch (...) {
+            // logging must never stop a command, without a log file the lines are dropped
+        }
+        flusher = thread([this] { run(); });
+    }
+
+    ~AsyncLogger() {
+        stopping = true;
+        {
+            lock_guard<mutex> guard(wakeLock);
+            wake.notify_all();
+        }
+        flusher.join();
+        if (file) fclose(file);
+    }
+
+    void push(string&& text) {
+        size_t pos = head.load(memory_order_relaxed);
+        while (true) {
+            Slot& slot = slots[pos & (CAPACITY - 1)];
+            size_t seq = slot.sequence.load(memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    slot.time = time(nullptr);
+                    slot.text = move(text);
+                    slot.sequence.store(pos + 1, memory_order_release);
+                    // only wake the flush thread early when the ring is filling up
+                    if (pos - tail.load(memory_order_relaxed) == CAPACITY / 2) wake.notify_one();
+                    return;
+                }
+            } else if (diff < 0) {
+                wake.notify_one();  // ring is full: let the flush thread catch up
+                this_thread::yield();
+                pos = head.load(memory_order_relaxed);
+            } else {
+                pos = head.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    //* function to wait until everything logged so far is in the file
+    void flush() {
+        size_t target = head.load(memory_order_acquire);
+        unique_lock<mutex> lock(wakeLock);
+        if (flushTarget < target) flushTarget = target;
+        wake.notify_all();
+        drained.wait_for(lock, chrono::seconds(5), [&] { return tail.load() >= target; });
+    }
+
+    void drain() {
+        size_t pos = tail.load(memory_order_relaxed);
+        batch.clear();
+        while (true) {
+            Slot& slot = slots[pos & (CAPACITY - 1)];
+            if (slot.sequence.load(memory_order_acquire) != pos + 1) break;
+            if (slot.time != cachedSecond) {
+                tm localTime;
+#ifdef _WIN32
+                localtime_s(&localTime, &slot.time);
+#else
+                localtime_r(&slot.time, &localTime);
+#endif
+                strftime(cachedStamp, sizeof(cachedStamp), "%Y-%m-%d %H:%M:%S", &localTime);
+                cachedSecond = slot.time;
+            }
+            batch += '[';
+            batch += cachedStamp;
+            batch += "] ";
+            batch += slot.text;
+            batch += '\n';
+            string().swap(slot.text);
+            slot.sequence.store(pos + CAPACITY, memory_order_release);
+            ++pos;
+        }
+        if (file && !batch.empty()) {
+            fwrite(batch.data(), 1, batch.size(), file);
+            fflush(file);
+        }
+        tail.store(pos, memory_order_release);
+    }
+
+    void run() {
+        while (true) {
+            {
+                unique_lock<mutex> lock(wakeLock);
+                wake.wait_for(lock, interval, [&] { return stopping.load() || flushTarget > tail.load(); });
+            }
+            drain();
+            {
+                lock_guard<mutex> guard(wakeLock);
+                drained.notify_all();
+            }
+            if (stopping && tail.load() == head.load()) break;
+        }
+    }
+};
+
+AsyncLogger& logger() {
+    static AsyncLogger instance;  // destroyed at exit, which drains the ring one last time
+    return instance;
+}
+
+//* function to log to .backup-logs in logs/ folder in %LOCALAPPDATA%/backup-setup
+//* lines above the configured `log-level` are dropped, "ERROR" lines always count as errors
+void logAction(const string& entry, int level) {
+    if (entry.rfind("ERROR", 0) == 0) level = LOG_ERRORS;
+    AsyncLogger& log = logger();
+    if (level > log.level) return;
+    PhaseTimer timer(RunStats::Log);
+    runStats().add(RunStats::LogLines);
+    log.push(string(entry));
+}
+
+//* function to write out all pending log lines (before the log file is read)
+void flushLogs() {
+    logger().flush();
+}
+
+void executeCommand(const string& cmd);
+
+//* backup daemon: `backup daemon` (or `backup auto --min X`) keeps one process per project running that
+//* listens on the Unix socket `.backup/__daemon__.sock`. The CLI sends its command line there and prints
+//* the reply, and runs the command itself when no daemon answers (or with BACKUP_DAEMON=off). Between
+//* commands the daemon keeps its log file, the pack indexes and (Linux) an inotify watch of the tree, so a
+//* `backup do` only rescans the paths that changed since the daemon's previous snapshot. Commands run one
+//* at a time, scheduled backups run between them.
+//* Protocol: the client sends the command line and '\n'; every reply frame is a tag byte, a 32-bit
+//* little-endian length and the payload: 'o' standard output, 'e' standard error, 'x' end of the reply
+//* (payload: one byte, 1 if the command failed).
+const string DAEMON_SOCKET = ".backup/__daemon__.sock";
+const string DAEMON_PID_FILE = ".backup/__daemon__.pid";  // locked while a daemon runs, holds its pid
+const size_t DAEMON_MAX_REQUEST = 64 * 1024;
+
+//* function to format a duration as "2h 05m", "4m 10s" or "12s"
+string formatDuration(int64_t seconds) {
+    ostringstream out;
+    if (seconds >= 3600) out << seconds / 3600 << "h " << setw(2) << setfill('0') << seconds % 3600 / 60 << "m";
+    else if (seconds >= 60) out << seconds / 60 << "m " << setw(2) << setfill('0') << seconds % 60 << "s";
+    else out << seconds << "s";
+    return out.str();
+}
+
+//* function to print the newest backup of the catalog
+void printLastBackup() {
+    ensureCatalog();
+    Catalog catalog;
+    if (catalog.empty()) {
+        cout << "  last backup: none" << endl;
+        return;
+    }
+    CatalogRecord r = catalog.last();
+    cout << "  last backup: #" << r.seq << " " << catalogName(r) << " (" << r.files << " files, " << r.bytes << " bytes)"
+         << endl;
+}
+
+#ifndef _WIN32
+static volatile sig_atomic_t daemonStopRequested = 0;
+
+bool writeAll(int fd, const void* data, size_t len) {
+    const char* p = static_cast<const char*>(data);
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool readAll(int fd, void* data, size_t len) {
+    char* p = static_cast<char*>(data);
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+//* function to send one reply frame, false once the client is gone
+bool sendFrame(int fd, char tag, const char* data, size_t len) {
+    uint32_t n = static_cast<uint32_t>(len);
+    char header[5] = {tag, static_cast<char>(n), static_cast<char>(n >> 8), static_cast<char>(n >> 16),
+                      static_cast<char>(n >> 24)};
+    return writeAll(fd, header, sizeof(header)) && (len == 0 || writeAll(fd, data, len));
+}
+
+//* stream buffer that sends what a command prints to the client as frames of one tag
+//* workers of a command print errors from several threads, so there is no put area (sputc would write
+//* into it without a lock): every write goes through xsputn/overflow and is buffered under the mutex;
+//* the stdout and stderr buffers of one client share `sendLock` so their frames do not interleave
+struct FrameStreamBuf : streambuf {
+    static constexpr size_t FLUSH_AT = 16 * 1024;
+    int fd;
+    char tag;
+    mutex& sendLock;
+    mutex lock;
+    bool connected = true;  // a client that went away does not stop the command
+    string pending;
+
+    FrameStreamBuf(int socket, char frameTag, mutex& socketLock) : fd(socket), tag(frameTag), sendLock(socketLock) {}
+
+    void flushLocked() {
+        if (!pending.empty() && connected) {
+            lock_guard<mutex> guard(sendLock);
+            connected = sendFrame(fd, tag, pending.data(), pending.size());
+        }
+        pending.clear();
+    }
+
+    int sync() override {
+        lock_guard<mutex> guard(lock);
+        flushLocked();
+        return 0;
+    }
+
+    streamsize xsputn(const char* data, streamsize len) override {
+        lock_guard<mutex> guard(lock);
+        pending.append(data, static_cast<size_t>(len));
+        if (pending.size() >= FLUSH_AT) flushLocked();
+        return len;
+    }
+
+    int_type overflow(int_type c) override {
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            char ch = traits_type::to_char_type(c);
+            xsputn(&ch, 1);
+        }
+        return traits_type::not_eof(c);
+    }
+};
+
+//* function to connect to the project's daemon, -1 if none is running
+int connectDaemon() {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, DAEMON_SOCKET.c_str(), sizeof(addr.sun_path) - 1);
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+//* function to run a command line in the daemon and print its reply, false if no daemon is running
+bool forwardToDaemon(const string& cmd) {
+    const char* mode = getenv("BACKUP_DAEMON");
+    if (mode && string(mode) == "off") return false;
+    int fd = connectDaemon();
+    if (fd < 0) return false;
+    signal(SIGPIPE, SIG_IGN);
+    string request = cmd + "\n";
+    bool done = false;
+    if (writeAll(fd, request.data(), request.size())) {
+        unsigned char header[5];
+        string payload;
+        while (readAll(fd, header, sizeof(header))) {
+            uint32_t len = header[1] | header[2] << 8 | header[3] << 16 | static_cast<uint32_t>(header[4]) << 24;
+            payload.resize(len);
+            if (len > 0 && !readAll(fd, &payload[0], len)) break;
+            if (header[0] == 'x') {
+                done = true;
+                if (!payload.empty() && payload[0]) commandFailed = true;
+                break;
+            }
+            (header[0] == 'e' ? cerr : cout) << payload << flush;
+        }
+    }
+    close(fd);
+    if (!done) {
+        cerr << "Error: the backup daemon stopped before the command finished" << endl;
+        commandFailed = true;
+    }
+    return true;
+}
+
+struct BackupDaemon {
+    int pidFd = -1;
+    int listenFd = -1;
+    int minutes = 0;  // scheduled backups, 0 = none
+    chrono::steady_clock::time_point started = chrono::steady_clock::now(), nextRun;
+    uint64_t served = 0;
+#ifdef __linux__
+    unique_ptr<TreeWatcher> watcher;
+    uint64_t baseSeq = 0;  // catalog id of the daemon's last snapshot, the watcher's changes are relative to it
+#endif
+
+    ~BackupDaemon() {
+        if (listenFd >= 0) {
+            close(listenFd);
+            error_code ec;
+            fs::remove(DAEMON_SOCKET, ec);
+        }
+        if (pidFd >= 0) close(pidFd);  // releases the lock
+    }
+
+    //* function to take the daemon lock and open the socket, false if another daemon runs here
+    bool start() {
+        pidFd = open(DAEMON_PID_FILE.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (pidFd < 0) throw runtime_error("Failed to open " + DAEMON_PID_FILE + ": " + strerror(errno));
+        if (flock(pidFd, LOCK_EX | LOCK_NB) != 0) return false;
+        string pid = to_string(getpid()) + "\n";
+        if (ftruncate(pidFd, 0) != 0 || pwrite(pidFd, pid.data(), pid.size(), 0) != static_cast<ssize_t>(pid.size())) {
+            throw runtime_error("Failed to write " + DAEMON_PID_FILE + ": " + strerror(errno));
+        }
+
+        error_code ec;
+        fs::remove(DAEMON_SOCKET, ec);  // left behind by a daemon that was killed
+        listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listenFd < 0) throw runtime_error(string("Failed to create the daemon socket: ") + strerror(errno));
+        fcntl(listenFd, F_SETFD, FD_CLOEXEC);
+        struct sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, DAEMON_SOCKET.c_str(), sizeof(addr.sun_path) - 1);
+        if (::bind(listenFd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listenFd, 16) != 0) {
+            int err = errno;
+            close(listenFd);
+            listenFd = -1;
+            throw runtime_error("Failed to listen on " + DAEMON_SOCKET + ": " + strerror(err));
+        }
+        chmod(DAEMON_SOCKET.c_str(), 0600);  // only the owner may run commands
+
+#ifdef __linux__
+        // watches go up before the first snapshot, which always compares the whole tree
+        try {
+            watcher = make_unique<TreeWatcher>(defaultJobs());
+        } catch (const exception& e) {
+            cerr << "Not watching for changes, every backup scans the whole tree: " << e.what() << endl;
+            logAction(string("ERROR: ") + e.what());
+        }
+#endif
+        return true;
+    }
+
+    //* function to forget the loaded pack indexes when another process changed the packs
+#ifdef __linux__
+    void drainWatcher() {
+        try {
+            watcher->drain();
+        } catch (const exception& e) {
+            cerr << "Stopped watching for changes, every backup scans the whole tree: " << e.what() << endl;
+            logAction(string("ERROR: ") + e.what());
+            watcher.reset();
+        }
+    }
+
+    //* function to check that the watcher's changes cover everything since the newest snapshot
+    bool canRescanDirty() {
+        if (!watcher || watcher->rescan || baseSeq == 0) return false;
+        // the unchanged paths are taken over from the newest snapshot, so it must be the daemon's own: one
+        // by another process may have been taken with other --ignore patterns (and a pruned base is gone)
+        return lastCatalogSeq() == baseSeq;
+    }
+#endif
+
+    //* function to take a snapshot, only reading the changed paths when the watcher knows them
+    void snapshot(const BackupOptions& options) {
+#ifdef __linux__
+        if (watcher) drainWatcher();
+        // the watcher only knows the .backupignore rules, extra --ignore patterns need a full scan
+        bool incremental = options.cloneMode != CloneMode::Copy && options.ignore.empty() && canRescanDirty();
+        if (!incremental && watcher && watcher->rescan) {
+            try {
+                watcher = make_unique<TreeWatcher>(defaultJobs());
+            } catch (const exception& e) {
+                cerr << "Stopped watching for changes, every backup scans the whole tree: " << e.what() << endl;
+                logAction(string("ERROR: ") + e.what());
+                watcher.reset();
+            }
+        }
+        set<string> changed;
+        if (watcher) changed.swap(watcher->dirty);
+        uint64_t before = lastCatalogSeq();
+        if (incremental) {
+            cout << "Snapshot of " << changed.size() << " changed path(s)" << endl;
+            createBackup(options, &changed);
+        } else {
+            createBackup(options);
+        }
+        // a failed backup used up the changes, so the next one compares the whole tree again
+        uint64_t after = lastCatalogSeq();
+        baseSeq = after > before ? after : 0;
+#else
+        createBackup(options);
+#endif
+    }
+
+    void status() {
+        auto now = chrono::steady_clock::now();
+        cout << "Backup daemon running (pid " << getpid() << ", up "
+             << formatDuration(chrono::duration_cast<chrono::seconds>(now - started).count()) << ", " << served
+             << " commands served)" << endl;
+        if (minutes > 0) {
+            int64_t due = max<int64_t>(0, chrono::duration_cast<chrono::seconds>(nextRun - now).count());
+            cout << "  schedule: every " << minutes << " minutes, next backup in " << formatDuration(due) << endl;
+        } else {
+            cout << "  schedule: off (backup auto --min X)" << endl;
+        }
+#ifdef __linux__
+        if (watcher) drainWatcher();
+        if (canRescanDirty()) {
+            cout << "  watching " << watcher->folders.size() << " folders, " << watcher->dirty.size()
+                 << " changed path(s) since backup #" << baseSeq << endl;
+        } else if (watcher) {
+            cout << "  watching " << watcher->folders.size() << " folders, the next backup compares the whole tree" << endl;
+        } else {
+            cout << "  not watching, every backup compares the whole tree" << endl;
+        }
+#endif
+        printLastBackup();
+    }
+
+    //* function to run one command line, the verbs that use the daemon's state are handled here
+    void run(const string& cmd) {
+        // for the verbs that read packs without the store lock (locate, diff); backups, restores and
+        // verify check again once they hold it
+        refreshPackStore();
+        vector<string> args = splitArgs(cmd);
+        if (cmd == "backup status") {
+            status();
+            logAction("Ran: " + cmd);
+        } else if (cmd == "backup daemon --stop") {
+            cout << "Backup daemon stopping." << endl;
+            daemonStopRequested = 1;
+        } else if (cmd == "backup auto --off") {
+            minutes = 0;
+            cout << "Automatic backup turned off." << endl;
+            logAction("Ran: " + cmd);
+        } else if (cmd.rfind("backup auto --min ", 0) == 0) {
+            minutes = stoi(cmd.substr(18));
+            if (minutes <= 0) throw runtime_error("--min must be at least 1");
+            nextRun = chrono::steady_clock::now();
+            cout << "Automatic backup set every " << minutes << " minutes." << endl;
+            logAction("Ran: " + cmd);
+        } else if ((cmd == "backup do" || cmd.rfind("backup do ", 0) == 0) && isBackupInitialized()) {
+            BackupOptions options;
+            try {
+                options = parseBackupOptions(args);
+            } catch (const exception& e) {
+                cerr << e.what() << endl;
+                logAction(string("ERROR: ") + e.what());
+                return;
+            }
+            snapshot(options);
+            logAction("Ran: " + cmd);
+            if (hasArg(args, "--stats")) showStats(hasArg(args, "--json"));
+        } else {
+            executeCommand(cmd);
+        }
+    }
+
+    //* function to read one command from a client, run it with its output sent back, and close the connection
+    void serveClient(int client) {
+        struct timeval timeout = {5, 0};  // a client that connects and sends nothing must not block the daemon
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        string cmd;
+        char c;
+        while (cmd.size() < DAEMON_MAX_REQUEST && readAll(client, &c, 1) && c != '\n') cmd += c;
+        if (cmd.rfind("backup", 0) != 0) {
+            close(client);
+            return;
+        }
+        ++served;
+        mutex socketLock;
+        FrameStreamBuf out(client, 'o', socketLock), err(client, 'e', socketLock);
+        streambuf* oldOut = cout.rdbuf(&out);
+        streambuf* oldErr = cerr.rdbuf(&err);
+        commandFailed = false;
+        try {
+            run(cmd);
+        } catch (const exception& e) {
+            cerr << "Error: " << e.what() << endl;
+            logAction(string("ERROR: ") + e.what());
+            commandFailed = true;
+        }
+        cout.flush();
+        cerr.flush();
+        cout.rdbuf(oldOut);
+        cerr.rdbuf(oldErr);
+        char failed = commandFailed ? 1 : 0;
+        if (out.connected && err.connected) sendFrame(client, 'x', &failed, 1);
+        close(client);
+    }
+
+    void serve() {
+        while (!daemonStopRequested) {
+            int timeout = -1;
+            if (minutes > 0) {
+                auto wait = chrono::duration_cast<chrono::milliseconds>(nextRun - chrono::steady_clock::now()).count();
+                timeout = static_cast<int>(min<int64_t>(max<int64_t>(0, wait), INT32_MAX));
+            }
+            struct pollfd p[2] = {{listenFd, POLLIN, 0}, {-1, POLLIN, 0}};
+#ifdef __linux__
+            if (watcher) p[1].fd = watcher->fd;
+#endif
+            int ready = poll(p, 2, timeout);
+            if (ready < 0 && errno == EINTR) continue;
+            if (ready < 0) throw runtime_error(string("Failed to wait for commands: ") + strerror(errno));
+#ifdef __linux__
+            if (watcher && (p[1].revents & POLLIN)) drainWatcher();
+#endif
+            if (p[0].revents & POLLIN) {
+                int client = accept(listenFd, nullptr, nullptr);
+                if (client >= 0) serveClient(client);
+            }
+            if (minutes > 0 && chrono::steady_clock::now() >= nextRun && !daemonStopRequested) {
+                try {
+                    // read per run, so scheduled backups follow .backup/__init__ (throttle, store, io, ...)
+                    snapshot(parseBackupOptions({}));
+                } catch (const exception& e) {
+                    cerr << "Error in scheduled backup: " << e.what() << endl;
+                    logAction(string("ERROR: ") + e.what());
+                }
+                nextRun = chrono::steady_clock::now() + chrono::minutes(minutes);
+                cout << "Waiting " << minutes << " minutes for the next backup..." << endl;
+            }
+        }
+    }
+};
+
+//* function to run the daemon in the foreground until `backup daemon --stop`, Ctrl+C or SIGTERM
+void runDaemon(int minutes) {
+    auto onSignal = [](int) { daemonStopRequested = 1; };
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    signal(SIGPIPE, SIG_IGN);
+    try {
+        BackupDaemon daemon;
+        if (!daemon.start()) {
+            cerr << "A backup daemon is already running for this folder (see `backup status`)." << endl;
+            logAction("ERROR: Daemon already running");
+            return;
+        }
+        daemon.minutes = minutes;
+        daemon.nextRun = chrono::steady_clock::now();
+        cout << "Backup daemon (pid " << getpid() << ") listening on " << DAEMON_SOCKET;
+        if (minutes > 0) cout << ", automatic backup every " << minutes << " minutes";
+        cout << " (Ctrl+C or `backup daemon --stop` to stop)" << endl;
+        logAction("Daemon started" + (minutes > 0 ? ", backup every " + to_string(minutes) + " minutes" : string()));
+        daemon.serve();
+    } catch (const exception& e) {
+        cerr << "Error running the daemon: " << e.what() << endl;
+        logAction(string("ERROR: ") + e.what());
+    }
+    cout << "Backup daemon stopped." << endl;
+    logAction("Daemon stopped");
+}
+#else
+bool forwardToDaemon(const string&) {
+    return false;
+}
+
+void runDaemon(int minutes) {
+    if (minutes <= 0) throw runtime_error("backup daemon needs Unix domain sockets, use `backup auto --min X` instead");
+    autoBackup(minutes, parseBackupOptions({}));
+}
+#endif
+
+//* multi-project scheduler: `backup schedule add` registers a project folder with an interval, a priority
+//* and extra ignore patterns in `projects` next to the log folder; `backup schedule run` is one process
+//* for all of them that starts each due snapshot as a `backup do` child in the project's folder (or its
+//* daemon). At most --max-parallel snapshots run at once. First runs are spread over the interval by a
+//* hash of the path, later ones get +-jitter, so projects with the same interval do not start together.
+//* Due projects wait in a queue ordered by priority plus lateness in intervals, so a low priority project
+//* that keeps waiting moves up until it gets a slot (no project starves). The running scheduler writes
+//* its queue depth, lateness and durations to `scheduler-status` for `backup schedule status`.
+struct ScheduledProject {
+    string path;  // absolute project folder
+    uint64_t minutes = 60;
+    int priority = 0;
+    vector<string> ignore;
+
+    // runtime state, only in the running scheduler
+    int64_t dueMs = 0;  // unix ms
+    int64_t lastStartMs = 0, lastDurationMs = -1, lastLatenessMs = 0;
+    uint64_t runs = 0, failures = 0;
+    int pid = 0;        // child running the snapshot, 0 = idle
+    bool lastOk = true;
+};
+
+fs::path scheduleDataDir() {
+    return fs::path(getLogDir()).parent_path();
+}
+
+fs::path scheduleRegistryFile() {
+    return scheduleDataDir() / "projects";
+}
+
+fs::path scheduleStatusFile() {
+    return scheduleDataDir() / "scheduler-status";
+}
+
+const string SCHEDULE_HEADER = "# .backup projects v1";
+
+int64_t unixMs() {
+    return chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+//* function to read the project registry (lines: minutes, priority, path, ignore patterns; tab separated)
+vector<ScheduledProject> readScheduleRegistry() {
+    vector<ScheduledProject> projects;
+    ifstream in(scheduleRegistryFile());
+    string line;
+    while (getline(in, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        vector<string> fields;
+        size_t start = 0;
+        for (size_t tab; (tab = line.find('\t', start)) != string::npos; start = tab + 1) fields.push_back(line.substr(start, tab - start));
+        fields.push_back(line.substr(start));
+        if (fields.size() < 3) continue;
+        ScheduledProject p;
+        p.minutes = max<uint64_t>(1, strtoull(fields[0].c_str(), nullptr, 10));
+        p.priority = atoi(fields[1].c_str());
+        p.path = fields[2];
+        p.ignore.assign(fields.begin() + 3, fields.end());
+        projects.push_back(p);
+    }
+    return projects;
+}
+
+void writeScheduleRegistry(const vector<ScheduledProject>& projects) {
+    fs::create_directories(scheduleDataDir());
+    fs::path file = scheduleRegistryFile(), temp = file;
+    temp += ".tmp";
+    {
+        ofstream out(temp, ios::trunc);
+        out << SCHEDULE_HEADER << "\n";
+        for (const ScheduledProject& p : projects) {
+            out << p.minutes << "\t" << p.priority << "\t" << p.path;
+            for (const string& pattern : p.ignore) out << "\t" << pattern;
+            out << "\n";
+        }
+        if (!out.flush()) throw runtime_error("Failed to write " + temp.string());
+    }
+    fs::rename(temp, file);
+}
+
+//* function to add, change or remove a project (`backup schedule add|remove ...`) and list the registry
+void editSchedule(const vector<string>& args) {
+    string action = args.size() > 2 ? args[2] : "list";
+    vector<ScheduledProject> projects = readScheduleRegistry();
+    if (action == "list") {
+        if (projects.empty()) {
+            cout << "No projects scheduled, add one with `backup schedule add --every MIN`." << endl;
+            return;
+        }
+        cout << right << setw(8) << "every" << setw(10) << "priority" << "  " << left << "project" << endl;
+        for (const ScheduledProject& p : projects) {
+            cout << right << setw(6) << p.minutes << " m" << setw(10) << p.priority << "  " << left << p.path;
+            for (const string& pattern : p.ignore) cout << " --ignore " << pattern;
+            cout << "\n";
+        }
+        cout << flush;
+        return;
+    }
+    fs::path dir = fs::absolute(argValue(args, "--dir", ".")).lexically_normal();
+    string path = dir.string();
+    if (path.size() > 1 && (path.back() == '/' || path.back() == '\\')) path.pop_back();
+    auto it = find_if(projects.begin(), projects.end(), [&](const ScheduledProject& p) { return p.path == path; });
+    if (action == "remove") {
+        if (it == projects.end()) throw runtime_error("Not scheduled: " + path);
+        projects.erase(it);
+        writeScheduleRegistry(projects);
+        cout << "Removed " << path << " from the schedule." << endl;
+        return;
+    }
+    if (action != "add") throw runtime_error("Unknown schedule action (use add, remove, list, run or status): " + action);
+    if (!fs::exists(dir / ".backup" / "__init__")) throw runtime_error("Not an initialized backup folder: " + path);
+    if (path.find('\t') != string::npos) throw runtime_error("Project paths must not contain tabs: " + path);
+    ScheduledProject p;
+    p.path = path;
+    p.minutes = argNumber(args, "--every", 0);
+    if (p.minutes < 1 || p.minutes > 525600) throw runtime_error("--every must be between 1 and 525600 minutes");
+    p.priority = stoi(argValue(args, "--priority", "0"));
+    for (size_t i = 0; i + 1 < args.size(); ++i) {
+        if (args[i] == "--ignore") p.ignore.push_back(args[++i]);
+    }
+    bool updated = it != projects.end();
+    if (updated) *it = p;
+    else projects.push_back(p);
+    writeScheduleRegistry(projects);
+    cout << (updated ? "Updated " : "Scheduled ") << path << ": every " << p.minutes << " minutes, priority " << p.priority;
+    if (!p.ignore.empty()) cout << ", " << p.ignore.size() << " extra ignore pattern(s)";
+    cout << endl;
+}
+
+fs::path scheduleLockFile() {
+    return scheduleDataDir() / "scheduler.lock";
+}
+
+//* function to check whether a scheduler holds the scheduler lock
+bool schedulerRunning() {
+#ifdef _WIN32
+    return false;
+#else
+    int fd = open(scheduleLockFile().c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    bool locked = flock(fd, LOCK_SH | LOCK_NB) != 0;
+    close(fd);
+    return locked;
+#endif
+}
+
+//* function to print what the running scheduler last wrote to scheduler-status
+void showScheduleStatus(bool json) {
+    ifstream in(scheduleStatusFile());
+    string line;
+    vector<vector<string>> rows;
+    while (getline(in, line)) {
+        vector<string> fields;
+        size_t start = 0;
+        for (size_t tab; (tab = line.find('\t', start)) != string::npos; start = tab + 1) fields.push_back(line.substr(start, tab - start));
+        fields.push_back(line.substr(start));
+        rows.push_back(fields);
+    }
+    // scheduler pid, heartbeat, max parallel, running, queue depth, max queue depth, mean and max lateness
+    if (rows.empty() || rows[0].size() < 9 || rows[0][0] != "scheduler") {
+        cout << (json ? "{\"running\":false}" : "The scheduler is not running (start it with `backup schedule run`).") << endl;
+        return;
+    }
+    const vector<string>& h = rows[0];
+    int64_t now = unixMs();
+    bool alive = schedulerRunning();
+    if (json) {
+        cout << "{\"running\":" << (alive ? "true" : "false") << ",\"pid\":" << h[1] << ",\"max_parallel\":" << h[3]
+             << ",\"active\":" << h[4] << ",\"queue_depth\":" << h[5] << ",\"max_queue_depth\":" << h[6]
+             << ",\"mean_lateness_ms\":" << h[7] << ",\"max_lateness_ms\":" << h[8] << ",\"projects\":[";
+    } else {
+        cout << "Scheduler " << (alive ? "running" : "stopped, last status") << " (pid " << h[1] << "): " << h[4] << "/" << h[3]
+             << " snapshots running, queue depth " << h[5] << " (max " << h[6] << "), lateness mean "
+             << stoll(h[7]) / 1000.0 << " s, max " << stoll(h[8]) / 1000.0 << " s" << endl;
+        cout << left << setw(9) << "state" << right << setw(10) << "next in" << setw(10) << "last" << setw(10) << "late"
+             << setw(7) << "runs" << setw(7) << "fails" << "  " << left << "project" << endl;
+    }
+    // path, state, due, last duration, last lateness, runs, failures, priority, minutes
+    bool first = true;
+    for (size_t i = 1; i < rows.size(); ++i) {
+        const vector<string>& r = rows[i];
+        if (r.size() < 9) continue;
+        int64_t dueIn = max<int64_t>(0, stoll(r[2]) - now), duration = stoll(r[3]), lateness = stoll(r[4]);
+        if (json) {
+            cout << (first ? "" : ",") << "{\"path\":\"" << escapeManifestPath(r[0]) << "\",\"state\":\"" << r[1]
+                 << "\",\"due_in_ms\":" << dueIn << ",\"last_duration_ms\":" << duration << ",\"last_lateness_ms\":"
+                 << lateness << ",\"runs\":" << r[5] << ",\"failures\":" << r[6] << ",\"priority\":" << r[7]
+                 << ",\"every_min\":" << r[8] << "}";
+        } else {
+            cout << left << setw(9) << r[1] << right << setw(10) << (r[1] == "waiting" ? formatDuration(dueIn / 1000) : "-")
+                 << setw(10) << (duration < 0 ? "-" : formatDuration(duration / 1000)) << setw(10)
+                 << formatDuration(lateness / 1000) << setw(7) << r[5] << setw(7) << r[6] << "  " << left << r[0] << "\n";
+        }
+        first = false;
+    }
+    cout << (json ? "]}\n" : "") << flush;
+}
+
+#ifndef _WIN32
+static volatile sig_atomic_t scheduleStopRequested = 0;
+
+//* the running scheduler (`backup schedule run`)
+struct ProjectScheduler {
+    unsigned maxParallel = 2;
+    double jitter = 0.1;  // share of the interval a start may move either way
+    vector<ScheduledProject> projects;
+    fs::file_time_type registryStamp;
+    string executable = getExecutablePath();
+    uint64_t rng;
+    size_t maxQueueDepth = 0;
+    int64_t latenessSumMs = 0, latenessMaxMs = 0;
+    uint64_t started = 0;
+
+    ProjectScheduler() : rng(static_cast<uint64_t>(unixMs()) ^ (static_cast<uint64_t>(getpid()) << 32)) {}
+
+    double random01() {
+        rng += 0x9E3779B97F4A7C15ull;  // splitmix64
+        uint64_t z = rng;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return static_cast<double>((z ^ (z >> 31)) >> 11) / 9007199254740992.0;
+    }
+
+    //* function to pick up registry changes, keeping the state of projects that stay
+    void reload() {
+        error_code ec;
+        fs::file_time_type stamp = fs::last_write_time(scheduleRegistryFile(), ec);
+        if (ec || stamp == registryStamp) return;
+        registryStamp = stamp;
+        vector<ScheduledProject> fresh = readScheduleRegistry();
+        int64_t now = unixMs();
+        for (ScheduledProject& p : fresh) {
+            auto old = find_if(projects.begin(), projects.end(), [&](const ScheduledProject& o) { return o.path == p.path; });
+            if (old != projects.end()) {
+                ScheduledProject settings = p;
+                p = *old;
+                p.minutes = settings.minutes;
+                p.priority = settings.priority;
+                p.ignore = settings.ignore;
+            } else {
+                // first start at a fixed phase inside the interval, so restarts do not bunch projects up either
+                int64_t interval = static_cast<int64_t>(p.minutes) * 60000;
+                p.dueMs = now + static_cast<int64_t>(hash<string>()(p.path) % static_cast<uint64_t>(interval));
+            }
+        }
+        // removed projects that are still running are kept until their snapshot ends
+        for (ScheduledProject& p : projects) {
+            if (p.pid == 0) continue;
+            if (none_of(fresh.begin(), fresh.end(), [&](const ScheduledProject& f) { return f.path == p.path; })) {
+                p.minutes = 0;
+                fresh.push_back(p);
+            }
+        }
+        projects.swap(fresh);
+        cout << "Schedule loaded: " << projects.size() << " project(s)" << endl;
+    }
+
+    size_t running() const {
+        return count_if(projects.begin(), projects.end(), [](const ScheduledProject& p) { return p.pid != 0; });
+    }
+
+    //* function to list the due projects that wait for a slot, the next one to start first
+    vector<ScheduledProject*> queue(int64_t now) {
+        vector<ScheduledProject*> due;
+        for (ScheduledProject& p : projects) {
+            if (p.pid == 0 && p.minutes > 0 && p.dueMs <= now) due.push_back(&p);
+        }
+        auto score = [now](const ScheduledProject* p) {
+            return p->priority + static_cast<double>(now - p->dueMs) / (static_cast<double>(p->minutes) * 60000.0);
+        };
+        sort(due.begin(), due.end(), [&](const ScheduledProject* a, const ScheduledProject* b) {
+            double sa = score(a), sb = score(b);
+            return sa != sb ? sa > sb : a->dueMs < b->dueMs;
+        });
+        return due;
+    }
+
+    //* function to start `backup do` for a project in its folder
+    void launch(ScheduledProject& p, int64_t now) {
+        vector<string> words = {executable, "do"};
+        for (const string& pattern : p.ignore) {
+            words.push_back("--ignore");
+            words.push_back(pattern);
+        }
+        vector<char*> argv;
+        for (string& w : words) argv.push_back(&w[0]);
+        argv.push_back(nullptr);
+        pid_t pid = fork();
+        if (pid < 0) throw runtime_error(string("Failed to start a snapshot: ") + strerror(errno));
+        if (pid == 0) {
+            int devnull = open("/dev/null", O_RDWR);
+            if (devnull >= 0) {
+                dup2(devnull, 0);
+                dup2(devnull, 1);
+                dup2(devnull, 2);
+            }
+            if (chdir(p.path.c_str()) == 0) execv(argv[0], argv.data());
+            _exit(127);
+        }
+        p.pid = pid;
+        p.lastStartMs = now;
+        p.lastLatenessMs = now - p.dueMs;
+        latenessSumMs += p.lastLatenessMs;
+        latenessMaxMs = max(latenessMaxMs, p.lastLatenessMs);
+        ++started;
+        logAction("Schedule: started " + p.path + " (" + to_string(p.lastLatenessMs) + " ms late)");
+    }
+
+    //* function to record a finished snapshot and plan the project's next one
+    void finished(ScheduledProject& p, int status, int64_t now) {
+        p.pid = 0;
+        p.lastDurationMs = now - p.lastStartMs;
+        ++p.runs;
+        // the exit status, not the project's __stats__: a pull running there at the same time rewrites that
+        p.lastOk = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        if (!p.lastOk) ++p.failures;
+        cout << (p.lastOk ? "Backed up " : "Backup failed: ") << p.path << " in " << p.lastDurationMs / 1000.0 << " s ("
+             << p.lastLatenessMs / 1000.0 << " s late)" << endl;
+        logAction(string(p.lastOk ? "Schedule: backed up " : "ERROR: Scheduled backup failed: ") + p.path + " in " +
+                  to_string(p.lastDurationMs) + " ms");
+        int64_t interval = static_cast<int64_t>(p.minutes) * 60000;
+        // the next run is planned from the due time, so a slow snapshot does not push the whole series back
+        int64_t next = p.dueMs + interval + static_cast<int64_t>((random01() * 2 - 1) * jitter * interval);
+        p.dueMs = max(next, now + interval / 10);
+    }
+
+    void writeStatus(size_t queued, int64_t now) {
+        fs::path file = scheduleStatusFile(), temp = file;
+        temp += ".tmp";
+        {
+            ofstream out(temp, ios::trunc);
+            out << "scheduler\t" << getpid() << "\t" << now << "\t" << maxParallel << "\t" << running() << "\t" << queued
+                << "\t" << maxQueueDepth << "\t" << (started ? latenessSumMs / static_cast<int64_t>(started) : 0) << "\t"
+                << latenessMaxMs << "\n";
+            for (const ScheduledProject& p : projects) {
+                string state = p.pid ? "running" : p.minutes == 0 ? "removed" : p.dueMs <= now ? "queued" : "waiting";
+                out << p.path << "\t" << state << "\t" << p.dueMs << "\t" << p.lastDurationMs << "\t" << p.lastLatenessMs
+                    << "\t" << p.runs << "\t" << p.failures << "\t" << p.priority << "\t" << p.minutes << "\n";
+            }
+        }
+        error_code ec;
+        fs::rename(temp, file, ec);
+    }
+
+    void run() {
+        int64_t lastStatus = 0;
+        while (true) {
+            int64_t now = unixMs();
+            bool changed = false;
+            int status;
+            for (pid_t pid; (pid = waitpid(-1, &status, WNOHANG)) > 0;) {
+                for (ScheduledProject& p : projects) {
+                    if (p.pid == pid) finished(p, status, now);
+                }
+                changed = true;
+            }
+            projects.erase(remove_if(projects.begin(), projects.end(),
+                                     [](const ScheduledProject& p) { return p.minutes == 0 && p.pid == 0; }),
+                           projects.end());
+            if (scheduleStopRequested) {
+                if (running() == 0) break;
+            } else {
+                reload();
+                vector<ScheduledProject*> due = queue(now);
+                size_t slots = maxParallel - min<size_t>(maxParallel, running());
+                for (size_t i = 0; i < due.size() && i < slots; ++i) {
+                    launch(*due[i], now);
+                    changed = true;
+                }
+                maxQueueDepth = max(maxQueueDepth, due.size() - min(due.size(), slots));
+            }
+            if (changed || now - lastStatus >= 10000) {
+                writeStatus(queue(now).size(), now);
+                lastStatus = now;
+            }
+            // wake at the next due time; SIGCHLD cuts the wait short, so a free slot is refilled at once
+            int64_t wait = 200;
+            for (const ScheduledProject& p : projects) {
+                if (p.pid == 0 && p.minutes > 0 && p.dueMs > now) wait = min(wait, p.dueMs - now);
+            }
+            poll(nullptr, 0, static_cast<int>(wait));
+        }
+        writeStatus(0, unixMs());
+    }
+};
+
+//* function to run the scheduler in the foreground until Ctrl+C or SIGTERM (running snapshots finish first)
+void runScheduler(const vector<string>& args) {
+    fs::create_directories(scheduleDataDir());
+    int lockFd = open(scheduleLockFile().c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (lockFd < 0 || flock(lockFd, LOCK_EX | LOCK_NB) != 0) {
+        if (lockFd >= 0) close(lockFd);
+        throw runtime_error("Another scheduler is already running (see `backup schedule status`)");
+    }
+    ProjectScheduler scheduler;
+    uint64_t parallel = argNumber(args, "--max-parallel", 2);
+    if (parallel < 1 || parallel > 1024) throw runtime_error("--max-parallel must be between 1 and 1024");
+    scheduler.maxParallel = static_cast<unsigned>(parallel);
+    uint64_t jitterPercent = argNumber(args, "--jitter", 10);
+    if (jitterPercent > 50) throw runtime_error("--jitter must be at most 50 (percent of the interval)");
+    scheduler.jitter = jitterPercent / 100.0;
+    if (scheduler.executable.empty()) throw runtime_error("Failed to find the backup executable");
+
+    scheduleStopRequested = 0;
+    auto onSignal = [](int) { scheduleStopRequested = 1; };
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    signal(SIGCHLD, [](int) {});
+    cout << "Scheduler started: at most " << scheduler.maxParallel << " snapshot(s) at once, jitter " << jitterPercent
+         << "% (Ctrl+C to stop)" << endl;
+    logAction("Scheduler started");
+    scheduler.run();
+    close(lockFd);
+    cout << "Scheduler stopped." << endl;
+    logAction("Scheduler stopped");
+}
+#else
+void runScheduler(const vector<string>&) {
+    throw runtime_error("backup schedule run needs fork/exec (Linux, macOS), use `backup auto --min X` per project");
+}
+#endif
+
+//* function to parse and execute commands
+void executeCommand(const string& cmd) {
+    if (cmd == "backup --version") {
         showVersion();
         logAction("Ran: backup --version");
     } else if (cmd == "backup --v") {
@@ -358,33 +8321,154 @@ void executeCommand(const string& cmd) {
     } else if (cmd == "backup init") {
         initBackup();
         logAction("Ran: backup init");
-    } else if (cmd == "backup do") {
+    } else if (cmd == "backup do" || cmd.rfind("backup do ", 0) == 0) {
         if (isBackupInitialized()) {
-            createBackup();
-            logAction("Ran: backup do");
+            BackupOptions options;
+            try {
+                options = parseBackupOptions(splitArgs(cmd));
+            } catch (const exception& e) {
+                cerr << e.what() << endl;
+                logAction(string("ERROR: ") + e.what());
+                commandFailed = true;
+                return;
+            }
+            createBackup(options);
+            logAction("Ran: " + cmd);
+            vector<string> args = splitArgs(cmd);
+            if (hasArg(args, "--stats")) showStats(hasArg(args, "--json"));
         } else {
             cerr << "Backup not initialized. Run `backup init` first." << endl;
             logAction("ERROR: Not initialized, attempted backup do");
+            commandFailed = true;
         }
     } else if (cmd.find("backup auto --min ") == 0) {
         int minutes = stoi(cmd.substr(18));
-        if (isBackupInitialized()) {
-            thread([minutes]() { autoBackup(minutes); }).detach();
+        if (minutes <= 0) {
+            cerr << "--min must be at least 1" << endl;
+            logAction("ERROR: Invalid interval for backup auto");
+        } else if (isBackupInitialized()) {
+            // no daemon answered: this process becomes it, so the schedule lives as long as it does
             cout << "Automatic backup set every " << minutes << " minutes." << endl;
             logAction("Ran: backup auto --min " + to_string(minutes));
+            runDaemon(minutes);
         } else {
             cerr << "Backup not initialized. Run `backup init` first." << endl;
             logAction("ERROR: Not initialized, attempted backup auto");
         }
+    } else if (cmd == "backup auto --off") {
+        cout << "No backup daemon is running, nothing is scheduled." << endl;
+        logAction("Ran: " + cmd);
+    } else if (cmd == "backup daemon") {
+        if (isBackupInitialized()) {
+            logAction("Ran: " + cmd);
+            runDaemon(0);
+        } else {
+            cerr << "Backup not initialized. Run `backup init` first." << endl;
+            logAction("ERROR: Not initialized, attempted backup daemon");
+        }
+    } else if (cmd == "backup daemon --stop" || cmd == "backup status") {
+        cout << "No backup daemon is running (start one with `backup daemon` or `backup auto --min X`)." << endl;
+        if (cmd == "backup status" && isBackupInitialized()) printLastBackup();
+        logAction("Ran: " + cmd);
+    } else if (cmd == "backup watch" || cmd.rfind("backup watch ", 0) == 0) {
+        if (isBackupInitialized()) {
+            logAction("Ran: " + cmd);
+            try {
+                vector<string> args = splitArgs(cmd);
+                uint64_t debounce = argNumber(args, "--debounce", 2000);
+                if (debounce > 3600000) throw runtime_error("--debounce must be at most 3600000 ms");
+                watchBackups(parseBackupOptions(args), static_cast<int>(debounce));
+            } catch (const exception& e) {
+                cerr << "Error watching: " << e.what() << endl;
+                logAction(string("ERROR: ") + e.what());
+            }
+        } else {
+            cerr << "Backup not initialized. Run `backup init` first." << endl;
+            logAction("ERROR: Not initialized, attempted backup watch");
+        }
+    } else if (cmd == "backup schedule" || cmd.rfind("backup schedule ", 0) == 0) {
+        try {
+            vector<string> args = splitArgs(cmd);
+            if (args.size() > 2 && args[2] == "run") runScheduler(args);
+            else if (args.size() > 2 && args[2] == "status") showScheduleStatus(hasArg(args, "--json"));
+            else editSchedule(args);
+        } catch (const exception& e) {
+            cerr << "Error scheduling: " << e.what() << endl;
+            logAction(string("ERROR: ") + e.what());
+        }
+        logAction("Ran: " + cmd);
     } else if (cmd == "backup remove --all") {
         removeAllBackups();
         logAction("Ran: backup remove --all");
-    } else if (cmd == "backup pull --last") {
-        pullLastBackup();
-        logAction("Ran: backup pull --last");
+    } else if (cmd.rfind("backup pull ", 0) == 0) {
+        pullBackup(splitArgs(cmd));
+        logAction("Ran: " + cmd);
+        vector<string> args = splitArgs(cmd);
+        if (hasArg(args, "--stats")) showStats(hasArg(args, "--json"));
+    } else if (cmd == "backup list" || cmd == "backup list --json") {
+        try {
+            listSnapshots(cmd == "backup list --json");
+        } catch (const exception& e) {
+            cerr << "Error listing backups: " << e.what() << endl;
+            logAction(string("ERROR: ") + e.what());
+        }
+        logAction("Ran: " + cmd);
+    } else if (cmd == "backup stats" || cmd == "backup stats --json") {
+        showStats(cmd == "backup stats --json");
+        logAction("Ran: " + cmd);
+    } else if (cmd.rfind("backup locate ", 0) == 0) {
+        try {
+            locateInBackup(splitArgs(cmd));
+        } catch (const exception& e) {
+            cerr << "Error locating: " << e.what() << endl;
+            logAction(string("ERROR: ") + e.what());
+        }
+        logAction("Ran: " + cmd);
+    } else if (cmd.rfind("backup diff ", 0) == 0) {
+        try {
+            diffSnapshots(splitArgs(cmd));
+        } catch (const exception& e) {
+            cerr << "Error comparing: " << e.what() << endl;
+            logAction(string("ERROR: ") + e.what());
+        }
+        logAction("Ran: " + cmd);
+    } else if (cmd == "backup verify" || cmd.rfind("backup verify ", 0) == 0) {
+        if (isBackupInitialized()) {
+            verifyBackups(splitArgs(cmd));
+            logAction("Ran: " + cmd);
+        } else {
+            cerr << "Backup not initialized. Run `backup init` first." << endl;
+            logAction("ERROR: Not initialized, attempted backup verify");
+        }
+    } else if (cmd == "backup prune" || cmd.rfind("backup prune ", 0) == 0) {
+        if (isBackupInitialized()) {
+            pruneBackups(splitArgs(cmd));
+            logAction("Ran: " + cmd);
+        } else {
+            cerr << "Backup not initialized. Run `backup init` first." << endl;
+            logAction("ERROR: Not initialized, attempted backup prune");
+        }
     } else if (cmd == "backup meta") {
         showBackupMeta();
         logAction("Ran: backup meta");
+    } else if (cmd.rfind("backup bench chunk", 0) == 0 || cmd.rfind("backup bench scan", 0) == 0 ||
+               cmd.rfind("backup bench ignore", 0) == 0 || cmd.rfind("backup bench small", 0) == 0 ||
+               cmd.rfind("backup bench compress", 0) == 0 || cmd.rfind("backup bench diff", 0) == 0 ||
+               cmd.rfind("backup bench hash", 0) == 0 || cmd.rfind("backup bench io", 0) == 0) {
+        try {
+            vector<string> args = splitArgs(cmd);
+            if (args[2] == "chunk") runChunkBenchmark(args);
+            else if (args[2] == "scan") runScanBenchmark(args);
+            else if (args[2] == "small") runSmallFileBenchmark(args);
+            else if (args[2] == "compress") runCompressBenchmark(args);
+            else if (args[2] == "diff") runDiffBenchmark(args);
+            else if (args[2] == "hash") runHashBenchmark(args);
+            else if (args[2] == "io") runIoBenchmark(args);
+            else runIgnoreBenchmark(args);
+        } catch (const exception& e) {
+            cerr << "Error running benchmark: " << e.what() << endl;
+        }
+        logAction("Ran: " + cmd);
     } else if (cmd == "backup help") {
         showHelp();
         logAction("Ran: backup help");
@@ -401,18 +8485,20 @@ int main(int argc, char* argv[]) {
     try {
         // setWorkingDirToExe(); // Entfernt, damit .backup im aktuellen Ordner bleibt
         if (argc > 1) {
-            string cmd = "backup";
-            for (int i = 1; i < argc; ++i) {
-                cmd += " ";
-                cmd += argv[i];
-            }
-            executeCommand(cmd);
+            string cmd = joinArgs(argc, argv);
+            // the verbs that read or change the store go through the daemon when one is running
+            static const char* const forwarded[] = {"do", "pull", "auto", "status", "stats", "list", "locate",
+                                                    "diff", "verify", "prune", "meta"};
+            bool viaDaemon = cmd == "backup daemon --stop";
+            for (const char* verb : forwarded) viaDaemon = viaDaemon || string(argv[1]) == verb;
+            if (!viaDaemon || !forwardToDaemon(cmd)) executeCommand(cmd);
         } else {
             cout << "Usage: `backup (command/help)`\n";
             cout << "Type 'backup help' for available commands." << endl;
         }
     } catch (const exception& e) {
         cerr << "Error: " << e.what() << endl;
+        commandFailed = true;
     }
-    return 0;
+    return commandFailed ? 1 : 0;
 }
@@ -0,0 +1,400 @@
+//! Benchmark suite for backup.cpp
+//* builds reproducible synthetic trees, runs the real `backup` binary on them and prints JSON results
+//* build it like backup.cpp (single file, C++17), e.g. `g++ -std=c++17 -O2 benchmark.cpp -o benchmark`
+
+#include <iostream>
+#include <filesystem>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#endif
+
+namespace fs = std::filesystem;
+using namespace std;
+
+//* benchmark settings, all from the command line
+struct BenchConfig {
+    string backup = "backup";       // path of the backup binary to measure
+    fs::path dir = fs::temp_directory_path() / "backup-benchmark";
+    double scale = 1.0;             // multiplies every workload size
+    unsigned mutatePercent = 10;    // share of files edited per mutation round
+    unsigned rounds = 3;            // mutation rounds
+    uint64_t seed = 1;
+    unsigned jobs = 0;              // 0 = backup's default
+    vector<string> workloads = {"tiny", "huge", "deep", "ignore"};
+    string out;                     // write the JSON here as well
+    bool keep = false;
+};
+
+//* result of one timed `backup` run
+struct BenchResult {
+    string workload;
+    string step;
+    uint64_t files = 0;
+    uint64_t bytes = 0;
+    double seconds = 0;
+    long peakRssKb = 0;
+    uint64_t bytesWritten = 0;
+    int exitCode = 0;
+};
+
+//* reproducible pseudo-random numbers (xorshift), same sequence on every platform
+struct BenchRandom {
+    uint64_t x;
+
+    explicit BenchRandom(uint64_t seed) : x(seed * 0x9E3779B97F4A7C15ULL | 1) {}
+
+    uint64_t next() {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        return x;
+    }
+
+    void fill(char* data, size_t len) {
+        for (size_t i = 0; i < len; ++i) data[i] = char(next() >> 32);
+    }
+};
+
+//* function to hash a workload name into its seed (FNV-1a; std::hash differs between standard libraries)
+uint64_t fnv1a(const string& text) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (unsigned char c : text) {
+        h ^= c;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+//* a generated tree: its root and the files in it, so mutation rounds can pick from them
+struct BenchTree {
+    fs::path root;
+    vector<fs::path> files;
+    uint64_t bytes = 0;
+};
+
+static vector<char> generatorBuffer;
+
+//* function to write one file of `size` random bytes
+void writeRandomFile(const fs::path& file, size_t size, BenchRandom& random, BenchTree& tree) {
+    vector<char>& buffer = generatorBuffer;
+    if (buffer.size() < size) buffer.resize(size);
+    random.fill(buffer.data(), size);
+    ofstream out(file, ios::binary | ios::trunc);
+    out.write(buffer.data(), static_cast<streamsize>(size));
+    if (!out) throw runtime_error("Failed to write: " + file.string());
+    tree.files.push_back(file);
+    tree.bytes += size;
+}
+
+//* function to generate one workload tree
+//*   tiny   many small files (0-1 KiB), 100 per folder
+//*   huge   a few large incompressible files
+//*   deep   long chains of nested folders with one file per level
+//*   ignore a tiny-style tree plus node_modules/build/log clutter and a .backupignore with many patterns
+BenchTree generateWorkload(const string& name, const BenchConfig& config) {
+    BenchTree tree;
+    tree.root = config.dir / name;
+    // only trees this run generated are deleted again, so an existing folder is never taken over
+    if (!fs::create_directory(tree.root)) throw runtime_error("Workload folder already exists: " + tree.root.string());
+    BenchRandom random(config.seed + fnv1a(name));
+
+    auto tinyFiles = [&](const fs::path& base, size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            fs::path folder = base / ("d" + to_string(i / 10000)) / ("s" + to_string(i / 100 % 100));
+            if (i % 100 == 0) fs::create_directories(folder);
+            writeRandomFile(folder / ("f" + to_string(i) + ".txt"), random.next() % 1025, random, tree);
+        }
+    };
+
+    if (name == "tiny") {
+        tinyFiles(tree.root, size_t(20000 * config.scale));
+    } else if (name == "huge") {
+        size_t count = max<size_t>(1, size_t(3 * config.scale));
+        for (size_t i = 0; i < count; ++i) writeRandomFile(tree.root / ("huge" + to_string(i) + ".bin"), 48 << 20, random, tree);
+    } else if (name == "deep") {
+        size_t chains = max<size_t>(1, size_t(200 * config.scale));
+        for (size_t c = 0; c < chains; ++c) {
+            fs::path folder = tree.root / ("chain" + to_string(c));
+            for (int level = 0; level < 30; ++level) {
+                folder /= "level" + to_string(level);
+                fs::create_directories(folder);
+                writeRandomFile(folder / "file.txt", 256 + random.next() % 4096, random, tree);
+            }
+        }
+    } else if (name == "ignore") {
+        tinyFiles(tree.root / "src", size_t(10000 * config.scale));
+        // clutter that the patterns below remove again; it is not counted as backed-up data
+        BenchTree clutter;
+        for (size_t p = 0; p < size_t(20 * config.scale) + 1; ++p) {
+            fs::path modules = tree.root / "src" / ("pkg" + to_string(p)) / "node_modules" / "dep";
+            fs::create_directories(modules);
+            for (int i = 0; i < 200; ++i) writeRandomFile(modules / ("m" + to_string(i) + ".js"), 512, random, clutter);
+            fs::create_directories(tree.root / "build" / to_string(p));
+            for (int i = 0; i < 50; ++i) writeRandomFile(tree.root / "build" / to_string(p) / ("o" + to_string(i) + ".o"), 2048, random, clutter);
+            writeRandomFile(tree.root / "src" / ("pkg" + to_string(p) + ".log"), 4096, random, clutter);
+        }
+        ofstream ignore(tree.root / ".backupignore");
+        ignore << "node_modules/\n/build/\n*.log\n*.tmp\n";
+        for (int i = 0; i < 200; ++i) ignore << "generated" << i << "/\n*.cache" << i << "\n";
+    } else {
+        throw runtime_error("Unknown workload: " + name + " (use tiny, huge, deep or ignore)");
+    }
+    vector<char>().swap(generatorBuffer);
+    return tree;
+}
+
+//* function to edit `percent` of the files: small files are rewritten, large ones get a 4 KiB patch
+void mutateTree(BenchTree& tree, unsigned percent, BenchRandom& random) {
+    size_t count = max<size_t>(1, tree.files.size() * percent / 100);
+    vector<char> patch(4096);
+    for (size_t k = 0; k < count; ++k) {
+        const fs::path& file = tree.files[random.next() % tree.files.size()];
+        uint64_t size = fs::file_size(file);
+        random.fill(patch.data(), patch.size());
+        if (size <= patch.size()) {
+            ofstream out(file, ios::binary | ios::trunc);
+            out.write(patch.data(), static_cast<streamsize>(size + 1 > patch.size() ? patch.size() : size + 1));
+        } else {
+            fstream out(file, ios::binary | ios::in | ios::out);
+            out.seekp(static_cast<streamoff>(random.next() % (size - patch.size())));
+            out.write(patch.data(), static_cast<streamsize>(patch.size()));
+        }
+    }
+}
+
+//* function to run the backup binary in `workdir` with output discarded; returns the exit code and peak RSS
+int runBackup(const BenchConfig& config, const fs::path& workdir, const vector<string>& args, long& peakRssKb) {
+    peakRssKb = 0;
+#ifdef _WIN32
+    string commandLine = "\"" + config.backup + "\"";
+    for (const auto& a : args) commandLine += " " + a;
+    SECURITY_ATTRIBUTES sa = {sizeof(sa), nullptr, TRUE};
+    HANDLE nul = CreateFileA("NUL", GENERIC_WRITE, FILE_SHARE_WRITE, &sa, OPEN_EXISTING, 0, nullptr);
+    STARTUPINFOA si = {};
+    si.cb = sizeof(si);
+    si.dwFlags = STARTF_USESTDHANDLES;
+    si.hStdOutput = nul;
+    si.hStdError = nul;
+    PROCESS_INFORMATION pi = {};
+    string workdirText = workdir.string();
+    if (!CreateProcessA(nullptr, commandLine.data(), nullptr, nullptr, TRUE, 0, nullptr, workdirText.c_str(), &si, &pi)) {
+        CloseHandle(nul);
+        throw runtime_error("Failed to start " + config.backup);
+    }
+    WaitForSingleObject(pi.hProcess, INFINITE);
+    DWORD code = 0;
+    GetExitCodeProcess(pi.hProcess, &code);
+    PROCESS_MEMORY_COUNTERS memory;
+    if (GetProcessMemoryInfo(pi.hProcess, &memory, sizeof(memory))) peakRssKb = long(memory.PeakWorkingSetSize / 1024);
+    CloseHandle(pi.hProcess);
+    CloseHandle(pi.hThread);
+    CloseHandle(nul);
+    return int(code);
+#else
+    // the child's peak RSS starts from the address space it was spawned from: use posix_spawn (no copy of
+    // the benchmark's memory) and, on Linux, reset the benchmark's own peak first
+#ifdef __linux__
+    ofstream("/proc/self/clear_refs") << "5";
+#endif
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY, 0);
+    vector<char*> argv;
+    argv.push_back(const_cast<char*>(config.backup.c_str()));
+    for (const auto& a : args) argv.push_back(const_cast<char*>(a.c_str()));
+    argv.push_back(nullptr);
+    fs::path previousDir = fs::current_path();
+    fs::current_path(workdir);
+    pid_t pid;
+    int spawned = posix_spawnp(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+    fs::current_path(previousDir);
+    posix_spawn_file_actions_destroy(&actions);
+    if (spawned != 0) throw runtime_error("Failed to start " + config.backup + ": " + strerror(spawned));
+    int status = 0;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0) throw runtime_error("wait4 failed");
+    peakRssKb = usage.ru_maxrss;
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    return 128 + (WIFSIGNALED(status) ? WTERMSIG(status) : 0);
+#endif
+}
+
+//* function to read one counter from the stats the backup binary saved for its last run
+uint64_t lastRunCounter(const fs::path& root, const string& name) {
+    ifstream in(root / ".backup" / "__stats__");
+    string line, key = "counter." + name + ": ";
+    while (getline(in, line)) {
+        if (line.rfind(key, 0) == 0) return stoull(line.substr(key.size()));
+    }
+    return 0;
+}
+
+//* function to time one backup command on a tree
+BenchResult timeStep(const BenchConfig& config, const BenchTree& tree, const string& workload, const string& step,
+                     vector<string> args) {
+    if (config.jobs && args[0] == "do") {
+        args.push_back("--jobs");
+        args.push_back(to_string(config.jobs));
+    }
+    BenchResult r;
+    r.workload = workload;
+    r.step = step;
+    r.files = tree.files.size();
+    r.bytes = tree.bytes;
+    auto start = chrono::steady_clock::now();
+    r.exitCode = runBackup(config, tree.root, args, r.peakRssKb);
+    r.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    r.bytesWritten = lastRunCounter(tree.root, args[0] == "do" ? "bytes_written" : "bytes_restored");
+    cerr << "  " << left << setw(8) << workload << setw(16) << step << right << fixed << setprecision(3)
+         << setw(9) << r.seconds << " s" << (r.exitCode ? "  (exit code " + to_string(r.exitCode) + ")" : "") << endl;
+    return r;
+}
+
+//* function to run all steps of one workload: initial backup, no-op backup, mutation rounds, restore
+vector<BenchResult> runWorkload(const string& name, const BenchConfig& config) {
+    cerr << "Generating workload '" << name << "' ..." << endl;
+    BenchTree tree = generateWorkload(name, config);
+    vector<BenchResult> results;
+    long rss;
+    if (runBackup(config, tree.root, {"init"}, rss) != 0) throw runtime_error("`backup init` failed in " + tree.root.string());
+
+    results.push_back(timeStep(config, tree, name, "do_initial", {"do"}));
+    results.push_back(timeStep(config, tree, name, "do_noop", {"do"}));
+    if (name != "ignore") {
+        BenchRandom random(config.seed * 31 + 7);
+        for (unsigned round = 1; round <= config.rounds; ++round) {
+            mutateTree(tree, config.mutatePercent, random);
+            results.push_back(timeStep(config, tree, name, "do_mutate_" + to_string(round), {"do"}));
+        }
+        // restore into an emptied tree
+        for (const auto& entry : fs::directory_iterator(tree.root)) {
+            if (entry.path().filename() != ".backup") fs::remove_all(entry.path());
+        }
+        results.push_back(timeStep(config, tree, name, "pull_last", {"pull", "--last"}));
+    }
+    if (!config.keep) fs::remove_all(tree.root);
+    return results;
+}
+
+//* function to escape a string for JSON output
+string jsonString(const string& text) {
+    string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') out += '\\';
+        if (static_cast<unsigned char>(c) < 0x20) continue;
+        out += c;
+    }
+    return out + "\"";
+}
+
+//* function to render all results as one JSON document
+string resultsToJson(const BenchConfig& config, const vector<BenchResult>& results) {
+    ostringstream json;
+    json << fixed << setprecision(3);
+    json << "{\n  \"config\": {\"backup\": " << jsonString(config.backup) << ", \"scale\": " << config.scale
+         << ", \"mutate_percent\": " << config.mutatePercent << ", \"rounds\": " << config.rounds
+         << ", \"seed\": " << config.seed << ", \"jobs\": " << config.jobs << "},\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        double seconds = max(r.seconds, 1e-9);
+        json << "    {\"workload\": " << jsonString(r.workload) << ", \"step\": " << jsonString(r.step)
+             << ", \"files\": " << r.files << ", \"bytes\": " << r.bytes << ", \"seconds\": " << r.seconds
+             << ", \"files_per_sec\": " << r.files / seconds << ", \"mb_per_sec\": " << r.bytes / seconds / 1e6
+             << ", \"peak_rss_kb\": " << r.peakRssKb << ", \"bytes_written\": " << r.bytesWritten
+             << ", \"exit_code\": " << r.exitCode << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    json << "  ]\n}\n";
+    return json.str();
+}
+
+//* function to show the benchmark options
+void showBenchHelp() {
+    cout << "Usage: benchmark [options]\n";
+    cout << "  --backup PATH        -> backup binary to measure (default: backup from PATH)\n";
+    cout << "  --dir D              -> where the workload trees are generated (must be empty or new)\n";
+    cout << "  --workloads a,b      -> tiny, huge, deep, ignore (default: all)\n";
+    cout << "  --scale X            -> size multiplier for every workload (default 1)\n";
+    cout << "  --mutate PCT         -> percent of files edited per mutation round (default 10)\n";
+    cout << "  --rounds N           -> mutation rounds (default 3)\n";
+    cout << "  --seed N             -> seed of the workload generator (default 1)\n";
+    cout << "  --jobs N             -> passed to `backup do`\n";
+    cout << "  --out FILE           -> also write the JSON to FILE\n";
+    cout << "  --keep               -> keep the generated trees\n";
+}
+
+int main(int argc, char* argv[]) {
+    BenchConfig config;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            string arg = argv[i];
+            auto value = [&]() -> string {
+                if (i + 1 >= argc) throw runtime_error("Missing value for " + arg);
+                return argv[++i];
+            };
+            if (arg == "--backup") config.backup = value();
+            else if (arg == "--dir") config.dir = value();
+            else if (arg == "--scale") config.scale = stod(value());
+            else if (arg == "--mutate") config.mutatePercent = unsigned(stoul(value()));
+            else if (arg == "--rounds") config.rounds = unsigned(stoul(value()));
+            else if (arg == "--seed") config.seed = stoull(value());
+            else if (arg == "--jobs") config.jobs = unsigned(stoul(value()));
+            else if (arg == "--out") config.out = value();
+            else if (arg == "--keep") config.keep = true;
+            else if (arg == "--workloads") {
+                config.workloads.clear();
+                stringstream list(value());
+                string name;
+                while (getline(list, name, ',')) config.workloads.push_back(name);
+            } else if (arg == "--help" || arg == "help") {
+                showBenchHelp();
+                return 0;
+            } else {
+                throw runtime_error("Unknown option: " + arg);
+            }
+        }
+        if (config.scale <= 0 || config.mutatePercent > 100) throw runtime_error("--scale must be > 0 and --mutate at most 100");
+        // the benchmark changes directory per run, so a relative binary path is resolved up front
+        if (config.backup.find('/') != string::npos || config.backup.find('\\') != string::npos) {
+            config.backup = fs::absolute(config.backup).string();
+        }
+
+        // the run deletes what it generates, so it never works in a folder that already holds something
+        error_code ec;
+        if (fs::exists(config.dir) && !fs::is_empty(config.dir, ec)) {
+            throw runtime_error("--dir " + config.dir.string() + " is not empty, pick a new or empty folder");
+        }
+        bool createdDir = fs::create_directories(config.dir);
+
+        vector<BenchResult> results;
+        for (const auto& name : config.workloads) {
+            auto workload = runWorkload(name, config);
+            results.insert(results.end(), workload.begin(), workload.end());
+        }
+        string json = resultsToJson(config, results);
+        cout << json;
+        if (!config.out.empty()) ofstream(config.out) << json;
+        if (!config.keep && createdDir) fs::remove(config.dir, ec);  // only if empty: the workload trees are gone
+    } catch (const exception& e) {
+        cerr << "Error running benchmark: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}